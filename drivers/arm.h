@@ -1,6 +1,8 @@
 #ifndef ARM_H
 #define ARM_H
 
+#include <stdint.h>
+
 // Portable across ARMv7 and ARMv8 Aarch32
 
 static inline void int_enable()
@@ -12,9 +14,30 @@ static inline void int_disable()
     asm volatile ("cpsid i");
 }
 
+// Event register: SEV (e.g. from an ISR after setting a completion flag)
+// makes the next (or current) WFE return, so that checking a flag and then
+// waiting is race-free without masking interrupts.
+static inline void send_event()
+{
+    asm volatile ("dsb\n\tsev" ::: "memory");
+}
+static inline void wait_for_event()
+{
+    asm volatile ("wfe" ::: "memory");
+}
+
 
 // Enables/disables interrupts that bypass the interrupt controller
 void sys_ints_enable();
 void sys_ints_disable();
 
+// Critical section usable from both thread and ISR context: returns the
+// previous interrupt mask state, to be passed to int_restore.
+unsigned int_save_disable();
+void int_restore(unsigned state);
+
+// Free-running CPU cycle counter, for benchmarks (wraps around)
+void cycle_counter_enable();
+uint32_t cycle_counter_read();
+
 #endif // ARM_H
@@ -1,3 +1,4 @@
+#include "regops.h"
 #include "systick.h"
 
 #include "arm.h" // the interface being implemented
@@ -13,3 +14,34 @@ void sys_ints_disable()
     systick_disable();
     // others (see comment above)
 }
+
+unsigned int_save_disable()
+{
+    unsigned primask;
+    asm volatile ("mrs %0, primask\n"
+                  "cpsid i\n" : "=r" (primask));
+    return primask;
+}
+
+void int_restore(unsigned state)
+{
+    asm volatile ("msr primask, %0" : : "r" (state));
+}
+
+#define DEMCR                   0xe000edfc
+#define DEMCR__TRCENA           (1 << 24)
+#define DWT_CTRL                0xe0001000
+#define DWT_CTRL__CYCCNTENA     (1 << 0)
+#define DWT_CYCCNT              0xe0001004
+
+void cycle_counter_enable()
+{
+    REG_SET32(DEMCR, DEMCR__TRCENA);
+    REG_WRITE32(DWT_CYCCNT, 0);
+    REG_SET32(DWT_CTRL, DWT_CTRL__CYCCNTENA);
+}
+
+uint32_t cycle_counter_read()
+{
+    return REG_READ32(DWT_CYCCNT);
+}
@@ -9,3 +9,39 @@ void sys_ints_disable()
 {
     // None that we care about so far
 }
+
+#define CPSR__I (1 << 7)
+
+unsigned int_save_disable()
+{
+    unsigned cpsr;
+    asm volatile ("mrs %0, cpsr\n"
+                  "cpsid i\n" : "=r" (cpsr));
+    return cpsr & CPSR__I;
+}
+
+void int_restore(unsigned state)
+{
+    if (!(state & CPSR__I))
+        asm volatile ("cpsie i");
+}
+
+#define PMCR__E                 (1 << 0)
+#define PMCR__C                 (1 << 2)
+#define PMCNTEN__C              (1u << 31)
+
+void cycle_counter_enable()
+{
+    uint32_t pmcr;
+    asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (pmcr));
+    pmcr |= PMCR__E | PMCR__C; // enable and reset
+    asm volatile("mcr p15, 0, %0, c9, c12, 0" : : "r" (pmcr));
+    asm volatile("mcr p15, 0, %0, c9, c12, 1" : : "r" (PMCNTEN__C));
+}
+
+uint32_t cycle_counter_read()
+{
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (val));
+    return val;
+}
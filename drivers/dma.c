@@ -1,14 +1,21 @@
+#define DEBUG 0
+
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "arm.h"
 #include "hwinfo.h"
 #include "regops.h"
 #include "object.h"
 #include "mem.h"
 #include "dma.h"
 #include "bit.h"
+#include "panic.h"
 
+// Dump of the microcode generated for each transfer
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
 #define PL330_DEBUG_MCGEN
+#endif
 
 // Type renaming to bridge to Linux driver source
 
@@ -255,7 +262,9 @@ static unsigned cmd_line;
 #endif
 
 #define MAX_CHANS               8
+#define MAX_TXES                DMA_MAX_TXES
 #define MCBUFSZ                 128
+#define MAX_SG_BATCH            8 // bound on segments per program (actual is smaller)
 #define BURST_LEN_BITS          4 // See Table 3-21
 #define BURST_LEN               (1 << BURST_LEN_BITS)
 #define BURST_SIZE_BITS         4  // See Table 3-21
@@ -351,6 +360,19 @@ struct _pl330_req {
         void *cb_arg;
         int rc;
         struct dma_tx *tx;
+
+	/*
+	 * Shape of the program last compiled into mc_cpu, so that a batch of
+	 * the same shape is set up by patching only the SAR/DAR immediates.
+	 * The program is valid only if mc_nxfers is non-zero.
+	 */
+	u32 mc_ccr;
+	enum dma_transfer_direction mc_rqtype;
+	unsigned mc_peri;
+	unsigned mc_nxfers;
+	bool mc_full; /* batch was cut short because slot was full */
+	u32 mc_bytes[MAX_SG_BATCH];
+	u16 mc_xfer_off[MAX_SG_BATCH]; /* offset of DMAMOV SAR of each xfer */
 };
 
 /* A DMAC Thread */
@@ -375,6 +397,12 @@ struct pl330_dmac {
 
     /* Size of MicroCode buffers for each channel. */
     unsigned mcbufsz;
+    /* Channels in use: limited by HW and by space for microcode */
+    unsigned num_chan;
+    /* Transfers waiting for any free channel (FIFO ring) */
+    struct dma_tx *txq[MAX_TXES];
+    unsigned txq_head;
+    unsigned txq_len;
     /* ioremap'ed address of PL330 registers. */
     void __iomem	*base;
     /* Populated by the PL330 core driver during pl330_add */
@@ -464,15 +492,26 @@ struct dma_pl330_desc {
 struct _xfer_spec {
     u32 ccr;
     struct dma_pl330_desc *desc;
+    const struct pl330_xfer *xfers;
+    unsigned nxfers;
 };
 
 struct dma_tx {
+    struct object obj;
     struct dma_pl330_desc desc;
-    struct _pl330_req *req;
+    struct _pl330_req *req; // the req slot whose completion the client reaps
+    struct pl330_thread *thrd;
+    u32 ccr;
+    dma_cb_t cb;
+    void *cb_arg;
+    struct dma_sg seg; // backing store for the segment of a simple transfer
+    const struct dma_sg *sg;
+    unsigned nsegs;
+    unsigned seg_next; // first segment not yet compiled into a req slot
+    volatile bool done; // set by ISR, followed by SEV to wake WFE waiters
 };
 
 #define MAX_DMAS  8
-#define MAX_TXES  8
 static struct pl330_dmac dmas[MAX_DMAS];
 static struct dma_tx txes[MAX_TXES];
 
@@ -963,6 +1002,19 @@ static inline int _ldst_memtomem(unsigned dry_run, u8 buf[],
 	return off;
 }
 
+/*
+ * A single request moves one beat, so bursts of more than one beat need
+ * burst requests from the peripheral.
+ */
+static inline enum pl330_cond _periph_cond(struct pl330_dmac *pl330,
+					   const struct _xfer_spec *pxs)
+{
+	if ((pl330->quirks & PL330_QUIRK_BROKEN_NO_FLUSHP) ||
+	    pxs->desc->rqcfg.brst_len > 1)
+		return BURST;
+	return SINGLE;
+}
+
 static inline int _ldst_devtomem(struct pl330_dmac *pl330, unsigned dry_run,
 				 u8 buf[], const struct _xfer_spec *pxs,
 				 int cyc)
@@ -970,10 +1022,7 @@ static inline int _ldst_devtomem(struct pl330_dmac *pl330, unsigned dry_run,
 	int off = 0;
 	enum pl330_cond cond;
 
-	if (pl330->quirks & PL330_QUIRK_BROKEN_NO_FLUSHP)
-		cond = BURST;
-	else
-		cond = SINGLE;
+	cond = _periph_cond(pl330, pxs);
 
 	while (cyc--) {
 		off += _emit_WFP(dry_run, &buf[off], cond, pxs->desc->peri);
@@ -995,10 +1044,7 @@ static inline int _ldst_memtodev(struct pl330_dmac *pl330,
 	int off = 0;
 	enum pl330_cond cond;
 
-	if (pl330->quirks & PL330_QUIRK_BROKEN_NO_FLUSHP)
-		cond = BURST;
-	else
-		cond = SINGLE;
+	cond = _periph_cond(pl330, pxs);
 
 	while (cyc--) {
 		off += _emit_WFP(dry_run, &buf[off], cond, pxs->desc->peri);
@@ -1120,9 +1166,9 @@ static inline int _loop(struct pl330_dmac *pl330, unsigned dry_run, u8 buf[],
 
 static inline int _setup_loops(struct pl330_dmac *pl330,
 			       unsigned dry_run, u8 buf[],
-			       const struct _xfer_spec *pxs)
+			       const struct _xfer_spec *pxs,
+			       const struct pl330_xfer *x)
 {
-	struct pl330_xfer *x = &pxs->desc->px;
 	u32 ccr = pxs->ccr;
 	unsigned long c, bursts = BYTE_TO_BURST(x->bytes, ccr);
 	int off = 0;
@@ -1138,9 +1184,9 @@ static inline int _setup_loops(struct pl330_dmac *pl330,
 
 static inline int _setup_xfer(struct pl330_dmac *pl330,
 			      unsigned dry_run, u8 buf[],
-			      const struct _xfer_spec *pxs)
+			      const struct _xfer_spec *pxs,
+			      const struct pl330_xfer *x)
 {
-	struct pl330_xfer *x = &pxs->desc->px;
 	int off = 0;
 
 	/* DMAMOV SAR, x->src_addr */
@@ -1149,7 +1195,7 @@ static inline int _setup_xfer(struct pl330_dmac *pl330,
 	off += _emit_MOV(dry_run, &buf[off], DAR, x->dst_addr);
 
 	/* Setup Loop(s) */
-	off += _setup_loops(pl330, dry_run, &buf[off], pxs);
+	off += _setup_loops(pl330, dry_run, &buf[off], pxs, x);
 
 	return off;
 }
@@ -1159,21 +1205,27 @@ static int _setup_req(struct pl330_dmac *pl330, unsigned dry_run,
 		      struct _xfer_spec *pxs)
 {
 	struct _pl330_req *req = &thrd->req[index];
-	struct pl330_xfer *x;
+	const struct pl330_xfer *x;
 	u8 *buf = req->mc_cpu;
 	int off = 0;
+	unsigned i;
 
 	PL330_DBGMC_START(req->mc_bus);
 
 	/* DMAMOV CCR, ccr */
 	off += _emit_MOV(dry_run, &buf[off], CCR, pxs->ccr);
 
-	x = &pxs->desc->px;
-	/* Error if xfer length is not aligned at burst size */
-	if (x->bytes % (BRST_SIZE(pxs->ccr) * BRST_LEN(pxs->ccr)))
-		return -EINVAL;
+	/* All xfers of the spec go into one program (scatter-gather) */
+	for (i = 0; i < pxs->nxfers; i++) {
+		x = &pxs->xfers[i];
+		/* Error if xfer length is not aligned at burst size */
+		if (x->bytes % (BRST_SIZE(pxs->ccr) * BRST_LEN(pxs->ccr)))
+			return -EINVAL;
 
-	off += _setup_xfer(pl330, dry_run, &buf[off], pxs);
+		if (!dry_run)
+			req->mc_xfer_off[i] = off;
+		off += _setup_xfer(pl330, dry_run, &buf[off], pxs, x);
+	}
 
 	/* DMASEV peripheral/event */
 	off += _emit_SEV(dry_run, &buf[off], thrd->ev);
@@ -1273,12 +1325,14 @@ static inline void _reset_thread(struct pl330_thread *thrd)
 	thrd->req[0].mc_bus = (u32)(pl330->mcode_bus
 				+ (thrd->id * pl330->mcbufsz));
 	thrd->req[0].desc = NULL;
+	thrd->req[0].mc_nxfers = 0;
 
 	thrd->req[1].mc_cpu = (void *)(thrd->req[0].mc_cpu
 				+ pl330->mcbufsz / 2);
 	thrd->req[1].mc_bus = (u32)(thrd->req[0].mc_bus
 				+ pl330->mcbufsz / 2);
 	thrd->req[1].desc = NULL;
+	thrd->req[1].mc_nxfers = 0;
 
 	thrd->req_running = -1;
 }
@@ -1300,15 +1354,19 @@ struct dma *dma_create(const char *name, uintptr_t base,
 
     read_dmac_config(d);
 
-    if (mcode_sz < MCBUFSZ * d->pcfg.num_chan) {
-        printf("DMA: microcode space too small: %x <= %\r\n",
-               mcode_sz, MCBUFSZ * d->pcfg.num_chan);
-        OBJECT_FREE(d);
-        return NULL;
+    d->num_chan = d->pcfg.num_chan;
+    if (mcode_sz < MCBUFSZ * d->num_chan) {
+        d->num_chan = mcode_sz / MCBUFSZ;
+        WPRINTF("DMA: microcode space for only %u of %u channels: %x < %x\r\n",
+                d->num_chan, d->pcfg.num_chan, mcode_sz, MCBUFSZ * d->pcfg.num_chan);
+        if (!d->num_chan) {
+            OBJECT_FREE(d);
+            return NULL;
+        }
     }
 
     /* Init Channel threads */
-    for (unsigned i = 0; i < d->pcfg.num_chan; i++) {
+    for (unsigned i = 0; i < d->num_chan; i++) {
         struct pl330_thread *thrd = &d->channels[i];
         thrd->id = i;
         thrd->dmac = d;
@@ -1316,7 +1374,7 @@ struct dma *dma_create(const char *name, uintptr_t base,
         thrd->free = true;
     }
 
-    printf("DMA %s: created\r\n", d->name);
+    IPRINTF("DMA %s: created\r\n", d->name);
     return (struct dma *)d;
 }
 
@@ -1324,69 +1382,447 @@ void dma_destroy(struct dma *dma)
 {
     struct pl330_dmac *pl330 = (struct pl330_dmac *)dma; // TODO: rename?
 
-    printf("DMA %s: destroy\r\n", pl330->name);
+    IPRINTF("DMA %s: destroy\r\n", pl330->name);
 
     // TODO: kill threads?
     OBJECT_FREE(pl330);
 }
 
-struct dma_tx *dma_transfer(struct dma *dma, unsigned chan,
-                            uint32_t *src, uint32_t *dst, unsigned sz,
-                            dma_cb_t cb, void *cb_arg)
+// Memory-to-memory copies may have any alignment and size: the DMA moves
+// the body of each segment in whole bursts of the widest beat at which both
+// src and dst can be aligned, and the CPU copies the head (up to the first
+// aligned address) and the tail (shorter than a burst). Peripheral
+// transfers are validated to consist of only the body.
+static unsigned _beat_bits(const struct dma_sg *sg, unsigned nsegs)
 {
-    struct pl330_dmac *pl330 = (struct pl330_dmac *)dma; // TODO: rename?
+    unsigned bits = BURST_SIZE_BITS;
+    unsigned i;
+
+    for (i = 0; i < nsegs; ++i) {
+        uint32_t skew = (uint32_t)sg[i].src ^ (uint32_t)sg[i].dst;
+        while (bits && (skew & ALIGN_MASK(bits)))
+            bits--;
+    }
+    return bits;
+}
 
-    printf("DMA %s: chan %u: %p -> %p sz %x\r\n",
-           pl330->name, chan, src, dst, sz);
+static void _seg_body(const struct dma_tx *tx, const struct dma_sg *seg,
+                      struct pl330_xfer *x)
+{
+    unsigned burst = BRST_SIZE(tx->ccr) * BRST_LEN(tx->ccr);
+    unsigned head = 0;
 
-    if (chan >= pl330->pcfg.num_chan) {
-        printf("DMA: invalid channel %u (>= %u)\r\n", chan, pl330->pcfg.num_chan);
-        return NULL;
+    if (tx->desc.rqtype == DMA_MEM_TO_MEM) {
+        head = (0 - (uint32_t)seg->dst) & (BRST_SIZE(tx->ccr) - 1);
+        if (head > seg->sz)
+            head = seg->sz;
     }
+    x->src_addr = (u32)seg->src + head;
+    x->dst_addr = (u32)seg->dst + head;
+    x->bytes = (seg->sz - head) / burst * burst;
+}
 
-    if (!(ALIGNED(src, TX_BURST_BITS) &&
-          ALIGNED(dst, TX_BURST_BITS) &&
-          ALIGNED(sz, TX_BURST_BITS))) {
-        printf("DMA: ERROR: size/src/dst not aligned to burst bytes: %x\r\n",
-               1 << TX_BURST_BITS);
-        return NULL;
+static void _copy_edges(const struct dma_tx *tx)
+{
+    const struct dma_sg *seg;
+    struct pl330_xfer x;
+    const u8 *src;
+    u8 *dst;
+    unsigned i, head, tail;
+
+    for (i = 0; i < tx->nsegs; ++i) {
+        seg = &tx->sg[i];
+        _seg_body(tx, seg, &x);
+        head = x.src_addr - (u32)seg->src;
+        tail = seg->sz - head - x.bytes;
+
+        src = (const u8 *)seg->src;
+        dst = (u8 *)seg->dst;
+        while (head--)
+            *dst++ = *src++;
+
+        src = (const u8 *)(x.src_addr + x.bytes);
+        dst = (u8 *)(x.dst_addr + x.bytes);
+        while (tail--)
+            *dst++ = *src++;
+    }
+}
+
+// Whether the slot holds a program compiled for the same config as the tx
+static bool _mc_match(const struct _pl330_req *req, const struct dma_tx *tx)
+{
+    return req->mc_nxfers && req->mc_ccr == tx->ccr &&
+           req->mc_rqtype == tx->desc.rqtype && req->mc_peri == tx->desc.peri;
+}
+
+// Whether the program cached in the slot is the one that compiling the
+// given segments would produce (modulo addresses)
+static bool _mc_hit(const struct _pl330_req *req, const struct dma_tx *tx,
+                    const struct dma_sg *sg, unsigned nsegs)
+{
+    struct pl330_xfer x;
+    unsigned i;
+
+    if (!_mc_match(req, tx) || nsegs < req->mc_nxfers)
+        return false;
+    if (nsegs > req->mc_nxfers && !req->mc_full)
+        return false; // would pack more segments into the slot
+    for (i = 0; i < req->mc_nxfers; ++i) {
+        _seg_body(tx, &sg[i], &x);
+        if (req->mc_bytes[i] != x.bytes)
+            return false;
+    }
+    return true;
+}
+
+// Whether a segment of this size is known to fit into a slot, because a
+// program containing it is cached in one of the slots of any thread
+static bool _mc_fits(struct pl330_dmac *pl330, const struct dma_tx *tx,
+                     unsigned bytes)
+{
+    unsigned c, r, i;
+
+    for (c = 0; c < pl330->num_chan; ++c) {
+        for (r = 0; r < 2; ++r) {
+            const struct _pl330_req *req = &pl330->channels[c].req[r];
+            if (!_mc_match(req, tx))
+                continue;
+            for (i = 0; i < req->mc_nxfers; ++i)
+                if (req->mc_bytes[i] == bytes)
+                    return true;
+        }
     }
+    return false;
+}
 
-    // Only use req 0 ever. NOTE: this is not channel number, this is a request
-    // queue (of length 2) from the Linux driver, which we don't use (for
-    // simplicity) but keep to avoid changing the code copied from Linux.
-    u32 idx = 0;
+// Point the xfers of the program cached in the slot at new addresses
+static void _mc_patch(struct _pl330_req *req, const struct dma_tx *tx,
+                      const struct dma_sg *sg)
+{
+    u8 *buf = req->mc_cpu;
+    struct pl330_xfer x;
+    unsigned i, off;
+
+    for (i = 0; i < req->mc_nxfers; ++i) {
+        _seg_body(tx, &sg[i], &x);
+        off = req->mc_xfer_off[i];
+        off += _emit_MOV(0, &buf[off], SAR, x.src_addr);
+        _emit_MOV(0, &buf[off], DAR, x.dst_addr);
+    }
+}
 
-    struct pl330_thread *thrd = &pl330->channels[chan];
+// Compile as many segments (starting with tx->seg_next) as fit into the
+// microcode buffer of request slot idx, and arm the slot. Returns the
+// number of segments compiled or negative on error. If the slot already
+// holds a program of the same shape, only its addresses are patched.
+static int _compile_batch(struct pl330_dmac *pl330, struct dma_tx *tx,
+                          unsigned idx)
+{
+    struct pl330_thread *thrd = tx->thrd;
     struct _pl330_req *req = &thrd->req[idx];
+    const struct dma_sg *sg = &tx->sg[tx->seg_next];
+    unsigned nsegs = tx->nsegs - tx->seg_next;
+    struct pl330_xfer xfers[MAX_SG_BATCH];
+    struct _xfer_spec xs;
+    unsigned n = 0, i;
+    int ret;
+
+    if (_mc_hit(req, tx, sg, nsegs)) {
+        _mc_patch(req, tx, sg);
+        n = req->mc_nxfers;
+        goto arm;
+    }
+
+    xs.ccr = tx->ccr;
+    xs.desc = &tx->desc;
+    xs.xfers = xfers;
+
+    /* Dry runs to find how many segments fit into the slot */
+    while (n < MAX_SG_BATCH && tx->seg_next + n < tx->nsegs) {
+        const struct dma_sg *seg = &tx->sg[tx->seg_next + n];
+        _seg_body(tx, seg, &xfers[n]);
+        xs.nxfers = n + 1;
+
+        ret = _setup_req(pl330, 1, thrd, idx, &xs);
+        if (ret < 0) {
+            EPRINTF("DMA: failed to construct request\r\n");
+            return ret;
+        }
+        if (ret > pl330->mcbufsz / 2) {
+            if (!n) {
+                EPRINTF("DMA: microcode buffer too small for req: %u > %u)\r\n",
+                       ret, pl330->mcbufsz / 2);
+                return -EINVAL;
+            }
+            break;
+        }
+        n++;
+    }
+
+    xs.nxfers = n;
+    _setup_req(pl330, 0, thrd, idx, &xs);
+
+    req->mc_ccr = tx->ccr;
+    req->mc_rqtype = tx->desc.rqtype;
+    req->mc_peri = tx->desc.peri;
+    req->mc_nxfers = n;
+    req->mc_full = n < nsegs;
+    for (i = 0; i < n; ++i)
+        req->mc_bytes[i] = xfers[i].bytes;
+
+arm:
+    tx->seg_next += n;
+
+    req->desc = &tx->desc;
+    req->tx = tx;
+    req->cb = tx->cb;
+    req->cb_arg = tx->cb_arg;
+    req->rc = -1;
+    thrd->lstenq = idx; // TODO: unused
+    return n;
+}
+
+static void _trigger(struct pl330_thread *thrd, unsigned idx)
+{
+    void __iomem *regs = thrd->dmac->base;
+    u8 insn[6] = {0, 0, 0, 0, 0, 0};
+    struct _arg_GO go;
+
+    go.chan = thrd->id;
+    go.addr = (u32)thrd->req[idx].mc_bus;
+    go.ns = 0; // all users of this driver run in secure mode
+    _emit_GO(0, insn, &go);
+
+    thrd->req_running = idx;
+
+    /* Set to generate interrupts for SEV */
+    writel(readl(regs + INTEN) | (1 << thrd->ev), regs + INTEN);
+
+    _execute_DBGINSN(thrd, insn, /* as manager */ true);
+}
+
+static inline bool _idle(struct pl330_thread *thrd)
+{
+    return !thrd->req[0].desc && !thrd->req[1].desc;
+}
+
+// A thread that is neither allocated to a client nor running a transfer
+static struct pl330_thread *_idle_thread(struct pl330_dmac *pl330)
+{
+    for (unsigned i = 0; i < pl330->num_chan; ++i) {
+        struct pl330_thread *thrd = &pl330->channels[i];
+        if (thrd->free && _idle(thrd))
+            return thrd;
+    }
+    return NULL;
+}
+
+// Compile the first batch(es) of the tx into the thread's slots and start it
+static void _launch(struct pl330_dmac *pl330, struct dma_tx *tx,
+                    struct pl330_thread *thrd)
+{
+    int rc;
+
+    tx->thrd = thrd;
+    tx->req = &thrd->req[0];
+    tx->desc.status = BUSY;
+
+    thrd->ev = thrd->id; // one-to-one thread-event allocation
+    pl330->events[thrd->ev] = thrd->id;
+
+    // segments were validated on submission, so compilation cannot fail
+    rc = _compile_batch(pl330, tx, 0);
+    ASSERT(rc > 0);
+    if (tx->seg_next < tx->nsegs) {
+        rc = _compile_batch(pl330, tx, 1);
+        ASSERT(rc > 0);
+    }
+
+    _trigger(thrd, 0);
+}
+
+// Start queued transfers on threads that have become idle
+static void _dispatch(struct pl330_dmac *pl330)
+{
+    struct pl330_thread *thrd;
+    unsigned irq_state = int_save_disable();
+
+    while (pl330->txq_len && (thrd = _idle_thread(pl330))) {
+        struct dma_tx *tx = pl330->txq[pl330->txq_head];
+        pl330->txq_head = (pl330->txq_head + 1) % MAX_TXES;
+        pl330->txq_len--;
+        DPRINTF("DMA %s: dequeued tx, starting on chan %u\r\n",
+                pl330->name, thrd->id);
+        _launch(pl330, tx, thrd);
+    }
+
+    int_restore(irq_state);
+}
+
+// Complete the tx that owns request slot 'active' of the thread
+static void _retire(struct pl330_thread *thrd, unsigned active, int rc)
+{
+    struct _pl330_req *req = &thrd->req[active];
+    struct _pl330_req *other = &thrd->req[active ^ 1];
+    struct dma_tx *tx = req->tx;
 
-    if (thrd->req[idx].desc) {
-        printf("DMA: channel %u busy\r\n", idx);
+    thrd->req_running = -1;
+
+    /* Drop a pre-compiled batch that will never run (on abort) */
+    if (other->tx == tx) {
+        other->desc = NULL;
+        other->tx = NULL;
+    }
+
+    tx->req = req;
+    req->rc = rc;
+    tx->desc.status = DONE;
+    tx->done = true;
+    send_event();
+
+    if (req->cb) {
+        req->cb(req->cb_arg, req->rc);
+        req->desc = NULL; // release request state
+        req->tx = NULL;
+        OBJECT_FREE(tx);
+        _dispatch(thrd->dmac);
+    } // else: channel busy until reaped by dma_wait
+}
+
+int dma_chan_alloc(struct dma *dma)
+{
+    struct pl330_dmac *pl330 = (struct pl330_dmac *)dma;
+    unsigned irq_state = int_save_disable();
+    struct pl330_thread *thrd = _idle_thread(pl330);
+    if (thrd)
+        thrd->free = false;
+    int_restore(irq_state);
+
+    if (!thrd) {
+        WPRINTF("DMA %s: no free channels\r\n", pl330->name);
+        return -1;
+    }
+    DPRINTF("DMA %s: allocated chan %u\r\n", pl330->name, thrd->id);
+    return thrd->id | DMA_CHAN_OWNED;
+}
+
+int dma_chan_free(struct dma *dma, unsigned chan)
+{
+    struct pl330_dmac *pl330 = (struct pl330_dmac *)dma;
+    if (!(chan & DMA_CHAN_OWNED) ||
+            (chan & ~DMA_CHAN_OWNED) >= pl330->num_chan) {
+        EPRINTF("DMA %s: free: invalid channel handle 0x%x\r\n",
+                pl330->name, chan);
+        return -1;
+    }
+    chan &= ~DMA_CHAN_OWNED;
+
+    unsigned irq_state = int_save_disable();
+    bool was_free = pl330->channels[chan].free;
+    pl330->channels[chan].free = true;
+    int_restore(irq_state);
+
+    if (was_free) {
+        EPRINTF("DMA %s: free: chan %u not allocated\r\n", pl330->name, chan);
+        return -1;
+    }
+    DPRINTF("DMA %s: freed chan %u\r\n", pl330->name, chan);
+    _dispatch(pl330);
+    return 0;
+}
+
+struct dma_tx *dma_transfer(struct dma *dma, unsigned chan,
+                            uint32_t *src, uint32_t *dst, unsigned sz,
+                            dma_cb_t cb, void *cb_arg)
+{
+    // Copied into the tx, so the list need not outlive this call
+    struct dma_sg seg;
+    seg.src = src;
+    seg.dst = dst;
+    seg.sz = sz;
+    return dma_transfer_sg(dma, chan, &seg, 1, cb, cb_arg);
+}
+
+// Burst of brst_len beats of (1 << brst_size) bytes each. For peripheral
+// transfers, the device side address is not incremented, and each burst
+// is paced by a request from peripheral interface peri.
+static struct dma_tx *_submit(struct pl330_dmac *pl330, unsigned chan,
+                              const struct dma_sg *sg, unsigned nsegs,
+                              enum dma_transfer_direction rqtype, unsigned peri,
+                              unsigned brst_size, unsigned brst_len,
+                              dma_cb_t cb, void *cb_arg)
+{
+    unsigned burst_bytes;
+    unsigned bytes = 0;
+    unsigned i;
+    bool owned = false; // by the caller, from dma_chan_alloc
+
+    if (chan != DMA_CHAN_ANY) {
+        owned = chan & DMA_CHAN_OWNED;
+        chan &= ~DMA_CHAN_OWNED;
+    }
+    if (chan != DMA_CHAN_ANY && chan >= pl330->num_chan) {
+        EPRINTF("DMA: invalid channel %u (>= %u)\r\n", chan, pl330->num_chan);
+        return NULL;
+    }
+
+    if (!nsegs) {
+        EPRINTF("DMA: ERROR: no segments in transfer\r\n");
         return NULL;
     }
 
+    if (rqtype == DMA_MEM_TO_MEM)
+        brst_size = _beat_bits(sg, nsegs);
+    burst_bytes = (1 << brst_size) * brst_len;
+
+    for (i = 0; i < nsegs; ++i) {
+        DPRINTF("DMA %s: chan %u: seg %u: %p -> %p sz %x\r\n",
+                pl330->name, chan, i, sg[i].src, sg[i].dst, sg[i].sz);
+
+        if (rqtype != DMA_MEM_TO_MEM &&
+            !(ALIGNED(sg[i].src, brst_size) &&
+              ALIGNED(sg[i].dst, brst_size) &&
+              sg[i].sz % burst_bytes == 0)) {
+            EPRINTF("DMA: ERROR: src/dst not aligned to %x or size to burst bytes: %x\r\n",
+                    1 << brst_size, burst_bytes);
+            return NULL;
+        }
+        bytes += sg[i].sz;
+    }
+
     void __iomem *regs = pl330->base;
 
-    printf("DMA %s: INS %08x\r\n", pl330->name, readl(regs + CR3));
+    DPRINTF("DMA %s: INS %08x\r\n", pl330->name, readl(regs + CR3));
 
     struct dma_tx *tx = OBJECT_ALLOC(txes);
     if (!tx)
         return NULL;
-    tx->req = req;
-    req->tx = tx;
+
+    if (nsegs == 1) { // field-wise, because GCC may insert a memcpy
+        tx->seg.src = sg[0].src;
+        tx->seg.dst = sg[0].dst;
+        tx->seg.sz = sg[0].sz;
+        sg = &tx->seg;
+    }
+    tx->sg = sg;
+    tx->nsegs = nsegs;
+    tx->seg_next = 0;
+    tx->done = false;
+    tx->cb = cb;
+    tx->cb_arg = cb_arg;
 
     struct dma_pl330_desc *desc = &tx->desc;
-    desc->px.src_addr = (u32)src;
-    desc->px.dst_addr = (u32)dst;
-    desc->px.bytes = sz;
+    desc->px.src_addr = (u32)sg[0].src;
+    desc->px.dst_addr = (u32)sg[0].dst;
+    desc->px.bytes = sg[0].sz;
 
-    desc->rqcfg.dst_inc = 1;
-    desc->rqcfg.src_inc = 1;
+    desc->rqcfg.dst_inc = rqtype != DMA_MEM_TO_DEV;
+    desc->rqcfg.src_inc = rqtype != DMA_DEV_TO_MEM;
     desc->rqcfg.nonsecure = 0;
     desc->rqcfg.privileged = 1;
     desc->rqcfg.insnaccess = 1;
-    desc->rqcfg.brst_len = BURST_LEN;
-    desc->rqcfg.brst_size = BURST_SIZE_BITS;
+    desc->rqcfg.brst_len = brst_len;
+    desc->rqcfg.brst_size = brst_size;
 
     desc->rqcfg.dcctl = CCTRL0;
     desc->rqcfg.scctl = CCTRL0;
@@ -1394,76 +1830,184 @@ struct dma_tx *dma_transfer(struct dma *dma, unsigned chan,
 
     desc->rqcfg.pcfg = &pl330->pcfg;
 
-    desc->status = BUSY;
+    desc->status = PREP;
 
-    desc->bytes_requested = sz; // TODO: unused
+    desc->bytes_requested = bytes; // TODO: unused
     desc->last = 1;             // TODO: unused
 
-    desc->rqtype = DMA_MEM_TO_MEM;
-    desc->peri = 0;
+    desc->rqtype = rqtype;
+    desc->peri = peri;
+
+    tx->ccr = _prepare_ccr(&desc->rqcfg);
+
+    // Check that every segment fits by itself in a request slot, so that
+    // compiling (possibly later, from the event ISR) cannot fail.
+    for (i = 0; i < nsegs; ++i) {
+        struct pl330_xfer x;
+        struct _xfer_spec xs;
+        _seg_body(tx, &sg[i], &x);
+        if (_mc_fits(pl330, tx, x.bytes))
+            continue;
+        xs.ccr = tx->ccr;
+        xs.desc = desc;
+        xs.xfers = &x;
+        xs.nxfers = 1;
+        int ret = _setup_req(pl330, 1, &pl330->channels[0], 0, &xs);
+        if (ret < 0 || ret > pl330->mcbufsz / 2) {
+            EPRINTF("DMA: microcode buffer too small for seg %u: %d > %u\r\n",
+                    i, ret, pl330->mcbufsz / 2);
+            OBJECT_FREE(tx);
+            return NULL;
+        }
+    }
 
-    u32 ccr = _prepare_ccr(&desc->rqcfg);
+    // The two request slots per thread (a queue of length 2 in the Linux
+    // driver) hold consecutive batches of the segment list: while one runs,
+    // the other is already compiled, so the event ISR chains them.
+    unsigned irq_state = int_save_disable();
+    struct pl330_thread *thrd;
 
-    thrd->ev = chan; // one-to-one thread-event allocation 
+    if (chan == DMA_CHAN_ANY) {
+        thrd = _idle_thread(pl330);
+        if (!thrd) {
+            ASSERT(pl330->txq_len < MAX_TXES); // at most one entry per tx
+            pl330->txq[(pl330->txq_head + pl330->txq_len) % MAX_TXES] = tx;
+            pl330->txq_len++;
+        }
+    } else {
+        thrd = &pl330->channels[chan];
+        if (thrd->free == owned) {
+            int_restore(irq_state);
+            EPRINTF("DMA: channel %u %s\r\n", chan,
+                    owned ? "not allocated" : "allocated to another client");
+            OBJECT_FREE(tx);
+            return NULL;
+        }
+        if (!_idle(thrd)) {
+            int_restore(irq_state);
+            WPRINTF("DMA: channel %u busy\r\n", chan);
+            OBJECT_FREE(tx);
+            return NULL;
+        }
+    }
 
-    struct _xfer_spec xs;
-    xs.ccr = ccr;
-    xs.desc = desc;
+    if (thrd)
+        _launch(pl330, tx, thrd);
 
-    /* First dry run to check if req is acceptable */
-    int ret = _setup_req(pl330, 1, thrd, idx, &xs);
-    if (ret < 0) {
-        printf("DMA: failed to construct request\r\n");
-        OBJECT_FREE(tx);
+    // Edges are copied only once the tx is launched or queued, so that a
+    // rejected tx leaves the destination untouched. Interrupts are still
+    // off, so the destination is complete by the time the completion ISR
+    // (or a dispatch from the queue) can run.
+    if (rqtype == DMA_MEM_TO_MEM)
+        _copy_edges(tx);
+    int_restore(irq_state);
+
+    if (!thrd)
+        DPRINTF("DMA %s: all channels busy, tx queued (%u)\r\n",
+                pl330->name, pl330->txq_len);
+    return tx;
+}
+
+struct dma_tx *dma_transfer_sg(struct dma *dma, unsigned chan,
+                               const struct dma_sg *sg, unsigned nsegs,
+                               dma_cb_t cb, void *cb_arg)
+{
+    struct pl330_dmac *pl330 = (struct pl330_dmac *)dma; // TODO: rename?
+    return _submit(pl330, chan, sg, nsegs, DMA_MEM_TO_MEM, 0,
+                   BURST_SIZE_BITS, BURST_LEN, cb, cb_arg);
+}
+
+static struct dma_tx *_submit_periph(struct pl330_dmac *pl330, unsigned chan,
+                                     const struct dma_periph *periph,
+                                     enum dma_transfer_direction rqtype,
+                                     uint32_t *mem, unsigned sz,
+                                     dma_cb_t cb, void *cb_arg)
+{
+    struct dma_sg seg;
+
+    if (periph->peri >= pl330->pcfg.num_peri) {
+        EPRINTF("DMA %s: invalid peripheral request interface %u (>= %u)\r\n",
+                pl330->name, periph->peri, pl330->pcfg.num_peri);
         return NULL;
     }
-
-    if (ret > pl330->mcbufsz / 2) {
-        printf("DMA: microcode buffer too small for req: %u > %u)\r\n",
-               ret, pl330->mcbufsz / 2);
-        OBJECT_FREE(tx);
+    if (periph->width_bits > 3 || // 64-bit bus, see Table 3-21
+        periph->burst < 1 || periph->burst > (1 << BURST_LEN_BITS)) {
+        EPRINTF("DMA %s: invalid peripheral beat width %u or burst %u\r\n",
+                pl330->name, 1 << periph->width_bits, periph->burst);
         return NULL;
     }
 
-    thrd->lstenq = idx; // TODO: unused
-    thrd->req_running = idx;
-
-    req->desc = desc;
-    req->cb = cb;
-    req->cb_arg = cb_arg;
-    req->rc = -1;
+    if (rqtype == DMA_MEM_TO_DEV) {
+        seg.src = mem;
+        seg.dst = (uint32_t *)periph->fifo;
+    } else {
+        seg.src = (uint32_t *)periph->fifo;
+        seg.dst = mem;
+    }
+    seg.sz = sz;
+    return _submit(pl330, chan, &seg, 1, rqtype, periph->peri,
+                   periph->width_bits, periph->burst, cb, cb_arg);
+}
 
-    _setup_req(pl330, 0, thrd, idx, &xs);
+struct dma_tx *dma_transfer_to_periph(struct dma *dma, unsigned chan,
+                                      const struct dma_periph *periph,
+                                      const void *src, unsigned sz,
+                                      dma_cb_t cb, void *cb_arg)
+{
+    return _submit_periph((struct pl330_dmac *)dma, chan, periph,
+                          DMA_MEM_TO_DEV, (uint32_t *)src, sz, cb, cb_arg);
+}
 
-    u8 insn[6] = {0, 0, 0, 0, 0, 0};
-    struct _arg_GO go;
-    go.chan = 0;
-    go.addr = (u32)thrd->req[idx].mc_bus;
-    go.ns = 0; // all users of this driver run in secure mode
-    _emit_GO(0, insn, &go);
+struct dma_tx *dma_transfer_from_periph(struct dma *dma, unsigned chan,
+                                        const struct dma_periph *periph,
+                                        void *dst, unsigned sz,
+                                        dma_cb_t cb, void *cb_arg)
+{
+    return _submit_periph((struct pl330_dmac *)dma, chan, periph,
+                          DMA_DEV_TO_MEM, (uint32_t *)dst, sz, cb, cb_arg);
+}
 
-    /* Set to generate interrupts for SEV */
-    writel(readl(regs + INTEN) | (1 << thrd->ev), regs + INTEN);
+bool dma_poll(struct dma_tx *tx)
+{
+    return tx->done;
+}
 
-    _execute_DBGINSN(thrd, insn, /* as manager */ true);
-    return tx;
+int dma_wait_any(struct dma_tx **txs, unsigned count)
+{
+    unsigned i;
+    bool pending;
+
+    // No race between the check and the WFE: if the ISR completes a tx in
+    // between, its SEV sets the event register and WFE returns immediately.
+    do {
+        pending = false;
+        for (i = 0; i < count; ++i) {
+            if (!txs[i])
+                continue;
+            if (txs[i]->done)
+                return i;
+            pending = true;
+        }
+        if (pending)
+            wait_for_event();
+    } while (pending);
+    return -1;
 }
 
 int dma_wait(struct dma_tx *tx)
 {
+    while (!tx->done)
+        wait_for_event(); // race-free, see dma_wait_any
+
     struct _pl330_req *req = tx->req;
-    while (req->desc->status != DONE) {
-        printf("DMA: waiting\r\n");
-        // TODO: wfe with sev (otherwise there's a race here, but it's not a
-        // problem as long as we have the watchdog timer, which will wake us up
-        // in case of the race, i.e. sleep after the condition check.)
-        asm("wfi");
-    }
+    struct pl330_dmac *pl330 = tx->thrd->dmac;
     int rc = req->rc;
     req->desc = NULL;
     req->tx = NULL;
     OBJECT_FREE(tx);
-    printf("DMA: completed: rc %u\r\n", rc);
+    if (rc)
+        EPRINTF("DMA %s: tx failed: rc %u\r\n", pl330->name, rc);
+    _dispatch(pl330);
     return rc;
 }
 
@@ -1473,43 +2017,36 @@ void dma_abort_isr(struct dma *dma)
     void __iomem *regs = pl330->base;
     u32 val;
 
-    printf("DMA %s: ISR: abort\r\n", pl330->name);
+    EPRINTF("DMA %s: ISR: abort\r\n", pl330->name);
 
     val = readl(regs + FSM) & 0x1;
 
     if (val) {
-        printf("DMA %s: ISR: abort: FSM %08x\r\n", pl330->name, val);
+        EPRINTF("DMA %s: ISR: abort: FSM %08x\r\n", pl330->name, val);
         _stop(pl330->manager);
     }
 
     val = readl(regs + FSC) & ((1 << pl330->pcfg.num_chan) - 1);
     if (val) {
-        printf("DMA %s: ISR: abort: FSC %08x\r\n", pl330->name, val);
+        EPRINTF("DMA %s: ISR: abort: FSC %08x\r\n", pl330->name, val);
         int i = 0;
         while (i < pl330->pcfg.num_chan) { // TODO: could use CLZ instruction
             if (val & (1 << i)) {
 	        struct pl330_thread *thrd = &pl330->channels[i];
 
-                printf("DMA %s: ISR: abort: reset ch %d CS %x FTC %x\r\n",
+                EPRINTF("DMA %s: ISR: abort: reset ch %d CS %x FTC %x\r\n",
                         pl330->name, i, readl(regs + CS(i)), readl(regs + FTC(i)));
 
                 int active = thrd->req_running;
                 if (active == -1) { // should not happen
-                    printf("DMA %s: ISR: abort: ch %i not running\r\n", pl330->name, i);
+                    EPRINTF("DMA %s: ISR: abort: ch %i not running\r\n", pl330->name, i);
                     continue;
                 }
-                struct _pl330_req *req = &thrd->req[active];
 
                 _stop(thrd);
 
-                req->rc = PL330_ERR_FAIL; // TODO: PL330_ERR_ABORT? (in ABORT ISR but no fault?)
-                req->desc->status = DONE;
-                thrd->req_running = -1;
-
-                if (req->cb) {
-                    req->cb(req->cb_arg, req->rc);
-                    req->desc = NULL; // release request state
-                } // else: channel busy until reaped by dma_wait
+                // TODO: PL330_ERR_ABORT? (in ABORT ISR but no fault?)
+                _retire(thrd, active, PL330_ERR_FAIL);
             }
             i++;
         }
@@ -1523,8 +2060,6 @@ void dma_event_isr(struct dma *dma, unsigned ev)
     int id, active;
     struct pl330_thread *thrd;
 
-    printf("DMA %s: ISR: event %u\r\n", pl330->name, ev);
-
     u32 inten = readl(regs + INTEN);
 
     /* Clear the event */
@@ -1539,23 +2074,29 @@ void dma_event_isr(struct dma *dma, unsigned ev)
 
     active = thrd->req_running;
     if (active == -1) { // aborted, so req->rc and req_running was set in abort ISR
-        printf("DMA %s: ISR: event %u: tx was aborted\r\n",
-               pl330->name, ev);
+        WPRINTF("DMA %s: ISR: event %u: tx was aborted\r\n",
+                pl330->name, ev);
         return;
     }
 
-    /* Detach the req */
     struct _pl330_req *req = &thrd->req[active];
-    req->rc = PL330_ERR_NONE;
-    req->desc->status = DONE;
-    thrd->req_running = -1;
+    struct _pl330_req *next = &thrd->req[active ^ 1];
+    struct dma_tx *tx = req->tx;
 
-    if (req->cb) {
-        req->cb(req->cb_arg, req->rc);
-        struct dma_tx *tx = req->tx;
-        req->desc = NULL; // release request state
+    if (next->desc && next->tx == tx) {
+        /* Chain the pre-compiled batch, then refill the slot just finished */
+        UNTIL(thrd, PL330_STATE_STOPPED);
+        _trigger(thrd, active ^ 1);
+
+        req->desc = NULL;
         req->tx = NULL;
-        OBJECT_FREE(tx);
-    } // else: channel busy until reaped by dma_wait
+        if (tx->seg_next < tx->nsegs) {
+            int rc = _compile_batch(pl330, tx, active);
+            ASSERT(rc > 0); // segments were validated on submission
+        }
+        return;
+    }
+
+    _retire(thrd, active, PL330_ERR_NONE);
 }
 
@@ -2,26 +2,94 @@
 #define DMA_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define DMA_MAX_BURST_BITS  8 // property of HW, see Table 3-21
 #define DMA_MAX_BURST_BYTES (1 << DMA_MAX_BURST_BITS)
 
+// Transfers in flight or queued at once, across all controllers
+#define DMA_MAX_TXES        24
+
 struct dma;
 struct dma_tx;
 
 typedef void (*dma_cb_t)(void *arg, int rc);
 
+// One contiguous piece of a scatter-gather transfer
+struct dma_sg {
+    uint32_t *src;
+    uint32_t *dst;
+    unsigned sz;
+};
+
+// Channel argument to let the driver pick any channel that is not allocated
+// to a client. When all are busy, the transfer is queued and started from
+// the ISR when one becomes free; dma_wait/callback work as usual.
+#define DMA_CHAN_ANY (~0u)
+
 struct dma *dma_create(const char *name, uintptr_t base,
                        uint8_t *mcode_addr, unsigned mcode_sz);
 void dma_destroy(struct dma *dma);
 
+// Reserve a channel for exclusive use by the caller: returns a handle to pass
+// as the channel argument (the channel number with DMA_CHAN_OWNED set), or -1.
+// While allocated, the channel is not used for DMA_CHAN_ANY, and a transfer
+// that names it by number is rejected.
+#define DMA_CHAN_OWNED 0x100u
+int dma_chan_alloc(struct dma *dma);
+// Release a channel from dma_chan_alloc (pass the handle): returns -1 if it
+// was not allocated
+int dma_chan_free(struct dma *dma, unsigned chan);
+
 // If callback is NULL, then must reap with dma_wait
 // TODO: split into compilation and launching methods
 struct dma_tx *dma_transfer(struct dma *dma, unsigned chan,
                             uint32_t *src, uint32_t *dst, unsigned sz,
                             dma_cb_t cb, void *cb_arg);
+
+// All segments are compiled into as few PL330 programs as fit into the
+// channel's microcode buffer, and consecutive programs are chained from the
+// event ISR, so the client is not involved between segments. The segment
+// list must remain valid until the transfer completes (except for nsegs = 1).
+struct dma_tx *dma_transfer_sg(struct dma *dma, unsigned chan,
+                               const struct dma_sg *sg, unsigned nsegs,
+                               dma_cb_t cb, void *cb_arg);
+
+// A device data register (FIFO) wired to one of the DMAC's peripheral
+// request interfaces
+struct dma_periph {
+    volatile void *fifo; // not incremented during the transfer
+    unsigned peri;       // peripheral request interface
+    unsigned width_bits; // log2 of the register width in bytes
+    unsigned burst;      // beats per peripheral request: 1..16
+};
+
+// Each burst waits for a request from the peripheral (WFP), and the request
+// is acknowledged (FLUSHP) after the burst, so the CPU is not involved per
+// byte. The size must be a multiple of the burst (width x beats).
+struct dma_tx *dma_transfer_to_periph(struct dma *dma, unsigned chan,
+                                      const struct dma_periph *periph,
+                                      const void *src, unsigned sz,
+                                      dma_cb_t cb, void *cb_arg);
+struct dma_tx *dma_transfer_from_periph(struct dma *dma, unsigned chan,
+                                        const struct dma_periph *periph,
+                                        void *dst, unsigned sz,
+                                        dma_cb_t cb, void *cb_arg);
+
+// Blocks (in WFE) until the tx completes, then reaps it and returns its rc
 int dma_wait(struct dma_tx *tx);
 
+// Non-blocking: true if the tx has completed (reap it with dma_wait, which
+// will then not block). Only for txes submitted without a callback.
+bool dma_poll(struct dma_tx *tx);
+
+// Blocks until at least one of the txes completes and returns its index
+// (the tx is not reaped); NULL entries are skipped, and -1 is returned if
+// there are no non-NULL entries. To wait on DMA together with other events
+// (e.g. in the main loop), check dma_poll along with the other conditions
+// with interrupts masked and then WFI, since the DMA event IRQ wakes it.
+int dma_wait_any(struct dma_tx **txs, unsigned count);
+
 void dma_abort_isr(struct dma *dma);
 void dma_event_isr(struct dma *dma, unsigned ev);
 
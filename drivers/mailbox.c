@@ -1,3 +1,5 @@
+#define DEBUG 0
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -31,7 +33,7 @@
 #define HPSC_MBOX_INT_A(idx) (1 << (2 * (idx)))      // rcv (map event A to int 'idx')
 #define HPSC_MBOX_INT_B(idx) (1 << (2 * (idx) + 1))  // ack (map event B to int 'idx')
 
-#define HPSC_MBOX_EVENTS 2
+#define HPSC_MBOX_EVENTS 2 // A (rcv) and B (ack), as index: see event_index
 #define HPSC_MBOX_INTS   16
 #define HPSC_MBOX_INSTANCES 32
 #define HPSC_MBOX_INSTANCE_REGION (REG_DATA + HPSC_MBOX_DATA_SIZE)
@@ -43,7 +45,11 @@ struct mbox_ip_block {
         struct object obj;
         uintptr_t base;
         unsigned refcnt;
-        unsigned irq_refcnt[HPSC_MBOX_EVENTS];
+        unsigned irq_refcnt[HPSC_MBOX_INTS];
+        // Claimed instances (bit per instance), by the interrupt and the event
+        // that they are routed to, so that the ISR visits only those
+        uint32_t subscribers[HPSC_MBOX_INTS][HPSC_MBOX_EVENTS];
+        struct mbox *mboxes[HPSC_MBOX_INSTANCES];
 };
 
 struct mbox {
@@ -52,8 +58,12 @@ struct mbox {
         uintptr_t base;
         unsigned instance;
         int int_idx;
+        unsigned event; // HPSC_MBOX_EVENT_*: A if incoming, B if outgoing
         struct irq *irq;
         bool owner; // whether this mailbox was claimed as owner
+#if CONFIG_MBOX_MSG_LEN
+        bool msg_len; // length-aware messages, see mailbox.h
+#endif // CONFIG_MBOX_MSG_LEN
         union mbox_cb cb;
         void *cb_arg;
 };
@@ -63,15 +73,33 @@ struct mbox {
 static struct mbox mboxes[MAX_MBOXES] = {0};
 static struct mbox_ip_block blocks[MAX_BLOCKS] = {0};
 
+static unsigned event_index(unsigned event)
+{
+    return event == HPSC_MBOX_EVENT_A ? 0 : 1;
+}
+
 static void mbox_irq_subscribe(struct mbox *mbox)
 {
-    if (mbox->block->irq_refcnt[mbox->int_idx]++ == 0)
+    struct mbox_ip_block *b = mbox->block;
+
+    // Before the interrupt is enabled, since it might fire right away
+    b->mboxes[mbox->instance] = mbox;
+    b->subscribers[mbox->int_idx][event_index(mbox->event)] |=
+        1 << mbox->instance;
+
+    if (b->irq_refcnt[mbox->int_idx]++ == 0)
         intc_int_enable(mbox->irq);
 }
 static void mbox_irq_unsubscribe(struct mbox *mbox)
 {
-    if (--mbox->block->irq_refcnt[mbox->int_idx] == 0)
+    struct mbox_ip_block *b = mbox->block;
+
+    if (--b->irq_refcnt[mbox->int_idx] == 0)
         intc_int_disable(mbox->irq);
+
+    b->subscribers[mbox->int_idx][event_index(mbox->event)] &=
+        ~(1 << mbox->instance);
+    b->mboxes[mbox->instance] = NULL;
 }
 
 static struct mbox_ip_block *block_get(uintptr_t ip_base)
@@ -97,8 +125,8 @@ static void block_put(struct mbox_ip_block *b)
     ASSERT(b);
     ASSERT(b->refcnt);
     if (!--b->refcnt) {
-        for (unsigned e = 0; e < HPSC_MBOX_EVENTS; ++e)
-            ASSERT(!b->irq_refcnt[e]);
+        for (unsigned i = 0; i < HPSC_MBOX_INTS; ++i)
+            ASSERT(!b->irq_refcnt[i]);
         OBJECT_FREE(b);
     }
 }
@@ -114,9 +142,18 @@ struct mbox *mbox_claim(uintptr_t ip_base, unsigned instance,
     uint32_t dest_hw;
     uint32_t ie;
 
-    printf("mbox_claim: ip %x instance %u irq (type %u) %u int %u owner %x src %x dest %x dir %u\r\n",
-           ip_base, instance, intc_int_type(irq), intc_int_num(irq),
-           int_idx, owner, src, dest, dir);
+    if (irq)
+        IPRINTF("mbox_claim: ip %x instance %u irq (type %u) %u int %u owner %x src %x dest %x dir %u\r\n",
+                ip_base, instance, intc_int_type(irq), intc_int_num(irq),
+                int_idx, owner, src, dest, dir);
+    else
+        IPRINTF("mbox_claim: ip %x instance %u polled owner %x src %x dest %x dir %u\r\n",
+                ip_base, instance, owner, src, dest, dir);
+
+    if (instance >= HPSC_MBOX_INSTANCES || int_idx >= HPSC_MBOX_INTS) {
+        EPRINTF("mbox_claim: invalid instance or interrupt index\r\n");
+        return NULL;
+    }
 
     struct mbox *m = OBJECT_ALLOC(mboxes);
     if (!m)
@@ -125,6 +162,10 @@ struct mbox *mbox_claim(uintptr_t ip_base, unsigned instance,
     m->block = block_get(ip_base);
     if (!m->block)
         goto cleanup;
+    if (m->block->mboxes[instance]) {
+        EPRINTF("mbox_claim: instance %u already claimed\r\n", instance);
+        goto cleanup;
+    }
 
     m->instance = instance;
     m->base = ip_base + instance * HPSC_MBOX_INSTANCE_REGION;
@@ -137,25 +178,25 @@ struct mbox *mbox_claim(uintptr_t ip_base, unsigned instance,
             ((owner << REG_CONFIG__OWNER__SHIFT) & REG_CONFIG__OWNER__MASK) |
             ((src << REG_CONFIG__SRC__SHIFT)     & REG_CONFIG__SRC__MASK) |
             ((dest  << REG_CONFIG__DEST__SHIFT)  & REG_CONFIG__DEST__MASK);
-        printf("mbox_claim: config <- %08lx\r\n", cfg);
+        DPRINTF("mbox_claim: config <- %08lx\r\n", cfg);
         REGB_WRITE32(m->base, REG_CONFIG, cfg);
         cfg_hw = REGB_READ32(m->base, REG_CONFIG);
-        printf("mbox_claim: config -> %08lx\r\n", cfg_hw);
+        DPRINTF("mbox_claim: config -> %08lx\r\n", cfg_hw);
         if (cfg_hw != cfg) {
-            printf("mbox_claim: failed to claim mailbox %u for %lx: already owned by %lx\r\n",
-                   instance, owner, (cfg_hw & REG_CONFIG__OWNER__MASK) >> REG_CONFIG__OWNER__SHIFT);
+            EPRINTF("mbox_claim: failed to claim mailbox %u for %lx: already owned by %lx\r\n",
+                    instance, owner, (cfg_hw & REG_CONFIG__OWNER__MASK) >> REG_CONFIG__OWNER__SHIFT);
             goto cleanup;
         }
     } else { // not owner, just check the value in registers against the requested value
         cfg_hw = REGB_READ32(m->base, REG_CONFIG);
-        printf("mbox_claim: config -> %08lx\r\n", cfg_hw);
+        DPRINTF("mbox_claim: config -> %08lx\r\n", cfg_hw);
         src_hw =  (cfg_hw & REG_CONFIG__SRC__MASK) >> REG_CONFIG__SRC__SHIFT;
         dest_hw = (cfg_hw & REG_CONFIG__DEST__MASK) >> REG_CONFIG__DEST__SHIFT;
         if ((dir == MBOX_OUTGOING && src  && src_hw != src) ||
             (dir == MBOX_INCOMING && dest && dest_hw != src)) {
-            printf("mbox_claim: failed to claim (instance %u dir %u): "
-                   "src/dest mismatch: %lx/%lx (expected %lx/%lx)\r\n",
-                   instance, dir, src, dest, src_hw, dest_hw);
+            EPRINTF("mbox_claim: failed to claim (instance %u dir %u): "
+                    "src/dest mismatch: %lx/%lx (expected %lx/%lx)\r\n",
+                    instance, dir, src, dest, src_hw, dest_hw);
             goto cleanup;
         }
     }
@@ -165,22 +206,30 @@ struct mbox *mbox_claim(uintptr_t ip_base, unsigned instance,
 
     switch (dir) {
         case MBOX_INCOMING:
+            m->event = HPSC_MBOX_EVENT_A;
             ie = HPSC_MBOX_INT_A(m->int_idx);
             break;
         case MBOX_OUTGOING:
+            m->event = HPSC_MBOX_EVENT_B;
             ie = HPSC_MBOX_INT_B(m->int_idx);
             break;
         default:
-            printf("mbox_claim: invalid direction: %u\r\n", dir);
+            EPRINTF("mbox_claim: invalid direction: %u\r\n", dir);
             goto cleanup;
     }
 
-    printf("mbox_claim: int en <- %08lx\r\n", ie);
-    REGB_SET32(m->base, REG_INT_ENABLE, ie);
-    mbox_irq_subscribe(m);
+    if (m->irq) { // otherwise, polled: see mbox_event_poll
+        mbox_irq_subscribe(m);
+        DPRINTF("mbox_claim: int en <- %08lx\r\n", ie);
+        REGB_SET32(m->base, REG_INT_ENABLE, ie);
+    } else {
+        m->block->mboxes[instance] = m; // only to mark it claimed
+    }
 
     return m;
 cleanup:
+    if (m->block)
+        block_put(m->block);
     OBJECT_FREE(m);
     return NULL;
 }
@@ -189,34 +238,63 @@ int mbox_release(struct mbox *m)
 {
     // We are the OWNER, so we can release
     static const uint32_t cfg = 0;
-    printf("mbox_release: base %p instance %u\r\n", m->base, m->instance);
+    IPRINTF("mbox_release: base %p instance %u\r\n", m->base, m->instance);
     if (m->owner) {
-        printf("mbox_release: config <- %08lx\r\n", cfg);
+        DPRINTF("mbox_release: config <- %08lx\r\n", cfg);
         REGB_WRITE32(m->base, REG_CONFIG, cfg);
         // clearing owner also clears destination (resets the instance)
     }
-    mbox_irq_unsubscribe(m);
+    if (m->irq)
+        mbox_irq_unsubscribe(m);
+    else
+        m->block->mboxes[m->instance] = NULL;
     block_put(m->block);
     OBJECT_FREE(m);
     return 0;
 }
 
+#if CONFIG_MBOX_MSG_LEN
+void mbox_set_msg_len(struct mbox *m, bool enable)
+{
+    m->msg_len = enable;
+}
+#endif // CONFIG_MBOX_MSG_LEN
+
 size_t mbox_send(struct mbox *m, void *buf, size_t sz)
 {
     unsigned i;
     uint32_t *msg = buf;
     unsigned len = sz / sizeof(uint32_t);
-    ASSERT(sz <= HPSC_MBOX_DATA_SIZE);
+    ASSERT(sz && sz <= HPSC_MBOX_DATA_SIZE);
     if (sz % sizeof(uint32_t))
         len++;
 
-    printf("mbox_send: base %p instance %u\r\n", m->base, m->instance);
-    printf("mbox_send: msg: ");
+    DPRINTF("mbox_send: base %p instance %u\r\n", m->base, m->instance);
+    DPRINTF("mbox_send: msg: ");
+#if CONFIG_MBOX_MSG_LEN
+    if (m->msg_len) {
+        size_t msg_sz = sz;
+        // The receiver zero-fills what is not sent
+        while (len > 1 && !msg[len - 1])
+            --len;
+        if (len * sizeof(uint32_t) < msg_sz)
+            msg_sz = len * sizeof(uint32_t);
+        REGB_WRITE32(m->base, REG_DATA, (msg[0] & ~HPSC_MBOX_LEN_MASK) |
+                     (msg_sz << HPSC_MBOX_LEN_SHIFT));
+        DPRINTF("%x ", msg[0]);
+        for (i = 1; i < len; ++i) {
+            REGB_WRITE32(m->base, REG_DATA + (i * sizeof(uint32_t)), msg[i]);
+            DPRINTF("%x ", msg[i]);
+        }
+        DPRINTF("\r\n");
+        return sz;
+    }
+#endif // CONFIG_MBOX_MSG_LEN
     for (i = 0; i < len; ++i) {
         REGB_WRITE32(m->base, REG_DATA + (i * sizeof(uint32_t)), msg[i]);
-        printf("%x ", msg[i]);
+        DPRINTF("%x ", msg[i]);
     }
-    printf("\r\n");
+    DPRINTF("\r\n");
     // zero out any remaining registers
     for (; i < HPSC_MBOX_DATA_REGS; i++)
         REGB_WRITE32(m->base, REG_DATA + (i * sizeof(uint32_t)), 0);
@@ -231,14 +309,38 @@ size_t mbox_read(struct mbox *m, void *buf, size_t sz)
     size_t len = sz / sizeof(uint32_t);
     if (sz % sizeof(uint32_t))
         len++;
-
-    printf("mbox_read: base %p instance %u\r\n", m->base, m->instance);
-    printf("mbox_read: msg: ");
-    for (i = 0; i < len && i < HPSC_MBOX_DATA_REGS; i++) {
+    if (len > HPSC_MBOX_DATA_REGS)
+        len = HPSC_MBOX_DATA_REGS;
+
+    DPRINTF("mbox_read: base %p instance %u\r\n", m->base, m->instance);
+    DPRINTF("mbox_read: msg: ");
+#if CONFIG_MBOX_MSG_LEN
+    if (m->msg_len && len) {
+        size_t msg_sz, msg_len;
+        uint32_t hdr = REGB_READ32(m->base, REG_DATA);
+
+        msg_sz = (hdr & HPSC_MBOX_LEN_MASK) >> HPSC_MBOX_LEN_SHIFT;
+        if (!msg_sz || msg_sz > HPSC_MBOX_DATA_SIZE) // peer sends all registers
+            msg_sz = HPSC_MBOX_DATA_SIZE;
+        msg_len = (msg_sz + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+        msg[0] = hdr & ~HPSC_MBOX_LEN_MASK;
+        DPRINTF("%x ", msg[0]);
+        for (i = 1; i < len && i < msg_len; i++) {
+            msg[i] = REGB_READ32(m->base, REG_DATA + (i * sizeof(uint32_t)));
+            DPRINTF("%x ", msg[i]);
+        }
+        DPRINTF("\r\n");
+        for (; i < len; i++) // as if the sender had zero-filled
+            msg[i] = 0;
+        return len * sizeof(uint32_t);
+    }
+#endif // CONFIG_MBOX_MSG_LEN
+    for (i = 0; i < len; i++) {
         msg[i] = REGB_READ32(m->base, REG_DATA + (i * sizeof(uint32_t)));
-        printf("%x ", msg[i]);
+        DPRINTF("%x ", msg[i]);
     }
-    printf("\r\n");
+    DPRINTF("\r\n");
 
     return i * sizeof(uint32_t);
 }
@@ -246,34 +348,41 @@ size_t mbox_read(struct mbox *m, void *buf, size_t sz)
 void mbox_event_set_rcv(struct mbox *m)
 {
     static const uint32_t val = HPSC_MBOX_EVENT_A;
-    printf("mbox_event_set_rcv: raise int A <- %08lx\r\n", val);
+    DPRINTF("mbox_event_set_rcv: raise int A <- %08lx\r\n", val);
     REGB_WRITE32(m->base, REG_EVENT_SET, val);
 }
 
 void mbox_event_set_ack(struct mbox *m)
 {
     static const uint32_t val = HPSC_MBOX_EVENT_B;
-    printf("mbox_event_set_ack: raise int B <- %08lx\r\n", val);
+    DPRINTF("mbox_event_set_ack: raise int B <- %08lx\r\n", val);
     REGB_WRITE32(m->base, REG_EVENT_SET, val);
 }
 
 void mbox_event_clear_rcv(struct mbox *m)
 {
     static const uint32_t val = HPSC_MBOX_EVENT_A;
-    printf("mbox_event_clear_rcv: clear int A <- %08lx\r\n", val);
+    DPRINTF("mbox_event_clear_rcv: clear int A <- %08lx\r\n", val);
     REGB_WRITE32(m->base, REG_EVENT_CLEAR, val);
 }
 
 void mbox_event_clear_ack(struct mbox *m)
 {
     static const uint32_t val = HPSC_MBOX_EVENT_B;
-    printf("mbox_event_clear_ack: clear int B <- %08lx\r\n", val);
+    DPRINTF("mbox_event_clear_ack: clear int B <- %08lx\r\n", val);
     REGB_WRITE32(m->base, REG_EVENT_CLEAR, val);
 }
 
+bool mbox_event_poll(struct mbox *m)
+{
+    // The event that the mailbox was claimed for: A (rcv) if incoming,
+    // B (ack) if outgoing
+    return (REGB_READ32(m->base, REG_EVENT_STATUS) & m->event) != 0;
+}
+
 static void mbox_instance_rcv_isr(struct mbox *mbox)
 {
-    printf("mbox_instance_rcv_isr: base %p instance %u\r\n", mbox->base, mbox->instance);
+    DPRINTF("mbox_instance_rcv_isr: base %p instance %u\r\n", mbox->base, mbox->instance);
     if (mbox->cb.rcv_cb)
         mbox->cb.rcv_cb(mbox->cb_arg);
     else
@@ -282,60 +391,57 @@ static void mbox_instance_rcv_isr(struct mbox *mbox)
 
 static void mbox_instance_ack_isr(struct mbox *mbox)
 {
-    printf("mbox_instance_ack_isr: base %p instance %u\r\n", mbox->base, mbox->instance);
+    DPRINTF("mbox_instance_ack_isr: base %p instance %u\r\n", mbox->base, mbox->instance);
     if (mbox->cb.ack_cb)
         mbox->cb.ack_cb(mbox->cb_arg);
     else
         mbox_event_clear_ack(mbox); // just clear event
 }
 
-static void mbox_isr(unsigned event, unsigned interrupt)
+static void mbox_isr(unsigned event, unsigned int_idx)
 {
-    uint32_t val;
+    struct mbox_ip_block *b;
     struct mbox *mbox;
+    uint32_t subs;
     unsigned i;
     bool handled = false;
 
-    // Technically, could iterate only over one IP block if we care to split
-    // the main mailbox array into multiple arrays, one per block.
-    for (i = 0; i < MAX_MBOXES; ++i) {
-        mbox = &mboxes[i];
-        if (!mbox->obj.valid)
+    // Only the instances claimed with this event routed to this interrupt;
+    // of those, the ones that have the event raised
+    for (b = &blocks[0]; b < &blocks[MAX_BLOCKS]; ++b) {
+        if (!b->obj.valid)
             continue;
-
-        // Are we 'signed up' for this event (A) from this mailbox (i)?
-        // Two criteria: (1) Cause is set, and (2) Mapped to our IRQ
-        val = REGB_READ32(mbox->base, REG_EVENT_CAUSE);
-        printf("mbox_isr: cause -> %08lx\r\n", val);
-        if (!(val & event))
-            continue; // this mailbox didn't raise the interrupt
-        val = REGB_READ32(mbox->base, REG_INT_ENABLE);
-        printf("mbox_isr: int enable -> %08lx\r\n", val);
-        if (!(val & interrupt))
-            continue; // this mailbox has an event but it's not ours
-
-        handled = true;
-
-        switch (event) {
-            case HPSC_MBOX_EVENT_A:
-                mbox_instance_rcv_isr(mbox);
-                break;
-            case HPSC_MBOX_EVENT_B:
-                mbox_instance_ack_isr(mbox);
-                break;
-            default:
-                printf("ERROR: mbox_isr: invalid event %u\r\n", event);
-                ASSERT(false && "invalid event");
+        subs = b->subscribers[int_idx][event_index(event)];
+        while (subs) {
+            i = __builtin_ctz(subs);
+            subs &= subs - 1;
+            mbox = b->mboxes[i];
+
+            if (!(REGB_READ32(mbox->base, REG_EVENT_CAUSE) & event))
+                continue; // this mailbox didn't raise the interrupt
+
+            handled = true;
+
+            switch (event) {
+                case HPSC_MBOX_EVENT_A:
+                    mbox_instance_rcv_isr(mbox);
+                    break;
+                case HPSC_MBOX_EVENT_B:
+                    mbox_instance_ack_isr(mbox);
+                    break;
+                default:
+                    ASSERT(false && "invalid event");
+            }
         }
-   }
-   ASSERT(handled); // otherwise, we're not correctly subscribed to interrupts
+    }
+    ASSERT(handled); // otherwise, we're not correctly subscribed to interrupts
 }
 
 void mbox_rcv_isr(unsigned int_idx)
 {
-    mbox_isr(HPSC_MBOX_EVENT_A, HPSC_MBOX_INT_A(int_idx));
+    mbox_isr(HPSC_MBOX_EVENT_A, int_idx);
 }
 void mbox_ack_isr(unsigned int_idx)
 {
-    mbox_isr(HPSC_MBOX_EVENT_B, HPSC_MBOX_INT_B(int_idx));
+    mbox_isr(HPSC_MBOX_EVENT_B, int_idx);
 }
@@ -1,6 +1,7 @@
 #ifndef MAILBOX_H
 #define MAILBOX_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -11,6 +12,19 @@
 #define HPSC_MBOX_DATA_REGS 16
 #define HPSC_MBOX_DATA_SIZE (HPSC_MBOX_DATA_REGS * 4)
 
+// Length-aware messages (CONFIG_MBOX_MSG_LEN): byte 2 of the first data word
+// (reserved in the command format, see command.h) carries the length of the
+// message in bytes, and only the words up to it are written and read.
+// Trailing zero words are not sent, since the receiver zero-fills past the
+// length. Length 0 is from a peer that writes all registers, zero-filled.
+//
+// This takes over a byte of the message, so it is off on every mailbox
+// until enabled with mbox_set_msg_len: only on mailboxes whose peer does the
+// same, and that carry only messages in the command format (not, e.g., raw
+// PSCI replies).
+#define HPSC_MBOX_LEN_SHIFT 16
+#define HPSC_MBOX_LEN_MASK  0x00ff0000
+
 typedef void (*rcv_cb_t)(void *arg);
 typedef void (*ack_cb_t)(void *arg);
 
@@ -26,6 +40,8 @@ union mbox_cb {
 
 struct mbox;
 
+// With irq NULL, the mailbox is polled: its event is not routed to any
+// interrupt (int_idx is ignored), and the callback is not called.
 struct mbox *mbox_claim(uintptr_t ip_base, unsigned instance,
                         struct irq *irq, unsigned int_idx,
                         uint32_t owner, uint32_t src, uint32_t dest,
@@ -39,8 +55,8 @@ int mbox_release(struct mbox *m);
  * and how mailboxes are used in general---and it's not pretty.
  * Higher-level abstractions can make event handling opaque, if desired.
  *
- * In the case of polled operation (not currently supported), event handling can
- * be performed at any time.
+ * In the case of polled operation (mailbox claimed without an IRQ), event
+ * handling can be performed at any time: see mbox_event_poll.
  * In the case where events drive IRQs (this design), events should be cleared
  * before ISRs complete, o/w the IRQ remains active and the ISR runs again.
  *
@@ -62,11 +78,20 @@ int mbox_release(struct mbox *m);
 size_t mbox_send(struct mbox *m, void *buf, size_t sz);
 size_t mbox_read(struct mbox *m, void *buf, size_t sz);
 
+#if CONFIG_MBOX_MSG_LEN
+void mbox_set_msg_len(struct mbox *m, bool enable);
+#endif // CONFIG_MBOX_MSG_LEN
+
 void mbox_event_set_rcv(struct mbox *m);
 void mbox_event_set_ack(struct mbox *m);
 void mbox_event_clear_rcv(struct mbox *m);
 void mbox_event_clear_ack(struct mbox *m);
 
+// Whether the event for the direction of the mailbox is raised: a message
+// (incoming) or an ACK (outgoing). Reads the status, not the cause, so it
+// works for polled mailboxes.
+bool mbox_event_poll(struct mbox *m);
+
 void mbox_rcv_isr(unsigned int_idx);
 void mbox_ack_isr(unsigned int_idx);
 
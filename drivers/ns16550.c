@@ -306,3 +306,44 @@ void ns16550_putchar(char ch)
 {
 	NS16550_putc(&com_port, ch);
 }
+
+/*
+ * Interrupt-driven transmission: the caller fills the TX FIFO from its ISR
+ * while the THR empty interrupt is enabled. With the FIFO enabled, THRE means
+ * that the whole FIFO is free.
+ */
+static void NS16550_tx_int_enable(NS16550_t com_port, bool enable)
+{
+	int ier = serial_in(&com_port->ier);
+
+	if (enable)
+		ier |= UART_IER_THRI;
+	else
+		ier &= ~UART_IER_THRI;
+	serial_out(ier, &com_port->ier);
+}
+
+static int NS16550_tx_empty(NS16550_t com_port)
+{
+	return (serial_in(&com_port->lsr) & UART_LSR_THRE) != 0;
+}
+
+static void NS16550_tx_put(NS16550_t com_port, char c)
+{
+	serial_out(c, &com_port->thr);
+}
+
+void ns16550_tx_int_enable(bool enable)
+{
+	NS16550_tx_int_enable(&com_port, enable);
+}
+
+bool ns16550_tx_empty(void)
+{
+	return NS16550_tx_empty(&com_port);
+}
+
+void ns16550_tx_put(char ch)
+{
+	NS16550_tx_put(&com_port, ch);
+}
@@ -16,7 +16,16 @@
  * by Richard Danter (richard.danter@windriver.com), (C) 2005 Wind River Systems
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#define NS16550_TX_FIFO_DEPTH 16
+
 int ns16550_startup(uintptr_t base, int clock, int baudrate);
 void ns16550_putchar(char ch);
+
+// For interrupt-driven output: the ISR writes up to NS16550_TX_FIFO_DEPTH
+// chars with ns16550_tx_put when ns16550_tx_empty
+void ns16550_tx_int_enable(bool enable);
+bool ns16550_tx_empty(void);
+void ns16550_tx_put(char ch);
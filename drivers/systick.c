@@ -1,5 +1,8 @@
 #define DEBUG 0
 
+#include <stdbool.h>
+
+#include "arm.h"
 #include "hwinfo.h"
 #include "regops.h"
 #include "printf.h"
@@ -17,23 +20,106 @@
 #define REG__STCSR__CLKSOURCE   (1 <<  2)
 #define REG__STCSR__COUNTFLAG   (1 << 16)
 
+#define REG__ICSR               0xd04
+#define REG__ICSR__PENDSTCLR    (1 << 25)
+
+#define SYSTICK_MAX_INTERVAL    0x01000000 // 24-bit counter
+#define SYSTICK_MIN_INTERVAL    2 // reload value of 0 stops the counter
+
 struct systick {
     systick_cb_t *cb;
     void *cb_arg;
+
+    // Tickless: the count is extended to 64 bits in software, and the
+    // down-counter is restarted for each deadline (losing at most a cycle).
+    bool tickless;
+    uint64_t base; // count at the restart of the counter
+    uint32_t reload;
+    bool wrapped; // COUNTFLAG, which clears on read, since the restart
 };
 
 static struct systick systick;
 
+// Reading STCSR clears COUNTFLAG, so every read must latch it
+static uint32_t csr_read()
+{
+    uint32_t csr = REGB_READ32(TRCH_SCS_BASE, REG__STCSR);
+    if (csr & REG__STCSR__COUNTFLAG)
+        systick.wrapped = true;
+    return csr;
+}
+
+// With interrupts disabled. After a restart, the counter reads 0 for a cycle
+// and then counts down from reload, and reaches 0 again (setting COUNTFLAG)
+// at reload + 1 cycles, when the interrupt is raised; it is restarted from
+// the ISR, before it wraps a second time.
+static uint64_t now()
+{
+    uint32_t cvr = REGB_READ32(TRCH_SCS_BASE, REG__STCVR);
+    uint32_t elapsed;
+
+    if (!systick.wrapped && (csr_read() & REG__STCSR__COUNTFLAG))
+        cvr = REGB_READ32(TRCH_SCS_BASE, REG__STCVR); // wrapped since read
+    elapsed = cvr ? systick.reload + 1 - cvr : 0;
+    if (systick.wrapped)
+        elapsed += systick.reload + 1;
+    return systick.base + elapsed;
+}
+
+static void restart(uint64_t t, uint32_t interval)
+{
+    systick.base = t;
+    systick.reload = interval - 1;
+    systick.wrapped = false;
+    REGB_WRITE32(TRCH_SCS_BASE, REG__STRVR, systick.reload);
+    REGB_WRITE32(TRCH_SCS_BASE, REG__STCVR, 0); // also clears COUNTFLAG
+    // an interrupt for the previous interval is stale
+    REGB_WRITE32(TRCH_SCS_BASE, REG__ICSR, REG__ICSR__PENDSTCLR);
+}
+
 void systick_config(uint32_t interval, systick_cb_t *cb, void *cb_arg)
 {
     printf("SYSTICK: config: interval %u\r\n", interval);
     systick.cb = cb;
     systick.cb_arg = cb_arg;
+    systick.tickless = false;
     REGB_WRITE32(TRCH_SCS_BASE, REG__STRVR, interval);
     REGB_WRITE32(TRCH_SCS_BASE, REG__STCVR, 0);
     REGB_WRITE32(TRCH_SCS_BASE, REG__STCSR, REG__STCSR__TICKINT);
 }
 
+void systick_config_tickless(systick_cb_t *cb, void *cb_arg)
+{
+    printf("SYSTICK: config: tickless\r\n");
+    systick.cb = cb;
+    systick.cb_arg = cb_arg;
+    systick.tickless = true;
+    restart(0, SYSTICK_MAX_INTERVAL);
+    REGB_WRITE32(TRCH_SCS_BASE, REG__STCSR, REG__STCSR__TICKINT);
+}
+
+uint64_t systick_now()
+{
+    unsigned irq = int_save_disable();
+    uint64_t t = now();
+    int_restore(irq);
+    return t;
+}
+
+void systick_alarm(uint64_t at)
+{
+    unsigned irq = int_save_disable();
+    uint64_t t = now();
+    uint64_t interval = at > t ? at - t : 0;
+
+    if (interval < SYSTICK_MIN_INTERVAL)
+        interval = SYSTICK_MIN_INTERVAL;
+    else if (interval > SYSTICK_MAX_INTERVAL)
+        interval = SYSTICK_MAX_INTERVAL; // an early interrupt, re-armed then
+    restart(t, interval);
+    int_restore(irq);
+}
+
 void systick_clear()
 {
     printf("SYSTICK: clear\r\n");
@@ -48,18 +134,20 @@ uint32_t systick_count()
 void systick_enable()
 {
     printf("SYSTICK: enable\r\n");
-    REGB_SET32(TRCH_SCS_BASE, REG__STCSR, REG__STCSR__ENABLE);
+    REGB_WRITE32(TRCH_SCS_BASE, REG__STCSR, csr_read() | REG__STCSR__ENABLE);
 }
 
 void systick_disable()
 {
     printf("SYSTICK: disable\r\n");
-    REGB_CLEAR32(TRCH_SCS_BASE, REG__STCSR, REG__STCSR__ENABLE);
+    REGB_WRITE32(TRCH_SCS_BASE, REG__STCSR, csr_read() & ~REG__STCSR__ENABLE);
 }
 
 void systick_isr()
 {
     DPRINTF("SYSTICK: ISR\r\n");
+    if (systick.tickless) // no more wraps until the cb re-arms it
+        restart(now(), SYSTICK_MAX_INTERVAL);
     if (systick.cb)
         systick.cb(systick.cb_arg);
 }
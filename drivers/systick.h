@@ -8,6 +8,13 @@
 typedef void (systick_cb_t)(void *arg);
 
 void systick_config(uint32_t interval, systick_cb_t *cb, void *cb_arg);
+
+// Tickless: a 64-bit count of cycles and a one-shot interrupt at a count (for
+// the timer queue, see timerq.h); the cb is called on every interrupt.
+void systick_config_tickless(systick_cb_t *cb, void *cb_arg);
+uint64_t systick_now();
+void systick_alarm(uint64_t at);
+
 void systick_clear();
 uint32_t systick_count();
 void systick_enable();
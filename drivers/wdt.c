@@ -107,7 +107,7 @@ static void exec_cmd(struct wdt *wdt, const struct cmd_code *code)
 
 static void exec_global_cmd(struct wdt *wdt, enum cmd cmd)
 {
-    printf("WDT %s: exec cmd: %u\r\n", wdt->name, cmd);
+    DPRINTF("WDT %s: exec cmd: %u\r\n", wdt->name, cmd);
     ASSERT(cmd < NUM_CMDS);
     exec_cmd(wdt, &cmd_codes[cmd]);
 }
@@ -123,7 +123,7 @@ static struct wdt *wdt_create(const char *name, uintptr_t base,
                               wdt_cb_t cb, void *cb_arg)
 {
 
-    printf("WDT %s: create base %p\r\n", name, base);
+    IPRINTF("WDT %s: create base %p\r\n", name, base);
 
     struct wdt *wdt = OBJECT_ALLOC(wdts);
     wdt->base = base;
@@ -159,19 +159,19 @@ int wdt_configure(struct wdt *wdt, unsigned freq,
     ASSERT(wdt->monitor);
     ASSERT(!wdt_is_enabled(wdt)); // not strict requirement, but for sanity
     if (num_stages > MAX_STAGES) {
-        printf("ERROR: WDT: more stages than supported: %u >= %u\r\n",
-               num_stages, MAX_STAGES);
+        EPRINTF("ERROR: WDT: more stages than supported: %u >= %u\r\n",
+                num_stages, MAX_STAGES);
         return 1;
     }
     if (!(freq <= wdt->clk_freq_hz && wdt->clk_freq_hz % freq == 0)) {
-        printf("ERROR: WDT: freq is larger than or not a divisor of clk freq: %u > %u\r\n",
-               freq, wdt->clk_freq_hz);
+        EPRINTF("ERROR: WDT: freq is larger than or not a divisor of clk freq: %u > %u\r\n",
+                freq, wdt->clk_freq_hz);
         return 1;
     }
     for (unsigned stage = 0; stage < num_stages; ++stage) {
         if (timeouts[stage] & (~0ULL << wdt->counter_width)) {
-                printf("ERROR: WDT: timeout for stage %u exceeds counter width (%u bits): %08x%08x\r\n",
-                       stage, wdt->counter_width,
+                EPRINTF("ERROR: WDT: timeout for stage %u exceeds counter width (%u bits): %08x%08x\r\n",
+                        stage, wdt->counter_width,
                       (uint32_t)(timeouts[stage] >> 32), (uint32_t)(timeouts[stage] & 0xffffffff));
                 return 2;
         }
@@ -183,12 +183,12 @@ int wdt_configure(struct wdt *wdt, unsigned freq,
     ASSERT(wdt->clk_freq_hz % freq == 0);
     unsigned div = wdt->clk_freq_hz / freq;
     if (div > wdt->max_div) {
-        printf("ERROR: WDT: divider too large: %u > %u\r\n",
-               div, wdt->max_div);
+        EPRINTF("ERROR: WDT: divider too large: %u > %u\r\n",
+                div, wdt->max_div);
         return 1;
     }
 
-    printf("WDT %s: set divider to %u\r\n", wdt->name, div);
+    IPRINTF("WDT %s: set divider to %u\r\n", wdt->name, div);
     REGB_WRITE32(wdt->base, REG__CONFIG, div << REG__CONFIG__TICKDIV__SHIFT);
 
     for (unsigned stage = 0; stage < num_stages; ++stage) {
@@ -205,7 +205,7 @@ int wdt_configure(struct wdt *wdt, unsigned freq,
 void wdt_destroy(struct wdt *wdt)
 {
     ASSERT(wdt);
-    printf("WDT %s: destroy\r\n", wdt->name);
+    IPRINTF("WDT %s: destroy\r\n", wdt->name);
     if (wdt->monitor)
         ASSERT(!wdt_is_enabled(wdt));
     OBJECT_FREE(wdt);
@@ -216,8 +216,8 @@ uint64_t wdt_count(struct wdt *wdt, unsigned stage)
     ASSERT(wdt);
     exec_stage_cmd(wdt, SCMD_CAPTURE, stage); 
     uint64_t count = REGB_READ64(wdt->base, STAGE_REG(REG__COUNT, stage));
-    printf("WDT %s: count -> 0x%08x%08x\r\n", wdt->name,
-           (uint32_t)(count >> 32), (uint32_t)(count & 0xffffffff));
+    IPRINTF("WDT %s: count -> 0x%08x%08x\r\n", wdt->name,
+            (uint32_t)(count >> 32), (uint32_t)(count & 0xffffffff));
     return count;
 }
 
@@ -226,22 +226,22 @@ uint64_t wdt_timeout(struct wdt *wdt, unsigned stage)
     ASSERT(wdt);
     // NOTE: not going to be the right value if it wasn't not loaded via cmd
     uint64_t terminal = REGB_READ64(wdt->base, STAGE_REG(REG__TERMINAL, stage));
-    printf("WDT %s: terminal -> 0x%08x%08x\r\n", wdt->name,
-           (uint32_t)(terminal >> 32), (uint32_t)(terminal & 0xffffffff));
+    IPRINTF("WDT %s: terminal -> 0x%08x%08x\r\n", wdt->name,
+            (uint32_t)(terminal >> 32), (uint32_t)(terminal & 0xffffffff));
     return terminal;
 }
 
 bool wdt_is_enabled(struct wdt *wdt)
 {
     bool enabled = REGB_READ32(wdt->base, REG__CONFIG) & REG__CONFIG__EN;
-    printf("WDT %s: is enabled -> %u\r\n", wdt->name, enabled);
+    IPRINTF("WDT %s: is enabled -> %u\r\n", wdt->name, enabled);
     return enabled;
 }
 
 void wdt_enable(struct wdt *wdt)
 {
     ASSERT(wdt);
-    printf("WDT %s: enable\r\n", wdt->name);
+    IPRINTF("WDT %s: enable\r\n", wdt->name);
     REGB_SET32(wdt->base, REG__CONFIG, REG__CONFIG__EN);
 }
 
@@ -249,7 +249,7 @@ void wdt_disable(struct wdt *wdt)
 {
     ASSERT(wdt);
     ASSERT(wdt->monitor);
-    printf("WDT %s: disable\r\n", wdt->name);
+    IPRINTF("WDT %s: disable\r\n", wdt->name);
     exec_global_cmd(wdt, CMD_DISABLE);
 }
 
@@ -267,7 +267,7 @@ void wdt_kick(struct wdt *wdt)
 void wdt_isr(struct wdt *wdt, unsigned stage)
 {
     ASSERT(wdt);
-    printf("WDT %s: ISR\r\n", wdt->name);
+    DPRINTF("WDT %s: ISR\r\n", wdt->name);
     // TODO: spec unclear: if we are not allowed to clear the int source, then
     // we have to disable the interrupt via the interrupt controller, and
     // re-enable it in wdt_enable.
@@ -1,3 +1,5 @@
+#define DEBUG 0
+
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -31,11 +33,11 @@ static struct balloc ballocs[MAX_ALLOCATORS] = {0};
 
 static void dump_balloc(struct balloc *ba)
 {
-    printf("BALLOC %s: free blocks: ", ba->name);
+    DPRINTF("BALLOC %s: free blocks: ", ba->name);
     for (unsigned i = 0; i < MAX_BLOCKS; ++i)
         if (ba->free_blocks[i].addr)
-            printf("(%p,+%x) ", ba->free_blocks[i].addr, ba->free_blocks[i].size);
-    printf("\r\n");
+            DPRINTF("(%p,+%x) ", ba->free_blocks[i].addr, ba->free_blocks[i].size);
+    DPRINTF("\r\n");
 }
 
 struct balloc *balloc_create(const char *name, void *addr, unsigned size)
@@ -47,17 +49,17 @@ struct balloc *balloc_create(const char *name, void *addr, unsigned size)
     ba->free_blocks[0].addr = addr;
     ba->free_blocks[0].size = size;
 
-    printf("BALLOC %s: init: zero-initing free block 0 (%p,0x%x)\r\n",
+    IPRINTF("BALLOC %s: init: zero-initing free block 0 (%p,0x%x)\r\n",
             ba->name, ba->free_blocks[0].addr, ba->free_blocks[0].size);
     bzero(addr, size);
-    printf("BALLOC %s: ready\r\n", ba->name);
+    IPRINTF("BALLOC %s: ready\r\n", ba->name);
     return ba;
 }
 
 void balloc_destroy(struct balloc *ba)
 {
      ASSERT(ba);
-     printf("BALLOC %s: destroy\r\n", ba->name);
+     IPRINTF("BALLOC %s: destroy\r\n", ba->name);
      OBJECT_FREE(ba);
 }
 
@@ -65,8 +67,8 @@ void *balloc_alloc(struct balloc *ba, unsigned sz, unsigned align_bits)
 {
     ASSERT(ba);
 
-    printf("BALLOC %s: balloc_alloc: sz 0x%x align 0x%x\r\n",
-           ba->name, sz, align_bits);
+    DPRINTF("BALLOC %s: balloc_alloc: sz 0x%x align 0x%x\r\n",
+            ba->name, sz, align_bits);
     dump_balloc(ba);
 
     struct block *free_blocks = &ba->free_blocks[0];
@@ -87,7 +89,7 @@ void *balloc_alloc(struct balloc *ba, unsigned sz, unsigned align_bits)
             ++i;
 
         if (i == MAX_BLOCKS) {
-            printf("ERROR: BALLOC %s: alloc failed: out of mem\r\n", ba->name);
+            EPRINTF("ERROR: BALLOC %s: alloc failed: out of mem\r\n", ba->name);
             return NULL;
         }
 
@@ -98,8 +100,8 @@ void *balloc_alloc(struct balloc *ba, unsigned sz, unsigned align_bits)
             ++j;
 
         if (j == MAX_BLOCKS) {
-            printf("ERROR: BALLOC %s: alloc failed: no space for free block\r\n",
-                   ba->name);
+            EPRINTF("ERROR: BALLOC %s: alloc failed: no space for free block\r\n",
+                    ba->name);
             return NULL;
         }
 
@@ -108,11 +110,11 @@ void *balloc_alloc(struct balloc *ba, unsigned sz, unsigned align_bits)
         free_blocks[j].addr = free_blocks[i].addr + padding;
         free_blocks[j].size = free_blocks[i].size - padding;
 
-        printf("BALLOC %s: blocks: split block %u (%p,+%x) into %u (%p,+%x) and %u (%p,+%x)\r\n",
-               ba->name,
-               i, free_blocks[i].addr, free_blocks[i].size,
-               i, free_blocks[i].addr, padding,
-               j, free_blocks[j].addr, free_blocks[j].size);
+        DPRINTF("BALLOC %s: blocks: split block %u (%p,+%x) into %u (%p,+%x) and %u (%p,+%x)\r\n",
+                ba->name,
+                i, free_blocks[i].addr, free_blocks[i].size,
+                i, free_blocks[i].addr, padding,
+                j, free_blocks[j].addr, free_blocks[j].size);
 
         free_blocks[i].size = padding;
 
@@ -123,8 +125,8 @@ void *balloc_alloc(struct balloc *ba, unsigned sz, unsigned align_bits)
     ASSERT(ALIGNED(b, align_bits));
 
 
-    printf("BALLOC %s: balloc_alloc: block %p sz 0x%x from block %u (%p,+%x)\r\n",
-           ba->name, b, sz, i, free_blocks[i].addr, free_blocks[i].size);
+    DPRINTF("BALLOC %s: balloc_alloc: block %p sz 0x%x from block %u (%p,+%x)\r\n",
+            ba->name, b, sz, i, free_blocks[i].addr, free_blocks[i].size);
 
     free_blocks[i].size -= sz;
     if (free_blocks[i].size)
@@ -140,7 +142,7 @@ int balloc_free(struct balloc *ba, void *addr, unsigned sz)
 {
     ASSERT(ba);
 
-    printf("BALLOC %s: balloc_free: addr %p sz %x\r\n", ba->name, addr, sz);
+    DPRINTF("BALLOC %s: balloc_free: addr %p sz %x\r\n", ba->name, addr, sz);
     dump_balloc(ba);
 
     struct block *free_blocks = &ba->free_blocks[0];
@@ -151,8 +153,8 @@ int balloc_free(struct balloc *ba, void *addr, unsigned sz)
         ++i;
 
     if (i < MAX_BLOCKS && free_blocks[i].addr - sz == addr) {
-        printf("BALLOC %s: balloc_free: coalesced into block %u (%p,+%x)\r\n",
-               ba->name, i, free_blocks[i].addr, free_blocks[i].size);
+        DPRINTF("BALLOC %s: balloc_free: coalesced into block %u (%p,+%x)\r\n",
+                ba->name, i, free_blocks[i].addr, free_blocks[i].size);
         free_blocks[i].addr -= sz;
         free_blocks[i].size += sz;
     } else {
@@ -160,14 +162,14 @@ int balloc_free(struct balloc *ba, void *addr, unsigned sz)
         while (i < MAX_BLOCKS && free_blocks[i].addr)
             ++i;
         if (i == MAX_BLOCKS) {
-            printf("ERROR: BALLOC %s: free failed: no space for free block\r\n",
-                   ba->name);
+            EPRINTF("ERROR: BALLOC %s: free failed: no space for free block\r\n",
+                    ba->name);
             return -1;
         }
         free_blocks[i].addr = addr;
         free_blocks[i].size = sz;
-        printf("BALLOC %s: balloc_free: new free block %u (%p,+%x)\r\n",
-               ba->name, i, free_blocks[i].addr, sz);
+        DPRINTF("BALLOC %s: balloc_free: new free block %u (%p,+%x)\r\n",
+                ba->name, i, free_blocks[i].addr, sz);
     }
 
     dump_balloc(ba);
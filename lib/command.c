@@ -1,20 +1,71 @@
+#define DEBUG 0
+
 #include <stdint.h>
 
+#include "arm.h"
 #include "mailbox.h"
 #include "mem.h"
+#include "object.h"
+#include "panic.h"
 #include "printf.h"
 
 #include "command.h"
 
-#define CMD_QUEUE_LEN 4
 #define REPLY_SIZE CMD_MSG_SZ
 
-static size_t cmdq_head = 0;
-static size_t cmdq_tail = 0;
-static struct cmd cmdq[CMD_QUEUE_LEN];
+// One queue per link on which requests are received. Each queue is a
+// lock-free single-producer/single-consumer ring: the producer is the
+// receive path of the link (an ISR for mailbox links, the main loop for
+// polled links), the consumer is the main loop. Head and tail are
+// free-running counters, each written by one side only, so the ring holds
+// all CONFIG_CMD_QUEUE_LEN entries (full is head - tail == LEN).
+#if CONFIG_CMD_QUEUE_LEN & (CONFIG_CMD_QUEUE_LEN - 1)
+#error CONFIG_CMD_QUEUE_LEN must be a power of 2
+#endif
+
+#define CMD_MAX_QUEUES 10
+#define CMD_MSG_WORDS (CMD_MSG_SZ / sizeof(uint32_t))
+
+// The messages are copied a word at a time (and without GCC inserting a
+// memcpy, which there is none of)
+typedef uint32_t cmd_word_t __attribute__((may_alias));
+
+struct cmdq {
+    struct object obj;
+    struct link *link;
+    volatile unsigned head; // written by the producer only
+    volatile unsigned tail; // written by the consumer only
+    // A request that does not fit is dropped, and the consumer replies to it
+    // with a NAK, once it has consumed the requests queued before it.
+    volatile unsigned naks; // by the producer
+    volatile unsigned nak_pos; // by the producer: head when last dropped
+    volatile uint8_t nak_cmd; // by the producer: type of the last dropped
+    volatile uint8_t nak_seq; // by the producer: its sequence number
+    unsigned naks_sent; // by the consumer
+    uint32_t msgs[CONFIG_CMD_QUEUE_LEN][CMD_MSG_WORDS];
+};
+
+static struct cmdq cmdqs[CMD_MAX_QUEUES];
+static unsigned cmdq_next; // round-robin among the queues
 
 static cmd_handler_t *cmd_handler = NULL;
 
+// Order the accesses to the slot with respect to the index update
+static inline void cmdq_barrier()
+{
+    asm volatile ("dmb" ::: "memory");
+}
+
+static void msg_copy(void *dst, const void *src)
+{
+    cmd_word_t *d = dst;
+    const cmd_word_t *s = src;
+    unsigned w;
+
+    for (w = 0; w < CMD_MSG_WORDS; ++w)
+        d[w] = s[w];
+}
+
 void cmd_handler_register(cmd_handler_t cb)
 {
     cmd_handler = cb;
@@ -25,85 +76,258 @@ void cmd_handler_unregister()
     cmd_handler = NULL;
 }
 
+int cmd_queue_open(struct link *link)
+{
+    struct cmdq *q = OBJECT_ALLOC(cmdqs);
+    if (!q)
+        return 1;
+    q->link = link;
+    link->cmdq = q;
+    return 0;
+}
+
+void cmd_queue_close(struct link *link)
+{
+    struct cmdq *q = link->cmdq;
+    if (!q)
+        return;
+    link->cmdq = NULL;
+    OBJECT_FREE(q);
+}
+
 int cmd_enqueue(struct cmd *cmd)
 {
-    size_t i;
+    struct cmdq *q = cmd->link->cmdq;
+    unsigned head;
 
-    if (cmdq_head + 1 % CMD_QUEUE_LEN == cmdq_tail) {
-        printf("command: enqueue failed: queue full\r\n");
+    if (!q) {
+        EPRINTF("command: enqueue: %s: no queue\r\n", cmd->link->name);
         return 1;
     }
-    cmdq_head = (cmdq_head + 1) % CMD_QUEUE_LEN;
 
-    // cmdq[cmdq_head] = *cmd; // can't because GCC inserts a memcpy
-    cmdq[cmdq_head].link = cmd->link;
-    for (i = 0; i < CMD_MSG_SZ; ++i)
-        cmdq[cmdq_head].msg[i] = cmd->msg[i];
+    head = q->head;
+    if (head - q->tail == CONFIG_CMD_QUEUE_LEN) {
+        q->nak_cmd = cmd->msg[0];
+        q->nak_seq = cmd->msg[CMD_SEQ_OFFSET];
+        q->nak_pos = head;
+        cmdq_barrier();
+        q->naks++;
+        return 1;
+    }
 
-    printf("command: enqueue (tail %u head %u): cmd %u arg %u...\r\n",
-           cmdq_tail, cmdq_head,
-           cmdq[cmdq_head].msg[0], cmdq[cmdq_head].msg[CMD_MSG_PAYLOAD_OFFSET]);
+    msg_copy(q->msgs[head % CONFIG_CMD_QUEUE_LEN], cmd->msg);
+    cmdq_barrier(); // the entry must be complete before it is visible
+    q->head = head + 1;
 
     // TODO: SEV (to prevent race between queue check and WFE in main loop)
 
     return 0;
 }
 
-int cmd_dequeue(struct cmd *cmd)
+static bool nak_due(struct cmdq *q)
+{
+    // The requests queued before the dropped one have been consumed
+    return q->naks != q->naks_sent && q->tail == q->nak_pos;
+}
+
+static int dequeue(struct cmdq *q, struct cmd *cmd)
 {
-    size_t i;
+    unsigned tail = q->tail;
+    unsigned naks = q->naks;
 
-    if (cmdq_head == cmdq_tail)
-        return 1;
+    cmdq_barrier();
+    if (naks != q->naks_sent && tail == q->nak_pos) {
+        struct cmd_nak *nak =
+            (struct cmd_nak *)&cmd->msg[CMD_MSG_PAYLOAD_OFFSET];
 
-    cmdq_tail = (cmdq_tail + 1) % CMD_QUEUE_LEN;
+        bzero(cmd->msg, sizeof(cmd->msg));
+        cmd->msg[0] = CMD_NAK;
+        cmd->msg[CMD_SEQ_OFFSET] = q->nak_seq;
+        nak->cmd = q->nak_cmd;
+        nak->count = naks - q->naks_sent;
+        cmd->link = q->link;
+        q->naks_sent = naks;
+        return 0;
+    }
 
-    // *cmd = cmdq[cmdq_tail].cmd; // can't because GCC inserts a memcpy
-    cmd->link = cmdq[cmdq_tail].link;
-    for (i = 0; i < CMD_MSG_SZ; ++i)
-        cmd->msg[i] = cmdq[cmdq_tail].msg[i];
-    printf("command: dequeue (tail %u head %u): cmd %u arg %u...\r\n",
-           cmdq_tail, cmdq_head,
-           cmdq[cmdq_tail].msg[0], cmdq[cmdq_tail].msg[CMD_MSG_PAYLOAD_OFFSET]);
+    if (tail == q->head)
+        return 1;
+    cmdq_barrier(); // read the entry only after seeing the head
+    msg_copy(cmd->msg, q->msgs[tail % CONFIG_CMD_QUEUE_LEN]);
+    cmd->link = q->link;
+    cmdq_barrier(); // done reading the entry before it is released
+    q->tail = tail + 1;
     return 0;
 }
 
+int cmd_dequeue(struct cmd *cmd)
+{
+    unsigned i, n;
+
+    for (i = 0; i < CMD_MAX_QUEUES; ++i) {
+        n = (cmdq_next + i) % CMD_MAX_QUEUES;
+        if (!cmdqs[n].obj.valid)
+            continue;
+        if (!dequeue(&cmdqs[n], cmd)) {
+            cmdq_next = n + 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
 bool cmd_pending()
 {
-    return !(cmdq_head == cmdq_tail);
+    struct cmdq *q;
+    unsigned i;
+
+    for (i = 0; i < CMD_MAX_QUEUES; ++i) {
+        q = &cmdqs[i];
+        if (q->obj.valid && (q->head != q->tail || nak_due(q)))
+            return true;
+    }
+    return false;
 }
 
 void cmd_handle(struct cmd *cmd)
 {
-    uint8_t reply[REPLY_SIZE];
+    uint8_t reply[REPLY_SIZE] __attribute__((aligned(4)));
     int reply_sz;
     size_t rc;
 
-    printf("command: handle: cmd %u arg %u...\r\n",
-           cmd->msg[0], cmd->msg[CMD_MSG_PAYLOAD_OFFSET]);
+    DPRINTF("command: handle: cmd %u arg %u...\r\n",
+            cmd->msg[0], cmd->msg[CMD_MSG_PAYLOAD_OFFSET]);
 
-    if (!cmd_handler) {
-        printf("command: handle: no handler registered\r\n");
-        return;
+    if (cmd->msg[0] == CMD_NAK) { // generated by dequeue: already a reply
+        struct cmd_nak *nak =
+            (struct cmd_nak *)&cmd->msg[CMD_MSG_PAYLOAD_OFFSET];
+        WPRINTF("command: handle: %s: NAK for %u dropped requests\r\n",
+                cmd->link->name, nak->count);
+        msg_copy(reply, cmd->msg);
+    } else {
+        if (!cmd_handler) {
+            EPRINTF("command: handle: no handler registered\r\n");
+            return;
+        }
+
+        bzero(reply, sizeof(reply));
+        reply_sz = cmd_handler(cmd, reply, sizeof(reply));
+        if (reply_sz < 0) {
+            EPRINTF("ERROR: command: handle: server failed to process request\r\n");
+            return;
+        }
+        if (!reply_sz) {
+            WPRINTF("command: handle: server did not produce a reply\r\n");
+            return;
+        }
     }
 
-    bzero(reply, sizeof(reply));
-    reply_sz = cmd_handler(cmd, reply, sizeof(reply));
-    if (reply_sz < 0) {
-        printf("ERROR: command: handle: server failed to process request\r\n");
-        return;
+    // For pipelined clients. PSCI replies are raw words for the ATF peer,
+    // without the type/seq header: byte 1 is data and is left alone.
+    if (cmd->msg[0] != CMD_PSCI)
+        reply[CMD_SEQ_OFFSET] = cmd->msg[CMD_SEQ_OFFSET];
+
+    DPRINTF("command: handle: %s: reply %u seq %u arg %u...\r\n",
+            cmd->link->name, reply[0], reply[CMD_SEQ_OFFSET],
+            reply[CMD_MSG_PAYLOAD_OFFSET]);
+
+    rc = cmd->link->send(cmd->link, CMD_TIMEOUT_MS_SERVE_REPLY, reply,
+                         sizeof(reply));
+    if (rc) {
+        DPRINTF("command: handle: %s: reply sent and ACK'd\r\n",
+                cmd->link->name);
+    } else {
+        EPRINTF("command: handle: %s: failed to send reply\r\n", cmd->link->name);
     }
-    if (!reply_sz) {
-        printf("command: handle: server did not produce a reply\r\n");
-        return;
+}
+
+int cmd_req_start(struct cmd_reqs *t, void *msg, void *reply, size_t reply_sz)
+{
+    struct cmd_req *r = NULL;
+    unsigned i;
+
+    for (i = 0; i < CMD_MAX_INFLIGHT; ++i) {
+        if (!t->reqs[i].pending) {
+            r = &t->reqs[i];
+            break;
+        }
+    }
+    if (!r)
+        return 0;
+
+    if (!++t->seq) // 0 is reserved for none
+        ++t->seq;
+    ((uint8_t *)msg)[CMD_SEQ_OFFSET] = t->seq;
+    r->seq = t->seq;
+    r->reply = reply;
+    r->reply_sz = reply_sz;
+    r->reply_sz_read = 0;
+    r->done = false;
+    cmdq_barrier(); // the entry must be complete before the receive path sees it
+    r->pending = true;
+    return r->seq;
+}
+
+int cmd_req_complete(struct cmd_reqs *t, const void *msg, size_t sz)
+{
+    const uint8_t *m = msg;
+    uint8_t seq = m[CMD_SEQ_OFFSET];
+    struct cmd_req *r = NULL;
+    unsigned i, n = 0;
+
+    for (i = 0; i < CMD_MAX_INFLIGHT; ++i) {
+        struct cmd_req *ri = &t->reqs[i];
+        if (!ri->pending || ri->done)
+            continue;
+        if (!seq) {
+            r = ri;
+            n++;
+        } else if (ri->seq == seq) {
+            r = ri;
+            break;
+        }
     }
+    if (!r || n > 1) // none, or ambiguous
+        return 1;
+
+    if (sz > r->reply_sz)
+        sz = r->reply_sz;
+    for (i = 0; i < sz; ++i)
+        ((uint8_t *)r->reply)[i] = m[i];
+    r->reply_sz_read = sz;
+    cmdq_barrier(); // the reply must be complete before it is seen as done
+    r->done = true;
+    return 0;
+}
+
+static struct cmd_req *req_find(struct cmd_reqs *t, int seq)
+{
+    unsigned i;
+    for (i = 0; i < CMD_MAX_INFLIGHT; ++i)
+        if (t->reqs[i].pending && t->reqs[i].seq == seq)
+            return &t->reqs[i];
+    return NULL;
+}
 
-    printf("command: handle: %s: reply %u arg %u...\r\n", cmd->link->name,
-           reply[0], reply[CMD_MSG_PAYLOAD_OFFSET]);
+int cmd_req_poll(struct cmd_reqs *t, int seq)
+{
+    struct cmd_req *r = req_find(t, seq);
+    int sz;
+
+    if (!r || !r->done)
+        return 0;
+    cmdq_barrier(); // read the reply only after seeing it done
+    sz = r->reply_sz_read;
+    r->pending = false;
+    return sz;
+}
 
-    rc = cmd->link->send(cmd->link, CMD_TIMEOUT_MS_REPLY, reply, sizeof(reply));
-    if (rc)
-        printf("command: handle: %s: reply sent and ACK'd\r\n", cmd->link->name);
-    else
-        printf("command: handle: %s: failed to send reply\r\n", cmd->link->name);
+void cmd_req_cancel(struct cmd_reqs *t, int seq)
+{
+    // not while the receive path (an ISR) might be writing the reply
+    unsigned irq_state = int_save_disable();
+    struct cmd_req *r = req_find(t, seq);
+    if (r)
+        r->pending = false;
+    int_restore(irq_state);
 }
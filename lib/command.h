@@ -13,6 +13,9 @@
 #define CMD_PING                        1
 #define CMD_PONG                        2
 #define CMD_PSCI                        3
+#define CMD_NAK                         4 // reply: requests were dropped
+#define CMD_BUF                         5 // payload by reference (shbuf.h)
+#define CMD_BUF_ACK                     6
 #define CMD_WATCHDOG_TIMEOUT            11
 #define CMD_LIFECYCLE                   13
 #define CMD_ACTION                      14
@@ -22,18 +25,88 @@
 
 #define CMD_ACTION_RESET_HPPS           1
 
+#define CMD_BUF_TYPE_DATA               1 // only checked against its checksum
+#define CMD_BUF_TYPE_LOG                2 // text, printed to the console
+
+#define CMD_BUF_STATUS_OK               0
+#define CMD_BUF_STATUS_RANGE            1 // not within the shared window
+#define CMD_BUF_STATUS_CHECKSUM         2
+#define CMD_BUF_STATUS_TYPE             3
+
 #define CMD_TIMEOUT_MS_SEND 1000
 #define CMD_TIMEOUT_MS_RECV 1000
 // wait up to 30 seconds for replies - a timeout prevent hangs when remotes fail
 #define CMD_TIMEOUT_MS_REPLY 30000
 
+// Waits while serving a command (cmd_handle): for the reply to be taken, and
+// for any request that the command makes on another link. With CONFIG_SCHED,
+// commands are served by a task and the watchdog is not kicked during a step
+// (see sched.h), so these add up to well within the watchdog timeout.
+#if CONFIG_SCHED
+#define CMD_TIMEOUT_MS_SERVE_REPLY 200
+#define CMD_TIMEOUT_MS_SERVE_SEND  100
+#define CMD_TIMEOUT_MS_SERVE_RECV  100
+#else // !CONFIG_SCHED
+#define CMD_TIMEOUT_MS_SERVE_REPLY CMD_TIMEOUT_MS_REPLY
+#define CMD_TIMEOUT_MS_SERVE_SEND  CMD_TIMEOUT_MS_SEND
+#define CMD_TIMEOUT_MS_SERVE_RECV  CMD_TIMEOUT_MS_RECV
+#endif // !CONFIG_SCHED
+
 struct cmd {
-    // the first byte of the message is the type, the next 3 bytes are reserved
+    // the first byte of the message is the type, the next byte is the
+    // sequence number, the next 2 bytes are reserved (the first of them
+    // carries the length over length-aware mailboxes: see mailbox.h)
     // the remainder of the msg is available for the payload
     uint8_t msg[CMD_MSG_SZ];
     struct link *link;
 };
 
+// Pipelined requests: a client may have up to CMD_MAX_INFLIGHT requests in
+// flight on a link. The client stamps each request with a sequence number,
+// which the server (cmd_handle) echoes in the reply, so that each reply
+// completes its own request, in whatever order the replies come. Sequence
+// number 0 means none: a reply without one completes the request in flight,
+// if there is only one (for servers that do not echo it). Replies to PSCI
+// requests are raw data without the header, and never carry it.
+#define CMD_SEQ_OFFSET 1
+#define CMD_MAX_INFLIGHT 8
+
+struct cmd_req {
+    volatile bool pending; // set by the requester, cleared when forgotten
+    volatile bool done; // set by the receive path
+    uint8_t seq;
+    void *reply;
+    size_t reply_sz;
+    volatile size_t reply_sz_read;
+};
+
+// Requests in flight on a link, on the client side
+struct cmd_reqs {
+    uint8_t seq; // last one used
+    struct cmd_req reqs[CMD_MAX_INFLIGHT];
+};
+
+// Reply to requests that were dropped because the queue of the link was
+// full: sent after the replies to the requests that were queued before them
+// (with the sequence number of the last dropped request)
+struct cmd_nak {
+    uint32_t cmd; // type of the last dropped request
+    uint32_t count; // requests dropped since the last NAK
+};
+
+// Payload in the shared window of the link (see shbuf.h)
+struct cmd_buf {
+    uint32_t type; // CMD_BUF_TYPE_*
+    uint32_t offset; // into the window
+    uint32_t len;
+    uint32_t checksum; // Adler-32 of the payload
+};
+
+// Reply to CMD_BUF, once the receiver is done with the payload
+struct cmd_buf_ack {
+    uint32_t status; // CMD_BUF_STATUS_*
+};
+
 struct cmd_lifecycle {
     uint32_t status;
     char info[CMD_MSG_PAYLOAD_SIZE - sizeof(uint32_t)];
@@ -57,6 +130,23 @@ void cmd_handler_unregister();
 
 void cmd_handle(struct cmd *cmd);
 
+// Requests are queued per link: a link that receives requests must have a
+// queue. Enqueue fails when the queue is full, and then the request is
+// answered with CMD_NAK (via dequeue and cmd_handle) instead.
+int cmd_queue_open(struct link *link);
+void cmd_queue_close(struct link *link);
+
+// The receive path of the client side completes requests, possibly from an
+// ISR. Start returns the sequence number stamped in msg, or 0 if there are
+// CMD_MAX_INFLIGHT requests in flight already. Complete returns 1 if the
+// reply is not for any request in flight. Poll returns the size of the
+// reply if it has come (and forgets the request), or 0. Cancel forgets a
+// request (e.g. after a timeout), after which its reply is not written.
+int cmd_req_start(struct cmd_reqs *t, void *msg, void *reply, size_t reply_sz);
+int cmd_req_complete(struct cmd_reqs *t, const void *msg, size_t sz);
+int cmd_req_poll(struct cmd_reqs *t, int seq);
+void cmd_req_cancel(struct cmd_reqs *t, int seq);
+
 int cmd_enqueue(struct cmd *cmd);
 int cmd_dequeue(struct cmd *cmd);
 bool cmd_pending();
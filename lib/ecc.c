@@ -36,6 +36,7 @@
 
 #include <stdint.h>
 #include "printf.h"
+#include "ecc.h"
 
 /*
  * invparity is a 256 byte table that contains the odd parity
@@ -127,49 +128,83 @@ static const char addressbits[256] = {
 	0x0e, 0x0e, 0x0f, 0x0f, 0x0e, 0x0e, 0x0f, 0x0f
 };
 
-/**
- * calculate_ecc - Calculate 3-byte ECC for 256/512-byte
- *			 block
+/*
+ * colparity holds the column parity bits of the third ECC byte (cp5..cp0,
+ * in bits 7..2) for each value of the byte-wide parity of the whole step,
+ * instead of looking up each of the six bits in invparity.
+ */
+static const unsigned char colparity[256] = {
+	0xfc, 0xa8, 0xa4, 0xf0, 0x98, 0xcc, 0xc0, 0x94,
+	0x94, 0xc0, 0xcc, 0x98, 0xf0, 0xa4, 0xa8, 0xfc,
+	0x68, 0x3c, 0x30, 0x64, 0x0c, 0x58, 0x54, 0x00,
+	0x00, 0x54, 0x58, 0x0c, 0x64, 0x30, 0x3c, 0x68,
+	0x64, 0x30, 0x3c, 0x68, 0x00, 0x54, 0x58, 0x0c,
+	0x0c, 0x58, 0x54, 0x00, 0x68, 0x3c, 0x30, 0x64,
+	0xf0, 0xa4, 0xa8, 0xfc, 0x94, 0xc0, 0xcc, 0x98,
+	0x98, 0xcc, 0xc0, 0x94, 0xfc, 0xa8, 0xa4, 0xf0,
+	0x58, 0x0c, 0x00, 0x54, 0x3c, 0x68, 0x64, 0x30,
+	0x30, 0x64, 0x68, 0x3c, 0x54, 0x00, 0x0c, 0x58,
+	0xcc, 0x98, 0x94, 0xc0, 0xa8, 0xfc, 0xf0, 0xa4,
+	0xa4, 0xf0, 0xfc, 0xa8, 0xc0, 0x94, 0x98, 0xcc,
+	0xc0, 0x94, 0x98, 0xcc, 0xa4, 0xf0, 0xfc, 0xa8,
+	0xa8, 0xfc, 0xf0, 0xa4, 0xcc, 0x98, 0x94, 0xc0,
+	0x54, 0x00, 0x0c, 0x58, 0x30, 0x64, 0x68, 0x3c,
+	0x3c, 0x68, 0x64, 0x30, 0x58, 0x0c, 0x00, 0x54,
+	0x54, 0x00, 0x0c, 0x58, 0x30, 0x64, 0x68, 0x3c,
+	0x3c, 0x68, 0x64, 0x30, 0x58, 0x0c, 0x00, 0x54,
+	0xc0, 0x94, 0x98, 0xcc, 0xa4, 0xf0, 0xfc, 0xa8,
+	0xa8, 0xfc, 0xf0, 0xa4, 0xcc, 0x98, 0x94, 0xc0,
+	0xcc, 0x98, 0x94, 0xc0, 0xa8, 0xfc, 0xf0, 0xa4,
+	0xa4, 0xf0, 0xfc, 0xa8, 0xc0, 0x94, 0x98, 0xcc,
+	0x58, 0x0c, 0x00, 0x54, 0x3c, 0x68, 0x64, 0x30,
+	0x30, 0x64, 0x68, 0x3c, 0x54, 0x00, 0x0c, 0x58,
+	0xf0, 0xa4, 0xa8, 0xfc, 0x94, 0xc0, 0xcc, 0x98,
+	0x98, 0xcc, 0xc0, 0x94, 0xfc, 0xa8, 0xa4, 0xf0,
+	0x64, 0x30, 0x3c, 0x68, 0x00, 0x54, 0x58, 0x0c,
+	0x0c, 0x58, 0x54, 0x00, 0x68, 0x3c, 0x30, 0x64,
+	0x68, 0x3c, 0x30, 0x64, 0x0c, 0x58, 0x54, 0x00,
+	0x00, 0x54, 0x58, 0x0c, 0x64, 0x30, 0x3c, 0x68,
+	0xfc, 0xa8, 0xa4, 0xf0, 0x98, 0xcc, 0xc0, 0x94,
+	0x94, 0xc0, 0xcc, 0x98, 0xf0, 0xa4, 0xa8, 0xfc,
+};
+
+/* The data is processed a longword at a time, including from byte buffers */
+typedef uint32_t __attribute__((may_alias)) ecc_word_t;
+
+#define ECC_ITER_WORDS	16	/* longwords per iteration of the parity loop */
+#define ECC_ITER_BYTES	(ECC_ITER_WORDS * sizeof(uint32_t))
+
+/*
+ * ecc_step - Calculate 3-byte ECC for one 256/512-byte step
  * @buf:	input buffer with raw data
- * @eccsize:	data bytes per ECC step (256 or 512)
+ * @len:	bytes of data in the step, the rest is taken to be 0xff
+ * @eccsize_mult: 1 for a 256-byte step, 2 for a 512-byte step
  * @code:	output buffer with ECC
+ *
+ * Iterations of the parity loop that are entirely padding contribute
+ * nothing (each parity accumulates an even number of all-ones longwords),
+ * so they are skipped. Only the iteration that straddles the end of the
+ * data, or any iteration over unaligned data, goes through a copy.
  */
-void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
-		       unsigned char *code)
+static void ecc_step(const unsigned char *buf, unsigned int len,
+		     uint32_t eccsize_mult, unsigned char *code)
 {
-	int i;
-	const uint32_t *bp = (uint32_t *)buf;
-	/* 256 or 512 bytes/ecc  */
-	uint32_t eccsize_mult;
+	unsigned int i, j;
+	unsigned int iters = (len + ECC_ITER_BYTES - 1) / ECC_ITER_BYTES;
+	unsigned int full = len / ECC_ITER_BYTES;
+	int aligned = ((uintptr_t)buf & 0x3) == 0;
+	const ecc_word_t *bp;
+	uint32_t tail[ECC_ITER_WORDS];
 	uint32_t cur;		/* current value in buffer */
 	/* rp0..rp15..rp17 are the various accumulated parities (per byte) */
 	uint32_t rp0, rp1, rp2, rp3, rp4, rp5, rp6, rp7;
 	uint32_t rp8, rp9, rp10, rp11, rp12, rp13, rp14, rp15, rp16;
-        uint32_t rp17;
-//	uint32_t uninitialized_var(rp17);	/* to make compiler happy */
+	uint32_t rp17 = 0;
 	uint32_t par;		/* the cumulative parity for all data */
 	uint32_t tmppar;	/* the cumulative parity for this iteration;
 				   for rp12, rp14 and rp16 at the end of the
 				   loop */
-        unsigned char cbuf[512];
-
-        if (eccsize < 256) {
-           for (i = 0; i < eccsize; i++) 
-               cbuf[i] = buf[i];
-           for (;i < 256; i++)
-               cbuf[i] = 0xff;
-           eccsize = 256;
-           bp = (uint32_t *)cbuf;           
-        } else if (eccsize < 512) {
-           for (i = 0; i < eccsize; i++) 
-               cbuf[i] = buf[i];
-           for (;i < 512; i++)
-               cbuf[i] = 0xff;
-           eccsize = 512;
-           bp = (uint32_t *)cbuf;           
-        }
-        eccsize_mult = eccsize >> 8;
- 
+
 	par = 0;
 	rp4 = 0;
 	rp6 = 0;
@@ -183,13 +218,26 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	 * The loop is unrolled a number of times;
 	 * This avoids if statements to decide on which rp value to update
 	 * Also we process the data by longwords.
-	 * Note: passing unaligned data might give a performance penalty.
-	 * It is assumed that the buffers are aligned.
 	 * tmppar is the cumulative sum of this iteration.
 	 * needed for calculating rp12, rp14, rp16 and par
 	 * also used as a performance improvement for rp6, rp8 and rp10
 	 */
-	for (i = 0; i < eccsize_mult << 2; i++) {
+	bp = (const ecc_word_t *)buf;
+	for (i = 0; i < iters; i++) {
+		if (!aligned || i == full) {
+			unsigned char *t = (unsigned char *)tail;
+			const unsigned char *b = buf + i * ECC_ITER_BYTES;
+			unsigned int n = len - i * ECC_ITER_BYTES;
+
+			if (n > ECC_ITER_BYTES)
+				n = ECC_ITER_BYTES;
+			for (j = 0; j < n; j++)
+				t[j] = b[j];
+			for (; j < ECC_ITER_BYTES; j++)
+				t[j] = 0xff;
+			bp = (const ecc_word_t *)tail;
+		}
+
 		cur = *bp++;
 		tmppar = cur;
 		rp4 ^= cur;
@@ -296,7 +344,7 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	 * rp0 rp1 rp0 rp1 in big endian
 	 * First calculate rp2 and rp3
 	 */
-#ifdef __BIG_ENDIAN
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 	rp2 = (par >> 16);
 	rp2 ^= (rp2 >> 8);
 	rp2 &= 0xff;
@@ -314,7 +362,7 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 
 	/* reduce par to 16 bits then calculate rp1 and rp0 */
 	par ^= (par >> 16);
-#ifdef __BIG_ENDIAN
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 	rp0 = (par >> 8) & 0xff;
 	rp1 = (par & 0xff);
 #else
@@ -331,9 +379,6 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	 * note that par = rp4 ^ rp5 and due to the commutative property
 	 * of the ^ operator we can say:
 	 * rp5 = (par ^ rp4);
-	 * The & 0xff seems superfluous, but benchmarking learned that
-	 * leaving it out gives slightly worse results. No idea why, probably
-	 * it has to do with the way the pipeline in pentium is organized.
 	 */
 	rp5 = (par ^ rp4) & 0xff;
 	rp7 = (par ^ rp6) & 0xff;
@@ -344,12 +389,7 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	if (eccsize_mult == 2)
 		rp17 = (par ^ rp16) & 0xff;
 
-	/*
-	 * Finally calculate the ECC bits.
-	 * Again here it might seem that there are performance optimisations
-	 * possible, but benchmarks showed that on the system this is developed
-	 * the code below is the fastest
-	 */
+	/* Finally calculate the ECC bits */
 	code[1] =
 	    (invparity[rp7] << 7) |
 	    (invparity[rp6] << 6) |
@@ -369,49 +409,28 @@ void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 	    (invparity[rp9] << 1)  |
 	    (invparity[rp8]);
 	if (eccsize_mult == 1)
-		code[2] =
-		    (invparity[par & 0xf0] << 7) |
-		    (invparity[par & 0x0f] << 6) |
-		    (invparity[par & 0xcc] << 5) |
-		    (invparity[par & 0x33] << 4) |
-		    (invparity[par & 0xaa] << 3) |
-		    (invparity[par & 0x55] << 2) |
-		    3;
+		code[2] = colparity[par] | 3;
 	else
-		code[2] =
-		    (invparity[par & 0xf0] << 7) |
-		    (invparity[par & 0x0f] << 6) |
-		    (invparity[par & 0xcc] << 5) |
-		    (invparity[par & 0x33] << 4) |
-		    (invparity[par & 0xaa] << 3) |
-		    (invparity[par & 0x55] << 2) |
+		code[2] = colparity[par] |
 		    (invparity[rp17] << 1) |
 		    (invparity[rp16] << 0);
 }
 
-/**
- * correct_data - [NAND Interface] Detect and correct bit error(s)
- * @buf:	raw data read from the chip
- * @read_ecc:	ECC from the chip
- * @calc_ecc:	the ECC calculated from raw data
- * @eccsize:	data bytes per ECC step (256 or 512)
+/*
+ * ecc_check - Locate a bit error in a step from the read and calculated ECC
+ * @len:	bytes of data in the step
  *
- * Detect and correct a 1 bit error for eccsize byte block
+ * Returns 0 if there is no error, 1 if there is a single bit error, in
+ * which case *byte_addr and *bit_addr locate it (*byte_addr is len or more
+ * if the error is in the ECC itself), and -1 if the error is uncorrectable.
  */
-int correct_data(unsigned char *buf,
-			unsigned char *read_ecc, unsigned char *calc_ecc,
-			unsigned int eccsize)
+static int ecc_check(const unsigned char *read_ecc,
+		     const unsigned char *calc_ecc, unsigned int len,
+		     uint32_t eccsize_mult,
+		     unsigned int *byte_addr, unsigned int *bit_addr)
 {
-	unsigned char b0, b1, b2, bit_addr;
-	unsigned int byte_addr;
-	/* 256 or 512 bytes/ecc  */
-	uint32_t eccsize_mult;
-
-        if (eccsize < 256) eccsize = 256;
-        else if (eccsize < 512) eccsize = 512;
-        eccsize_mult = eccsize >> 8;
-// printf("read_ecc = %02x %02x %02x\r\n", read_ecc[0], read_ecc[1], read_ecc[2]);
-// printf("calc_ecc = %02x %02x %02x\r\n", calc_ecc[0], calc_ecc[1], calc_ecc[2]);
+	unsigned char b0, b1, b2;
+
 	/*
 	 * b0 to b2 indicate which bit is faulty (if any)
 	 * we might need the xor result  more than once,
@@ -421,7 +440,6 @@ int correct_data(unsigned char *buf,
 	b1 = read_ecc[0] ^ calc_ecc[0];
 	b2 = read_ecc[2] ^ calc_ecc[2];
 
-// printf("b[] = %02x %02x %02x\r\n", b0, b1, b2);
 	/* check if there are any bitfaults */
 
 	/* repeated if statements are slightly more efficient than switch ... */
@@ -440,33 +458,149 @@ int correct_data(unsigned char *buf,
 		 * byte, cp 5/3/1 indicate the faulty bit.
 		 * A lookup table (called addressbits) is used to filter
 		 * the bits from the byte they are in.
-		 * A marginal optimisation is possible by having three
-		 * different lookup tables.
-		 * One as we have now (for b0), one for b2
-		 * (that would avoid the >> 1), and one for b1 (with all values
-		 * << 4). However it was felt that introducing two more tables
-		 * hardly justify the gain.
 		 *
 		 * The b2 shift is there to get rid of the lowest two bits.
-		 * We could also do addressbits[b2] >> 1 but for the
-		 * performance it does not make any difference
 		 */
 		if (eccsize_mult == 1)
-			byte_addr = (addressbits[b1] << 4) + addressbits[b0];
+			*byte_addr = (addressbits[b1] << 4) + addressbits[b0];
 		else
-			byte_addr = (addressbits[b2 & 0x3] << 8) +
-				    (addressbits[b1] << 4) + addressbits[b0];
-		bit_addr = addressbits[b2 >> 2];
-		/* flip the bit */
-		buf[byte_addr] ^= (1 << bit_addr);
-                printf("(%d)-th byte, (%d)-th bit is flipped. Fixed\n", byte_addr, bit_addr);
+			*byte_addr = (addressbits[b2 & 0x3] << 8) +
+				     (addressbits[b1] << 4) + addressbits[b0];
+		*bit_addr = addressbits[b2 >> 2];
+		/* a flip in the padding past the data cannot have happened */
+		if (*byte_addr >= len)
+			return -1;
 		return 1;
-
 	}
 	/* count nr of bits; use table lookup, faster than calculating it */
-	if ((bitsperbyte[b0] + bitsperbyte[b1] + bitsperbyte[b2]) == 1)
-		return 1;	/* error in ECC data; no action needed */
+	if ((bitsperbyte[b0] + bitsperbyte[b1] + bitsperbyte[b2]) == 1) {
+		*byte_addr = len;	/* error in ECC data; no action needed */
+		return 1;
+	}
 
-	printf("%s: uncorrectable ECC error\n", __func__);
 	return -1;
 }
+
+static uint32_t ecc_size_mult(unsigned int eccsize)
+{
+	/* 256 or 512 bytes/ecc */
+	return eccsize <= 256 ? 1 : 2;
+}
+
+/*
+ * For a single block, anything shorter than 256 bytes is padded to a
+ * 256-byte step, and anything from 256 bytes up to a 512-byte step. This
+ * is how the ECC stored in existing images was calculated.
+ */
+static uint32_t ecc_block_mult(unsigned int eccsize)
+{
+	return eccsize < 256 ? 1 : 2;
+}
+
+/**
+ * calculate_ecc - Calculate 3-byte ECC for 256/512-byte
+ *			 block
+ * @buf:	input buffer with raw data
+ * @eccsize:	data bytes in the block (up to 512)
+ * @code:	output buffer with ECC
+ */
+void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
+		       unsigned char *code)
+{
+	ecc_step(buf, eccsize, ecc_block_mult(eccsize), code);
+}
+
+/**
+ * calculate_ecc_steps - Calculate ECC for a buffer of any number of steps
+ * @buf:	input buffer with raw data
+ * @size:	bytes of data, the last step may be partial
+ * @eccsize:	data bytes per ECC step (256 or 512)
+ * @code:	output buffer, ECC_SIZE(@size, @eccsize) bytes
+ *
+ * Returns the number of steps
+ */
+unsigned int calculate_ecc_steps(const unsigned char *buf, unsigned int size,
+				 unsigned int eccsize, unsigned char *code)
+{
+	uint32_t eccsize_mult = ecc_size_mult(eccsize);
+	unsigned int off, len, steps = 0;
+
+	for (off = 0; off < size; off += eccsize) {
+		len = size - off < eccsize ? size - off : eccsize;
+		ecc_step(buf + off, len, eccsize_mult, code);
+		code += ECC_512_SIZE;
+		steps++;
+	}
+	return steps;
+}
+
+/**
+ * correct_data - [NAND Interface] Detect and correct bit error(s)
+ * @buf:	raw data read from the chip
+ * @read_ecc:	ECC from the chip
+ * @calc_ecc:	the ECC calculated from raw data
+ * @eccsize:	data bytes in the block (up to 512)
+ *
+ * Detect and correct a 1 bit error for eccsize byte block
+ */
+int correct_data(unsigned char *buf,
+			unsigned char *read_ecc, unsigned char *calc_ecc,
+			unsigned int eccsize)
+{
+	unsigned int byte_addr, bit_addr;
+	int rc;
+
+	rc = ecc_check(read_ecc, calc_ecc, eccsize, ecc_block_mult(eccsize),
+		       &byte_addr, &bit_addr);
+	if (rc < 0) {
+		printf("%s: uncorrectable ECC error\r\n", __func__);
+		return -1;
+	}
+	if (rc > 0 && byte_addr < eccsize) {
+		/* flip the bit */
+		buf[byte_addr] ^= (1 << bit_addr);
+		printf("(%d)-th byte, (%d)-th bit is flipped. Fixed\r\n",
+		       byte_addr, bit_addr);
+	}
+	return rc;
+}
+
+/**
+ * correct_data_steps - Detect and correct bit errors in a whole buffer
+ * @buf:	raw data, corrected in place
+ * @size:	bytes of data, the last step may be partial
+ * @read_ecc:	ECC stored with the data, ECC_SIZE(@size, @eccsize) bytes
+ * @eccsize:	data bytes per ECC step (256 or 512)
+ *
+ * Corrects up to one bit error per step. Returns the number of steps in
+ * which an error was found (in the data or in the ECC), or -1 if any step
+ * has an uncorrectable error, in which case the buffer may have been
+ * partially corrected.
+ */
+int correct_data_steps(unsigned char *buf, unsigned int size,
+		       const unsigned char *read_ecc, unsigned int eccsize)
+{
+	uint32_t eccsize_mult = ecc_size_mult(eccsize);
+	unsigned char calc_ecc[ECC_512_SIZE];
+	unsigned int off, len, byte_addr, bit_addr;
+	int rc, errors = 0;
+
+	for (off = 0; off < size; off += eccsize) {
+		len = size - off < eccsize ? size - off : eccsize;
+		ecc_step(buf + off, len, eccsize_mult, calc_ecc);
+		rc = ecc_check(read_ecc, calc_ecc, len, eccsize_mult,
+			       &byte_addr, &bit_addr);
+		if (rc < 0) {
+			printf("%s: uncorrectable ECC error at offset 0x%x\r\n",
+			       __func__, off);
+			return -1;
+		}
+		if (rc > 0) {
+			if (byte_addr < len)
+				buf[off + byte_addr] ^= (1 << bit_addr);
+			errors++;
+		}
+		read_ecc += ECC_512_SIZE;
+	}
+	return errors;
+}
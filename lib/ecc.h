@@ -1,9 +1,16 @@
 #ifndef ECC__H
 #define ECC__H
 #define ECC_512_SIZE 3
+/* bytes of ECC for size bytes of data in steps of eccsize bytes */
+#define ECC_SIZE(size, eccsize) \
+	((((size) + (eccsize) - 1) / (eccsize)) * ECC_512_SIZE)
 void calculate_ecc(const unsigned char *buf, unsigned int eccsize,
 		       unsigned char *code);
+unsigned int calculate_ecc_steps(const unsigned char *buf, unsigned int size,
+				 unsigned int eccsize, unsigned char *code);
 int correct_data(unsigned char *buf,
 			unsigned char *read_ecc, unsigned char *calc_ecc,
 			unsigned int eccsize);
+int correct_data_steps(unsigned char *buf, unsigned int size,
+		       const unsigned char *read_ecc, unsigned int eccsize);
 #endif
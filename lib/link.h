@@ -5,6 +5,9 @@
 
 #include "object.h"
 
+struct cmdq;
+struct shbuf_win;
+
 /**
  * The link struct is effectively an API, which can be populated by other
  * link-like interfaces.
@@ -13,6 +16,8 @@ struct link {
     struct object obj;
     void *priv;
     const char *name;
+    struct cmdq *cmdq; // requests received, if the link is a server
+    const struct shbuf_win *shbuf; // for payloads by reference, if any
     int (*disconnect)(struct link *link);
     // returns 0 on timeout, or positive value for number of bytes sent
     int (*send)(struct link *link, int timeout_ms, void *buf, size_t sz);
@@ -20,6 +25,13 @@ struct link {
     int (*request)(struct link *link,
                    int wtimeout_ms, void *wbuf, size_t wsz,
                    int rtimeout_ms, void *rbuf, size_t rsz);
+    // Pipelined requests (see struct cmd_reqs): request_start returns -1 on
+    // send failure or when too many requests are in flight, or the sequence
+    // number of the request; request_wait returns 0 on read timeout (the
+    // request is then forgotten), or number of bytes read into its rbuf
+    int (*request_start)(struct link *link, int wtimeout_ms,
+                         void *wbuf, size_t wsz, void *rbuf, size_t rsz);
+    int (*request_wait)(struct link *link, int seq, int rtimeout_ms);
     // recv not used for interrupt-based exchange mechanisms
     // returns 0 if no data, or number of bytes received
     int (*recv)(struct link *link, void *buf, size_t sz);
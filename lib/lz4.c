@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lz4.h"
+
+// A sequence is: token, [literal length bytes], literals, offset (2 bytes),
+// [match length bytes]. The last sequence of a block ends after its literals.
+#define MIN_MATCH 4
+#define RUN_MASK  0xf
+
+enum state {
+    ST_TOKEN = 0,
+    ST_LIT_LEN,
+    ST_LIT,
+    ST_OFF_LO,
+    ST_OFF_HI,
+    ST_MATCH_LEN,
+};
+
+void lz4_init(struct lz4_stream *s, void *dst, unsigned size)
+{
+    s->start = dst;
+    s->out = dst;
+    s->end = s->start + size;
+    s->state = ST_TOKEN;
+    s->len = 0;
+    s->mlen = 0;
+    s->offset = 0;
+}
+
+static int copy_match(struct lz4_stream *s)
+{
+    const uint8_t *from = s->out - s->offset;
+    unsigned i;
+
+    if (s->mlen > (unsigned)(s->end - s->out))
+        return 1;
+    // byte by byte: the match may overlap the output it produces
+    for (i = 0; i < s->mlen; ++i)
+        s->out[i] = from[i];
+    s->out += s->mlen;
+    return 0;
+}
+
+int lz4_decompress(struct lz4_stream *s, const uint8_t *in, unsigned len)
+{
+    const uint8_t *in_end = in + len;
+    unsigned b, n, i;
+
+    while (in < in_end) {
+        switch (s->state) {
+            case ST_TOKEN:
+                b = *in++;
+                s->len = b >> 4;
+                s->mlen = (b & RUN_MASK) + MIN_MATCH;
+                if (s->len == RUN_MASK)
+                    s->state = ST_LIT_LEN;
+                else
+                    s->state = s->len ? ST_LIT : ST_OFF_LO;
+                break;
+            case ST_LIT_LEN:
+                b = *in++;
+                s->len += b;
+                if (b != 255)
+                    s->state = ST_LIT;
+                break;
+            case ST_LIT:
+                n = in_end - in;
+                if (n > s->len)
+                    n = s->len;
+                if (n > (unsigned)(s->end - s->out))
+                    return 1;
+                for (i = 0; i < n; ++i)
+                    s->out[i] = in[i];
+                s->out += n;
+                in += n;
+                s->len -= n;
+                if (!s->len)
+                    s->state = ST_OFF_LO;
+                break;
+            case ST_OFF_LO:
+                s->offset = *in++;
+                s->state = ST_OFF_HI;
+                break;
+            case ST_OFF_HI:
+                s->offset |= *in++ << 8;
+                if (!s->offset || s->offset > (unsigned)(s->out - s->start))
+                    return 1;
+                if (s->mlen == RUN_MASK + MIN_MATCH) {
+                    s->state = ST_MATCH_LEN;
+                } else {
+                    if (copy_match(s))
+                        return 1;
+                    s->state = ST_TOKEN;
+                }
+                break;
+            case ST_MATCH_LEN:
+                b = *in++;
+                s->mlen += b;
+                if (b != 255) {
+                    if (copy_match(s))
+                        return 1;
+                    s->state = ST_TOKEN;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+bool lz4_complete(struct lz4_stream *s)
+{
+    return s->state == ST_OFF_LO;
+}
+
+unsigned lz4_out_size(struct lz4_stream *s)
+{
+    return s->out - s->start;
+}
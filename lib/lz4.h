@@ -0,0 +1,41 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Streaming decompressor for the LZ4 block format: the compressed block can
+// be fed in pieces of any size, and the output is written straight to its
+// final location (matches are copied from the output written so far).
+
+// Header that precedes the LZ4 block in a compressed file (little-endian)
+#define LZ4_MAGIC 0x42345a4c // "LZ4B"
+struct lz4_header {
+    uint32_t magic;
+    uint32_t size; // decompressed size
+};
+
+struct lz4_stream {
+    uint8_t *start;
+    uint8_t *out; // next byte of output
+    uint8_t *end;
+    unsigned state;
+    unsigned len; // of the literal run being decoded
+    unsigned mlen; // of the match being decoded
+    unsigned offset;
+};
+
+void lz4_init(struct lz4_stream *s, void *dst, unsigned size);
+
+// Decompress the next piece of the block. Returns 0 on success, or non-zero
+// if the data is corrupted or would overflow the output.
+int lz4_decompress(struct lz4_stream *s, const uint8_t *in, unsigned len);
+
+// Whether the block decompressed so far ended on a sequence boundary where
+// the block may end (after the literals of a sequence)
+bool lz4_complete(struct lz4_stream *s);
+
+// Bytes of output so far
+unsigned lz4_out_size(struct lz4_stream *s);
+
+#endif // LZ4_H
@@ -1,5 +1,8 @@
+#define DEBUG 0
+
 #include <stdbool.h>
 
+#include "arm.h"
 #include "command.h"
 #include "link.h"
 #include "mailbox.h"
@@ -11,15 +14,6 @@
 
 
 #define MAX_LINKS 8
-// pretty coarse, limited by systick
-#define MIN_SLEEP_MS 500
-
-struct cmd_ctx {
-    bool tx_acked;
-    uint32_t *reply;
-    size_t reply_sz;
-    size_t reply_sz_read;
-};
 
 struct mbox_link {
     struct object obj;
@@ -27,7 +21,9 @@ struct mbox_link {
     unsigned idx_from;
     struct mbox *mbox_from;
     struct mbox *mbox_to;
-    volatile struct cmd_ctx cmd_ctx;
+    volatile bool tx_acked;
+    struct cmd_reqs reqs; // completed by the reply ISR
+    bool polled; // no interrupts: events are polled while waiting
 };
 
 static struct mbox_link_dev *devs[MBOX_DEV_COUNT] = {0};
@@ -38,7 +34,7 @@ int mbox_link_dev_add(mbox_dev_id id, struct mbox_link_dev *dev)
 {
     ASSERT(id < MBOX_DEV_COUNT);
     if (devs[id]) {
-        printf("ERROR: mbox_link_dev_add: already added id=%u\r\n", id);
+        EPRINTF("ERROR: mbox_link_dev_add: already added id=%u\r\n", id);
         return -1;
     }
     devs[id] = dev;
@@ -61,9 +57,10 @@ static void handle_ack(void *arg)
 {
     struct link *link = arg;
     struct mbox_link *mlink = link->priv;
-    printf("%s: handle_ack\r\n", link->name);
-    mlink->cmd_ctx.tx_acked = true;
+    DPRINTF("%s: handle_ack\r\n", link->name);
+    mlink->tx_acked = true;
     mbox_event_clear_ack(mlink->mbox_to);
+    send_event(); // wake up the sender
 }
 
 static void handle_cmd(void *arg)
@@ -74,109 +71,144 @@ static void handle_cmd(void *arg)
     cmd.link = link;
     ASSERT(sizeof(cmd.msg) == HPSC_MBOX_DATA_SIZE); // o/w zero-fill rest of msg
 
-    printf("%s: handle_cmd\r\n", link->name);
+    DPRINTF("%s: handle_cmd\r\n", link->name);
     // read never fails if sizeof(cmd.msg) > 0
     mbox_read(mlink->mbox_from, cmd.msg, sizeof(cmd.msg));
     mbox_event_clear_rcv(mlink->mbox_from);
     mbox_event_set_ack(mlink->mbox_from);
     if (cmd_enqueue(&cmd))
-        panic("handle_cmd: failed to enqueue command");
+        WPRINTF("%s: handle_cmd: queue full, will NAK\r\n", link->name);
 }
 
 static void handle_reply(void *arg)
 {
     struct link *link = arg;
     struct mbox_link *mlink = link->priv;
-    printf("%s: handle_reply\r\n", link->name);
-    mlink->cmd_ctx.reply_sz_read = mbox_read(mlink->mbox_from,
-                                             mlink->cmd_ctx.reply,
-                                             mlink->cmd_ctx.reply_sz);
+    uint32_t msg[HPSC_MBOX_DATA_REGS];
+    size_t sz;
+    DPRINTF("%s: handle_reply\r\n", link->name);
+    sz = mbox_read(mlink->mbox_from, msg, sizeof(msg));
+    mbox_event_clear_rcv(mlink->mbox_from);
+    mbox_event_set_ack(mlink->mbox_from);
+    if (cmd_req_complete(&mlink->reqs, msg, sz))
+        WPRINTF("%s: handle_reply: not a reply to a request in flight\r\n",
+                link->name);
+    send_event(); // wake up the requester
+}
+
+// Wait for what the ISRs would otherwise wake us for
+static bool link_wait(struct mbox_link *mlink, struct timeout *to)
+{
+    return mlink->polled ? timeout_poll(to) : timeout_wait(to);
+}
+
+// For polled server links: bounded, so that the main loop gets to serve the
+// other links in between
+static int mbox_link_recv(struct link *link, void *buf, size_t sz)
+{
+    struct mbox_link *mlink = link->priv;
+    unsigned budget = CONFIG_MBOX_POLL_BUDGET;
+    size_t rc;
+
+    while (!mbox_event_poll(mlink->mbox_from))
+        if (!budget--)
+            return 0;
+    DPRINTF("%s: recv\r\n", link->name);
+    rc = mbox_read(mlink->mbox_from, buf, sz);
     mbox_event_clear_rcv(mlink->mbox_from);
     mbox_event_set_ack(mlink->mbox_from);
+    return rc;
 }
 
 static int mbox_link_disconnect(struct link *link) {
     struct mbox_link *mlink = link->priv;
     int rc;
-    printf("%s: disconnect\r\n", link->name);
+    IPRINTF("%s: disconnect\r\n", link->name);
     // in case of failure, keep going and fwd code
     rc = mbox_release(mlink->mbox_from);
     rc |= mbox_release(mlink->mbox_to);
+    cmd_queue_close(link);
     OBJECT_FREE(mlink);
     OBJECT_FREE(link);
     return rc;
 }
 
-static void msleep_and_dec(int *ms_rem)
-{
-    msleep(MIN_SLEEP_MS);
-    // if < 0, timeout is infinite
-    if (*ms_rem > 0)
-        *ms_rem -= *ms_rem >= MIN_SLEEP_MS ? MIN_SLEEP_MS : *ms_rem;
-}
-
 static int mbox_link_send(struct link *link, int timeout_ms, void *buf,
                           size_t sz)
 {
     struct mbox_link *mlink = link->priv;
-    int sleep_ms_rem = timeout_ms;
+    struct timeout to;
     int rc;
-    mlink->cmd_ctx.tx_acked = false;
+    mlink->tx_acked = false;
     rc = mbox_send(mlink->mbox_to, buf, sz);
     mbox_event_set_rcv(mlink->mbox_to);
-    printf("%s: send: waiting for ACK...\r\n", link->name);
+    DPRINTF("%s: send: waiting for ACK...\r\n", link->name);
+    timeout_start(&to, timeout_ms);
     do {
-        if (mlink->cmd_ctx.tx_acked) {
-            printf("%s: send: ACK received\r\n", link->name);
+        if (mlink->polled && mbox_event_poll(mlink->mbox_to))
+            mlink->tx_acked = true;
+        if (mlink->tx_acked) {
+            DPRINTF("%s: send: ACK received\r\n", link->name);
             mbox_event_clear_ack(mlink->mbox_to);
             return rc;
         }
-        if (!sleep_ms_rem)
-            break; // timeout
-        msleep_and_dec(&sleep_ms_rem);
-    } while (1);
+    } while (link_wait(mlink, &to)); // woken by the ACK ISR
     return 0;
 }
 
-static int mbox_link_poll(struct link *link, int timeout_ms)
+static int mbox_link_request_start(struct link *link, int wtimeout_ms,
+                                   void *wbuf, size_t wsz,
+                                   void *rbuf, size_t rsz)
 {
     struct mbox_link *mlink = link->priv;
-    int sleep_ms_rem = timeout_ms;
+    int seq;
+
+    DPRINTF("%s: request\r\n", link->name);
+    seq = cmd_req_start(&mlink->reqs, wbuf, rbuf, rsz);
+    if (!seq) {
+        WPRINTF("%s: request: too many requests in flight\r\n", link->name);
+        return -1;
+    }
+    if (!mbox_link_send(link, wtimeout_ms, wbuf, wsz)) {
+        WPRINTF("%s: request: send timed out\r\n", link->name);
+        cmd_req_cancel(&mlink->reqs, seq);
+        return -1;
+    }
+    return seq;
+}
+
+static int mbox_link_request_wait(struct link *link, int seq, int timeout_ms)
+{
+    struct mbox_link *mlink = link->priv;
+    struct timeout to;
     int rc;
-    printf("%s: poll: waiting for reply...\r\n", link->name);
+    DPRINTF("%s: poll: waiting for reply %d...\r\n", link->name, seq);
+    timeout_start(&to, timeout_ms);
     do {
-        rc = mlink->cmd_ctx.reply_sz_read;
+        if (mlink->polled && mbox_event_poll(mlink->mbox_from))
+            handle_reply(link);
+        rc = cmd_req_poll(&mlink->reqs, seq);
         if (rc) {
-            printf("%s: poll: reply received\r\n", link->name);
-            break; // got data
+            DPRINTF("%s: poll: reply received\r\n", link->name);
+            return rc; // got data
         }
-        if (!sleep_ms_rem)
-            break; // timeout
-        msleep_and_dec(&sleep_ms_rem);
-    } while (1);
-    return rc;
+    } while (link_wait(mlink, &to)); // woken by the reply ISR
+    cmd_req_cancel(&mlink->reqs, seq);
+    return 0;
 }
 
 static int mbox_link_request(struct link *link,
                              int wtimeout_ms, void *wbuf, size_t wsz,
                              int rtimeout_ms, void *rbuf, size_t rsz)
 {
-    struct mbox_link *mlink = link->priv;
-    int rc;
-
-    printf("%s: request\r\n", link->name);
-    mlink->cmd_ctx.reply_sz_read = 0;
-    mlink->cmd_ctx.reply = rbuf;
-    mlink->cmd_ctx.reply_sz = rsz / sizeof(uint32_t);
+    int seq, rc;
 
-    rc = mbox_link_send(link, wtimeout_ms, wbuf, wsz);
-    if (!rc) {
-        printf("%s: request: send timed out\r\n", link->name);
+    seq = mbox_link_request_start(link, wtimeout_ms, wbuf, wsz, rbuf, rsz);
+    if (seq < 0)
         return -1;
-    }
-    rc = mbox_link_poll(link, rtimeout_ms);
+    rc = mbox_link_request_wait(link, seq, rtimeout_ms);
     if (!rc)
-        printf("%s: request: recv failed\r\n", link->name);
+        EPRINTF("%s: request: recv failed\r\n", link->name);
     return rc;
 }
 
@@ -186,19 +218,26 @@ struct link *mbox_link_connect(const char *name, struct mbox_link_dev *ldev,
 {
     struct mbox_link *mlink;
     struct link *link;
-    printf("%s: connect\r\n", name);
+    IPRINTF("%s: connect\r\n", name);
     link = OBJECT_ALLOC(links);
     if (!link)
         return NULL;
 
     mlink = OBJECT_ALLOC(mlinks);
     if (!mlink) {
-        printf("ERROR: mbox_link_connect: failed to allocate mlink state\r\n");
+        EPRINTF("ERROR: mbox_link_connect: failed to allocate mlink state\r\n");
         goto free_link;
     }
 
     mlink->idx_from = idx_from;
     mlink->idx_to = idx_to;
+    mlink->polled = !ldev->rcv_irq;
+
+    // before the ISR can receive any requests
+    if (server && cmd_queue_open(link)) {
+        EPRINTF("ERROR: mbox_link_connect: failed to allocate cmd queue\r\n");
+        goto free_links;
+    }
 
     union mbox_cb rcv_cb = { .rcv_cb = server ? handle_cmd : handle_reply };
     mlink->mbox_from = mbox_claim(ldev->base, idx_from,
@@ -206,8 +245,8 @@ struct link *mbox_link_connect(const char *name, struct mbox_link_dev *ldev,
                                   server, client, server, MBOX_INCOMING,
                                   rcv_cb, link);
     if (!mlink->mbox_from) {
-        printf("ERROR: mbox_link_connect: failed to claim mbox_from\r\n");
-        goto free_links;
+        EPRINTF("ERROR: mbox_link_connect: failed to claim mbox_from\r\n");
+        goto free_queue;
     }
 
     union mbox_cb ack_cb = { .ack_cb = handle_ack };
@@ -216,26 +255,39 @@ struct link *mbox_link_connect(const char *name, struct mbox_link_dev *ldev,
                                 server, server, client, MBOX_OUTGOING,
                                 ack_cb, link);
     if (!mlink->mbox_to) {
-        printf("ERROR: mbox_link_connect: failed to claim mbox_to\r\n");
+        EPRINTF("ERROR: mbox_link_connect: failed to claim mbox_to\r\n");
         goto free_from;
     }
 
-    mlink->cmd_ctx.tx_acked = false;
-    mlink->cmd_ctx.reply = NULL;
+    mlink->tx_acked = false;
 
     link->priv = mlink;
     link->name = name;
     link->disconnect = mbox_link_disconnect;
     link->send = mbox_link_send;
     link->request = mbox_link_request;
-    link->recv = NULL;
+    link->request_start = mbox_link_request_start;
+    link->request_wait = mbox_link_request_wait;
+    // with interrupts, requests are received (enqueued) by the ISR
+    link->recv = mlink->polled && server ? mbox_link_recv : NULL;
     return link;
 
 free_from:
     mbox_release(mlink->mbox_from);
+free_queue:
+    cmd_queue_close(link);
 free_links:
     OBJECT_FREE(mlink);
 free_link:
     OBJECT_FREE(link);
     return NULL;
 }
+
+#if CONFIG_MBOX_MSG_LEN
+void mbox_link_set_msg_len(struct link *link, bool enable)
+{
+    struct mbox_link *mlink = link->priv;
+    mbox_set_msg_len(mlink->mbox_from, enable);
+    mbox_set_msg_len(mlink->mbox_to, enable);
+}
+#endif // CONFIG_MBOX_MSG_LEN
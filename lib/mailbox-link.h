@@ -1,6 +1,7 @@
 #ifndef MAILBOX_LINK_H
 #define MAILBOX_LINK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "intc.h"
@@ -10,6 +11,10 @@
 // configured interrupts that cover both inbound and outbound mailbox channels.
 // These properties are configured externally from the mailbox driver and
 // mailbox-link library, hence the separate data structure.
+//
+// Without IRQs (rcv_irq and ack_irq NULL), links on the device are polled:
+// the requester spins on the mailbox event status while it waits for the ACK
+// and the reply, and a server link has a recv op for the main loop.
 struct mbox_link_dev {
     uintptr_t base;
     struct irq *rcv_irq;
@@ -44,4 +49,10 @@ struct link *mbox_link_connect(const char *name, struct mbox_link_dev *ldev,
                                unsigned idx_from, unsigned idx_to,
                                unsigned server, unsigned client);
 
+#if CONFIG_MBOX_MSG_LEN
+// Declare the peer of a link length-aware (see mailbox.h): only for links on
+// which the peer does the same, and that carry only command-format messages
+void mbox_link_set_msg_len(struct link *link, bool enable);
+#endif // CONFIG_MBOX_MSG_LEN
+
 #endif // MAILBOX_LINK_H
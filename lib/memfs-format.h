@@ -0,0 +1,36 @@
+#ifndef MEMFS_FORMAT_H
+#define MEMFS_FORMAT_H
+
+#include <stdint.h>
+
+#include "ecc.h"
+
+// On-media layout of the file system image in SRAM: the global table, then
+// the file descriptors, each with the ECC of the struct.
+
+#define FILE_NAME_LENGTH 200
+
+// Flags in the valid field of a descriptor (any non-zero value is valid)
+#define FILE_FLAG_LZ4 (1 << 16) // data is an LZ4 image, see lz4.h
+
+typedef struct {
+    uint32_t valid;
+    uint32_t offset;	/* offset in memory */
+    uint32_t size;
+    uint32_t load_addr;		/* 32bit load address in DRAM at run-time */
+    uint32_t load_addr_high;	/* high 32bit of 64 bit load address in DRAM at run-time */
+    char  name[FILE_NAME_LENGTH];
+    uint32_t entry_offset;	/* the offset of the entry point in the image */
+    uint8_t chcksum[32];		/* SHA-256 checksum */
+    uint8_t ecc[ECC_512_SIZE];	/* ecc of the struct */
+} file_descriptor;
+
+typedef struct {
+    uint32_t low_mark_data;	/* low mark of data */
+    uint32_t high_mark_fd;	/* high mark of file descriptors */
+    uint32_t n_files;		/* number of files */
+    uint32_t fsize;		/* sram file size */
+    uint8_t ecc[ECC_512_SIZE];   /* ecc of the struct */
+} global_table;
+
+#endif // MEMFS_FORMAT_H
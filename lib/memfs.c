@@ -1,59 +1,120 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "printf.h"
 #include "panic.h"
 #include "str.h"
 #include "dma.h"
 #include "bit.h"
 #include "object.h"
+#include "sha256.h"
+#include "ecc.h"
+#include "lz4.h"
 
 #include "memfs.h"
+#include "memfs-format.h"
+
+#define CHECKSUM_SIZE 32
 
-#define FILE_NAME_LENGTH 200
-#define ECC_512_SIZE	3
 #define PAGE_SIZE (1 << 14) // 16KB (used for progress display only)
 
-typedef struct {
-    uint32_t valid;
-    uint32_t offset;	/* offset in memory */
-    uint32_t size;
-    uint32_t load_addr;		/* 32bit load address in DRAM at run-time */
-    uint32_t load_addr_high;	/* high 32bit of 64 bit load address in DRAM at run-time */
-    char  name[FILE_NAME_LENGTH];
-    uint32_t entry_offset;	/* the offset of the entry point in the image */
-    uint8_t chcksum[32];		/* SHA-256 checksum */
-    uint8_t ecc[ECC_512_SIZE];	/* ecc of the struct */
-} file_descriptor;
-
-typedef struct {
-    uint32_t low_mark_data;	/* low mark of data */
-    uint32_t high_mark_fd;	/* high mark of file descriptors */
-    uint32_t n_files;		/* number of files */
-    uint32_t fsize;		/* sram file size */
-    uint8_t ecc[ECC_512_SIZE];   /* ecc of the struct */
-} global_table;
+// The directory is read from SRAM once, at mount time, into an index in
+// RAM: lookups hash the name and compare it against the cached copy, so that
+// loading a file reads nothing but its data from SRAM.
+#define MAX_FILES        32
+#define NAME_CACHE_SIZE  32 // longer names are not supported
+#define INDEX_SIZE       (2 * MAX_FILES) // power of 2, keeps probes short
+
+struct memfs_file {
+    bool resident; // loaded and verified, and not overwritten since
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t size; // in SRAM
+    uint32_t load_size; // once loaded: larger than size if compressed
+    bool lz4;
+    uint32_t load_addr;
+    uint8_t chcksum[CHECKSUM_SIZE]; // of the loaded (decompressed) data
+    char name[NAME_CACHE_SIZE];
+};
 
 struct memfs {
+    struct object obj;
     uintptr_t base;
     struct dma *dmac; // optional, for loading files via DMA
+    struct memfs_file files[MAX_FILES];
+    unsigned n_files;
+    uint8_t index[INDEX_SIZE]; // file number + 1, or 0 if empty
+    unsigned sram_reads; // words read from SRAM for the directory
+};
+
+#if CONFIG_MEMFS_VERIFY
+// Files are verified against the SHA-256 checksum in their descriptor while
+// loading: the file is copied in chunks, and the CPU hashes chunk N while the
+// DMA copies the following ones. The number of chunks is bounded, so that
+// the per-chunk overhead stays small for large files.
+#define LOAD_CHUNKS          8
+#define LOAD_CHUNK_MIN_BITS  14 // 16KB
+#define LOAD_TXES            2  // chunks in flight per load
+#else // !CONFIG_MEMFS_VERIFY
+#define LOAD_TXES            1  // whole file in one chunk
+#endif // !CONFIG_MEMFS_VERIFY
+// Bounds the CPU time of one step of memfs_load_poll (hashing a chunk, or
+// copying it without DMA), e.g. for a step of a scheduler task (sched.h)
+#define LOAD_CHUNK_MAX_BITS  20 // 1MB
+
+// Compressed files are read from SRAM by the CPU, a word at a time, into a
+// buffer that is decompressed straight to the load address
+#define LZ4_BUF_WORDS        256
+
+// A load in progress until reaped
+struct memfs_load {
+    struct object obj;
+    struct memfs *fs;
+    struct memfs_file *file;
+    bool in_place; // checking a resident copy, nothing to copy
+    struct dma *dmac;
+    uint8_t *src;
+    uint8_t *dst;
+    unsigned size;
+    unsigned chunk;
+    unsigned copied; // bytes copied or being copied
+    unsigned loaded; // bytes copied and (if enabled) hashed
+#if CONFIG_MEMFS_LZ4
+    bool lz4; // decompressing: src_size bytes in SRAM make size bytes
+    unsigned src_size;
+    struct lz4_stream lz;
+    uint32_t lz_buf[LZ4_BUF_WORDS];
+#endif // CONFIG_MEMFS_LZ4
+    struct dma_tx *dtx[LOAD_TXES]; // chunks in flight, oldest first
+    unsigned ndtx;
+#if CONFIG_MEMFS_VERIFY
+    mbedtls_sha256_context sha;
+    uint8_t chcksum[CHECKSUM_SIZE];
+#endif // CONFIG_MEMFS_VERIFY
+    int rc;
 };
 
 #define MAX_MEMFS 2
+#define MAX_LOADS 10 // concurrent loads, e.g. HPPS (7 images) and RTPS (2)
 static struct memfs memfss[MAX_MEMFS];
 
-static int load_dma(uint32_t *sram_addr, uint32_t *load_addr, unsigned size,
-                    struct dma *dmac)
-{
-    printf("MEMFS: initiating DMA transfer\r\n");
+// Every load may have all its chunks in flight at once: if the DMA driver
+// ran out of transfers, a load would fail instead of waiting its turn
+_Static_assert(MAX_LOADS * LOAD_TXES <= DMA_MAX_TXES,
+               "DMA transfer pool too small for concurrent memfs loads");
+static struct memfs_load loads[MAX_LOADS];
 
-    struct dma_tx *dtx = dma_transfer(dmac, /* chan */ 0, // TODO: allocate channel per user
-        sram_addr, load_addr, ALIGN(size, DMA_MAX_BURST_BITS),
-        NULL, NULL /* no callback */);
-    int rc = dma_wait(dtx);
-    if (rc) {
-        printf("MEMFS: DMA transfer failed: rc %u\r\n", rc);
-        return rc;
-    }
-    printf("MEMFS: DMA transfer succesful\r\n");
-    return 0;
+static struct dma_tx *load_dma(uint32_t *sram_addr, uint32_t *load_addr,
+                               unsigned size, struct dma *dmac)
+{
+    // Any free channel: the driver queues the transfer if all are busy.
+    // The driver handles any size, so nothing past the end is overwritten.
+    struct dma_tx *dtx = dma_transfer(dmac, DMA_CHAN_ANY,
+        sram_addr, load_addr, size, NULL, NULL /* no callback */);
+    if (!dtx)
+        EPRINTF("MEMFS: failed to initiate DMA transfer\r\n");
+    return dtx;
 }
 
 
@@ -74,7 +135,7 @@ static int load_memcpy(uint32_t *mem_addr, uint32_t *load_addr, unsigned size)
             load_addr++;
             mem_addr++;
         }
-        printf("MEMFS: loading... %3u%%\r", p * 100 / pages);
+        IPRINTF("MEMFS: loading... %3u%%\r", p * 100 / pages);
     }
     for (w = 0; w < rem_words; w++) {
         * load_addr = * mem_addr;
@@ -88,18 +149,307 @@ static int load_memcpy(uint32_t *mem_addr, uint32_t *load_addr, unsigned size)
         load_addr_8++;
         mem_addr_8++;
     }
-    printf("MEMFS: loading... 100%%\r\n");
+    IPRINTF("MEMFS: loading... 100%%\r\n");
+    return 0;
+}
+
+// Start copying the next chunk: in the background if via DMA
+static int load_next(struct memfs_load *ld)
+{
+    unsigned sz = ld->size - ld->copied;
+    uint32_t *src = (uint32_t *)(ld->src + ld->copied);
+    uint32_t *dst = (uint32_t *)(ld->dst + ld->copied);
+
+    if (sz > ld->chunk)
+        sz = ld->chunk;
+    if (ld->dmac) {
+        struct dma_tx *dtx = load_dma(src, dst, sz, ld->dmac);
+        if (!dtx)
+            return 1;
+        ASSERT(ld->ndtx < LOAD_TXES);
+        ld->dtx[ld->ndtx++] = dtx;
+    } else {
+        load_memcpy(src, dst, sz);
+    }
+    ld->copied += sz;
+    return 0;
+}
+
+// Wait for the oldest chunk to be copied, keep the DMA busy with the next
+// one, and meanwhile hash the chunk that was copied
+static int load_step(struct memfs_load *ld)
+{
+    unsigned sz = ld->size - ld->loaded;
+    unsigned i;
+    int rc;
+
+    if (sz > ld->chunk)
+        sz = ld->chunk;
+
+    if (ld->ndtx) {
+        rc = dma_wait(ld->dtx[0]);
+        for (i = 1; i < ld->ndtx; ++i)
+            ld->dtx[i - 1] = ld->dtx[i];
+        ld->ndtx--;
+        if (rc) {
+            EPRINTF("MEMFS: DMA transfer failed: rc %u\r\n", rc);
+            return rc;
+        }
+    }
+
+    if (ld->copied < ld->size) {
+        rc = load_next(ld);
+        if (rc)
+            return rc;
+    }
+
+#if CONFIG_MEMFS_VERIFY
+    mbedtls_sha256_update_ret(&ld->sha, ld->dst + ld->loaded, sz);
+#endif // CONFIG_MEMFS_VERIFY
+    ld->loaded += sz;
+    return 0;
+}
+
+#if CONFIG_MEMFS_LZ4
+// Decompress the next piece of the image, and hash what it produced
+static int load_step_lz4(struct memfs_load *ld)
+{
+    unsigned sz = ld->src_size - ld->copied;
+    volatile uint32_t *src = (volatile uint32_t *)(ld->src + ld->copied);
+    uint8_t *out = ld->lz.out;
+    unsigned w, produced;
+
+    if (sz > sizeof(ld->lz_buf))
+        sz = sizeof(ld->lz_buf);
+    for (w = 0; w < (sz + sizeof(uint32_t) - 1) / sizeof(uint32_t); ++w)
+        ld->lz_buf[w] = src[w];
+    if (lz4_decompress(&ld->lz, (uint8_t *)ld->lz_buf, sz)) {
+        EPRINTF("MEMFS: ERROR: corrupted compressed image at offset %u\r\n",
+                ld->copied);
+        return 1;
+    }
+    ld->copied += sz;
+
+    produced = ld->lz.out - out;
+#if CONFIG_MEMFS_VERIFY
+    mbedtls_sha256_update_ret(&ld->sha, out, produced);
+#endif // CONFIG_MEMFS_VERIFY
+    ld->loaded += produced;
+    return 0;
+}
+
+static int load_lz4_end(struct memfs_load *ld)
+{
+    if (!lz4_complete(&ld->lz) || lz4_out_size(&ld->lz) != ld->size) {
+        EPRINTF("MEMFS: ERROR: compressed image decompressed to %u bytes, "
+                "expected %u\r\n", lz4_out_size(&ld->lz), ld->size);
+        return 1;
+    }
+    return 0;
+}
+#endif // CONFIG_MEMFS_LZ4
+
+#if CONFIG_MEMFS_VERIFY
+static bool load_digest_ok(struct memfs_load *ld)
+{
+    uint8_t digest[CHECKSUM_SIZE];
+    unsigned i;
+
+    mbedtls_sha256_finish_ret(&ld->sha, digest);
+    for (i = 0; i < CHECKSUM_SIZE; ++i) {
+        if (digest[i] != ld->chcksum[i])
+            return false;
+    }
+    return true;
+}
+
+static int load_verify(struct memfs_load *ld)
+{
+    if (!load_digest_ok(ld)) {
+        EPRINTF("MEMFS: ERROR: checksum mismatch\r\n");
+        return 1;
+    }
+    IPRINTF("MEMFS: checksum verified\r\n");
+    return 0;
+}
+#endif // CONFIG_MEMFS_VERIFY
+
+// Start hashing and fill the DMA pipeline (without DMA, the copy happens in
+// the wait). A resident copy is only hashed, in place.
+static void load_begin(struct memfs_load *ld)
+{
+    ld->copied = ld->in_place ? ld->size : 0;
+    ld->loaded = 0;
+#if CONFIG_MEMFS_VERIFY
+    mbedtls_sha256_init(&ld->sha);
+    mbedtls_sha256_starts_ret(&ld->sha, /* is224 */ 0);
+#endif // CONFIG_MEMFS_VERIFY
+#if CONFIG_MEMFS_LZ4
+    if (ld->lz4 && !ld->in_place) {
+        lz4_init(&ld->lz, ld->dst, ld->size);
+        return; // nothing in the background: decompressed in the wait
+    }
+#endif // CONFIG_MEMFS_LZ4
+    while (!ld->rc && ld->copied < ld->size &&
+           (ld->copied == 0 || (ld->dmac && ld->ndtx < LOAD_TXES)))
+        ld->rc = load_next(ld);
+}
+
+// FNV-1a
+static uint32_t name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+// The directory is in word-aligned structs: read it a word at a time
+static void read_dir(struct memfs *fs, unsigned offset, void *buf,
+                     unsigned size)
+{
+    volatile uint32_t *src = (volatile uint32_t *)(fs->base + offset);
+    uint32_t *dst = buf;
+    unsigned w;
+
+    for (w = 0; w < (size + sizeof(uint32_t) - 1) / sizeof(uint32_t); ++w)
+        dst[w] = src[w];
+    fs->sram_reads += w;
+}
+
+#if CONFIG_MEMFS_ECC
+// The ECC of each struct covers the fields before it
+static int check_ecc(void *s, unsigned size, uint8_t *ecc)
+{
+    uint8_t calc_ecc[ECC_512_SIZE];
+
+    calculate_ecc(s, size, calc_ecc);
+    return correct_data(s, ecc, calc_ecc, size) < 0;
+}
+#endif // CONFIG_MEMFS_ECC
+
+// The header of a compressed image has the size of the loaded file
+static int index_lz4(struct memfs *fs, struct memfs_file *f, unsigned n)
+{
+#if CONFIG_MEMFS_LZ4
+    struct lz4_header hdr;
+
+    if (f->size < sizeof(hdr)) {
+        EPRINTF("MEMFS: ERROR: file #%u: compressed image too short\r\n", n);
+        return 1;
+    }
+    read_dir(fs, f->offset, &hdr, sizeof(hdr));
+    if (hdr.magic != LZ4_MAGIC) {
+        EPRINTF("MEMFS: ERROR: file #%u: not an LZ4 image\r\n", n);
+        return 1;
+    }
+    f->lz4 = true;
+    f->offset += sizeof(hdr);
+    f->size -= sizeof(hdr);
+    f->load_size = hdr.size;
+    return 0;
+#else // !CONFIG_MEMFS_LZ4
+    EPRINTF("MEMFS: ERROR: file #%u: compressed, but no LZ4 support\r\n", n);
+    return 1;
+#endif // !CONFIG_MEMFS_LZ4
+}
+
+static int index_file(struct memfs *fs, const file_descriptor *fd, unsigned n)
+{
+    struct memfs_file *f;
+    unsigned i, slot;
+
+    for (i = 0; fd->name[i] && i < FILE_NAME_LENGTH; ++i) {
+        if (i == NAME_CACHE_SIZE - 1) {
+            EPRINTF("MEMFS: ERROR: file #%u: name longer than %u chars\r\n",
+                    n, NAME_CACHE_SIZE - 1);
+            return 1;
+        }
+    }
+    if (fs->n_files == MAX_FILES) {
+        EPRINTF("MEMFS: ERROR: file #%u: more than %u files\r\n", n, MAX_FILES);
+        return 1;
+    }
+
+    f = &fs->files[fs->n_files];
+    for (i = 0; fd->name[i]; ++i)
+        f->name[i] = fd->name[i];
+    f->name[i] = '\0';
+    f->hash = name_hash(f->name);
+    f->offset = fd->offset;
+    f->size = fd->size;
+    f->load_size = fd->size;
+    f->lz4 = false;
+    f->load_addr = fd->load_addr;
+    for (i = 0; i < CHECKSUM_SIZE; ++i)
+        f->chcksum[i] = fd->chcksum[i];
+    if ((fd->valid & FILE_FLAG_LZ4) && index_lz4(fs, f, n))
+        return 0; // skipped, like a file with a corrupted descriptor
+
+    slot = f->hash & (INDEX_SIZE - 1);
+    while (fs->index[slot])
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    fs->index[slot] = ++fs->n_files;
     return 0;
 }
 
+static struct memfs_file *lookup(struct memfs *fs, const char *fname)
+{
+    uint32_t hash = name_hash(fname);
+    unsigned slot = hash & (INDEX_SIZE - 1);
+    struct memfs_file *f;
+
+    while (fs->index[slot]) {
+        f = &fs->files[fs->index[slot] - 1];
+        if (f->hash == hash && !strcmp(f->name, fname))
+            return f;
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+    return NULL;
+}
+
 struct memfs *memfs_mount(uintptr_t base, struct dma *dmac)
 {
     struct memfs *fs;
+    global_table gt;
+    file_descriptor fd;
+    unsigned i;
+
     fs = OBJECT_ALLOC(memfss);
+    if (!fs)
+        return NULL;
     fs->base = base;
     fs->dmac = dmac;
-    // could load the file table here
+
+    read_dir(fs, 0, &gt, sizeof(gt));
+#if CONFIG_MEMFS_ECC
+    if (check_ecc(&gt, offsetof(global_table, ecc), gt.ecc)) {
+        EPRINTF("MEMFS: ERROR: file table corrupted\r\n");
+        goto fail;
+    }
+#endif // CONFIG_MEMFS_ECC
+    IPRINTF("MEMFS: #files : %u, low_mark_data(0x%lx), high_mark_fd(0x%x)\r\n",
+            gt.n_files, gt.low_mark_data, gt.high_mark_fd);
+
+    for (i = 0; i < gt.n_files; i++) {
+        read_dir(fs, sizeof(gt) + sizeof(fd) * i, &fd, sizeof(fd));
+#if CONFIG_MEMFS_ECC
+        if (check_ecc(&fd, offsetof(file_descriptor, ecc), fd.ecc)) {
+            EPRINTF("MEMFS: ERROR: file #%u: descriptor corrupted\r\n", i);
+            continue;
+        }
+#endif // CONFIG_MEMFS_ECC
+        if (!fd.valid)
+            continue;
+        if (index_file(fs, &fd, i))
+            goto fail;
+    }
+    IPRINTF("MEMFS: mounted: %u files indexed, %u SRAM reads\r\n",
+            fs->n_files, fs->sram_reads);
     return fs;
+fail:
+    OBJECT_FREE(fs);
+    return NULL;
 }
 
 void memfs_unmount(struct memfs *fs)
@@ -110,50 +460,176 @@ void memfs_unmount(struct memfs *fs)
     OBJECT_FREE(fs);
 }
 
-int memfs_load(struct memfs *fs, const char *fname, uint32_t **addr)
+unsigned memfs_sram_reads(struct memfs *fs)
 {
-    global_table gt;
-    unsigned i;
-    uint32_t * load_addr_32;
-    uint32_t * mem_addr_32;
-    file_descriptor * fd_buf;
-    unsigned char * mem_start_addr = (unsigned char *)fs->base;
-    unsigned char * ptr = (unsigned char *) &gt;
-    int rc;
+    return fs->sram_reads;
+}
 
-    for(i = 0; i < sizeof(global_table); i++) {
-        ptr[i] = * (mem_start_addr + i);
-    }
-    printf("MEMFS: #files : %u, low_mark_data(0x%lx), high_mark_fd(0x%x)\r\n",
-           gt.n_files, gt.low_mark_data, gt.high_mark_fd);
+static bool overlap(struct memfs_file *a, struct memfs_file *b)
+{
+    return a->load_addr < b->load_addr + b->load_size &&
+           b->load_addr < a->load_addr + a->load_size;
+}
 
-    for (i = 0; i < gt.n_files ; i++) {
-        fd_buf = (file_descriptor *)(mem_start_addr + sizeof(gt) + sizeof(file_descriptor)*i);
-        if (!fd_buf->valid)
-            continue;
-        if (!strcmp(fd_buf->name, fname))
-            break;
-    }
-    if (i == gt.n_files) {
-        printf("MEMFS: ERROR: file not found: %s\r\n", fname);
-        return 1;
+// Loading a file overwrites it and any other file in the way
+static void overwrite(struct memfs *fs, struct memfs_file *f)
+{
+    for (unsigned i = 0; i < fs->n_files; ++i)
+        if (overlap(f, &fs->files[i]))
+            fs->files[i].resident = false;
+}
+
+static struct memfs_load *load_start(struct memfs *fs, const char *fname,
+                                     uint32_t **addr, bool lazy)
+{
+    struct memfs_file *f;
+    struct memfs_load *ld;
+
+    f = lookup(fs, fname);
+    if (!f) {
+        EPRINTF("MEMFS: ERROR: file not found: %s\r\n", fname);
+        return NULL;
     }
 
-    uint32_t offset = fd_buf->offset;
+    ld = OBJECT_ALLOC(loads);
+    if (!ld)
+        return NULL;
 
-    printf("MEMFS: loading file #%u: %s: 0x%0x -> 0x%x (%u KB)\r\n",
-           i, fd_buf->name, mem_start_addr + offset,
-           fd_buf->load_addr, fd_buf->size / 1024);
+    ld->fs = fs;
+    ld->file = f;
+#if CONFIG_MEMFS_VERIFY
+    // The checksum of the copy in place decides whether it is still intact
+    ld->in_place = lazy && f->resident;
+#endif // CONFIG_MEMFS_VERIFY
+    if (ld->in_place) {
+        IPRINTF("MEMFS: checking resident file #%u: %s: 0x%x (%u KB)\r\n",
+                (unsigned)(f - fs->files), f->name, f->load_addr,
+                f->load_size / 1024);
+    } else {
+        IPRINTF("MEMFS: loading file #%u: %s: 0x%0x -> 0x%x (%u KB%s)\r\n",
+                (unsigned)(f - fs->files), f->name, fs->base + f->offset,
+                f->load_addr, f->load_size / 1024,
+                f->lz4 ? ", compressed" : "");
+        overwrite(fs, f);
+    }
 
-    mem_addr_32 = (uint32_t *) (mem_start_addr + offset);
-    load_addr_32 = (uint32_t *)fd_buf->load_addr;
+    ld->dmac = fs->dmac;
+    ld->src = (uint8_t *)(fs->base + f->offset);
+    ld->dst = (uint8_t *)f->load_addr;
+    ld->size = f->load_size;
+#if CONFIG_MEMFS_LZ4
+    ld->lz4 = f->lz4;
+    ld->src_size = f->size;
+#endif // CONFIG_MEMFS_LZ4
+#if CONFIG_MEMFS_VERIFY
+    ld->chunk = ALIGN(ld->size / LOAD_CHUNKS, LOAD_CHUNK_MIN_BITS);
+    if (!ld->chunk)
+        ld->chunk = 1 << LOAD_CHUNK_MIN_BITS;
+    if (ld->chunk > 1 << LOAD_CHUNK_MAX_BITS)
+        ld->chunk = 1 << LOAD_CHUNK_MAX_BITS;
+    for (unsigned i = 0; i < CHECKSUM_SIZE; ++i)
+        ld->chcksum[i] = f->chcksum[i];
+#else // !CONFIG_MEMFS_VERIFY
+    // With DMA, the copy is in the background, with nothing to hash
+    ld->chunk = ld->dmac || ld->size < 1 << LOAD_CHUNK_MAX_BITS ?
+                ld->size : 1 << LOAD_CHUNK_MAX_BITS;
+#endif // !CONFIG_MEMFS_VERIFY
 
-    if (fs->dmac)
-        rc = load_dma(mem_addr_32, load_addr_32, fd_buf->size, fs->dmac);
-    else
-        rc = load_memcpy(mem_addr_32, load_addr_32, fd_buf->size);
+    load_begin(ld);
 
     if (addr)
-        *addr = load_addr_32;
+        *addr = (uint32_t *)ld->dst;
+    return ld;
+}
+
+struct memfs_load *memfs_load_start(struct memfs *fs, const char *fname,
+                                    uint32_t **addr)
+{
+    return load_start(fs, fname, addr, /* lazy */ false);
+}
+
+struct memfs_load *memfs_load_start_lazy(struct memfs *fs, const char *fname,
+                                         uint32_t **addr)
+{
+    return load_start(fs, fname, addr, /* lazy */ true);
+}
+
+int memfs_load_wait(struct memfs_load *ld)
+{
+    int rc;
+    ASSERT(ld);
+
+    rc = ld->rc;
+#if CONFIG_MEMFS_LZ4
+    if (ld->lz4 && !ld->in_place) {
+        while (!rc && ld->copied < ld->src_size)
+            rc = load_step_lz4(ld);
+        if (!rc)
+            rc = load_lz4_end(ld);
+    }
+#endif // CONFIG_MEMFS_LZ4
+    while (!rc && ld->loaded < ld->size)
+        rc = load_step(ld);
+
+    while (ld->ndtx) // reap chunks in flight after a failure
+        dma_wait(ld->dtx[--ld->ndtx]);
+
+#if CONFIG_MEMFS_VERIFY
+    if (!rc && ld->in_place) {
+        if (!load_digest_ok(ld)) {
+            WPRINTF("MEMFS: resident copy changed, reloading\r\n");
+            overwrite(ld->fs, ld->file);
+            ld->in_place = false;
+            load_begin(ld);
+            return memfs_load_wait(ld);
+        }
+        IPRINTF("MEMFS: resident copy intact, not reloaded\r\n");
+    } else if (!rc) {
+        rc = load_verify(ld);
+    }
+    // Without verification, a copy can't be checked, so is never resident
+    ld->file->resident = !rc;
+#endif // CONFIG_MEMFS_VERIFY
+    if (!rc)
+        IPRINTF("MEMFS: load succesful\r\n");
+
+    OBJECT_FREE(ld);
     return rc;
 }
+
+bool memfs_load_blocked(struct memfs_load *ld)
+{
+    ASSERT(ld);
+    return ld->ndtx && !dma_poll(ld->dtx[0]);
+}
+
+// Each call does at most one step of CPU work (hashing or decompressing a
+// chunk, or a copy without DMA), so that the caller stays responsive
+bool memfs_load_poll(struct memfs_load *ld)
+{
+    ASSERT(ld);
+    if (ld->rc)
+        return true;
+#if CONFIG_MEMFS_LZ4
+    if (ld->lz4 && !ld->in_place) {
+        if (ld->copied == ld->src_size)
+            return true;
+        ld->rc = load_step_lz4(ld);
+        return false;
+    }
+#endif // CONFIG_MEMFS_LZ4
+    if (ld->loaded == ld->size)
+        return true;
+    if (memfs_load_blocked(ld))
+        return false;
+    ld->rc = load_step(ld);
+    return false;
+}
+
+int memfs_load(struct memfs *fs, const char *fname, uint32_t **addr)
+{
+    struct memfs_load *ld = memfs_load_start(fs, fname, addr);
+    if (!ld)
+        return 1;
+    return memfs_load_wait(ld);
+}
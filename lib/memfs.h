@@ -1,9 +1,35 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 struct dma;
+struct memfs_load;
 
 struct memfs *memfs_mount(uintptr_t base, struct dma *dmac);
 void memfs_unmount(struct memfs *fs);
 
+// Words read from SRAM for the directory, which happens only at mount time
+unsigned memfs_sram_reads(struct memfs *fs);
+
 // addr: will be set to the load addr found in the image
 int memfs_load(struct memfs *fs, const char *fname, uint32_t **addr);
+
+// Non-blocking variant: loads via DMA proceed in the background (in parallel
+// with other loads, as many as there are DMA channels), and must be reaped
+// with memfs_load_wait, which returns the result. Returns NULL on failure.
+struct memfs_load *memfs_load_start(struct memfs *fs, const char *fname,
+                                    uint32_t **addr);
+int memfs_load_wait(struct memfs_load *ld);
+
+// Non-blocking progress on a load started with memfs_load_start*: returns
+// true once memfs_load_wait would not block (it still must be called to
+// reap the load and get the result). Blocked means that polling would make
+// no progress until a DMA transfer completes (which raises an interrupt).
+bool memfs_load_poll(struct memfs_load *ld);
+bool memfs_load_blocked(struct memfs_load *ld);
+
+// Like memfs_load_start, but if the file was loaded and verified before (and
+// not overwritten by another load since), only checks that the copy at the
+// load address is still intact, and reloads it only if it is not. Needs
+// CONFIG_MEMFS_VERIFY, otherwise always loads.
+struct memfs_load *memfs_load_start_lazy(struct memfs *fs, const char *fname,
+                                         uint32_t **addr);
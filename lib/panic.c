@@ -2,6 +2,7 @@
 
 #include "printf.h"
 #include "arm.h"
+#include "console.h"
 #include "intc.h"
 
 void panic(const char *msg)
@@ -11,6 +12,7 @@ void panic(const char *msg)
     // To stay in WFI, we need to disable internal and external interrupts
     sys_ints_disable(); // internal interrupts that bypass int controller
     intc_disable_all(); // external interrupts
+    console_sync(); // output is no longer drained by the UART ISR
 
     printf("PANIC HALT: %s\r\n", msg);
 
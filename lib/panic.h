@@ -11,14 +11,39 @@
                 panic("ASSERT"); \
         }
 
+// Compile-time log levels: a message is compiled in only if its level is
+// at most the level of the module, so that messages above the level of a
+// build cost nothing, not even the format string. The level of a module is
+// CONFIG_LOG_LEVEL (set per build), or DEBUG if the module defines DEBUG to
+// 1, or LOG_LEVEL if the module defines it.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef CONFIG_LOG_LEVEL
+#define CONFIG_LOG_LEVEL LOG_LEVEL_INFO
+#endif // undef CONFIG_LOG_LEVEL
+
 // Define DEBUG to 1 in the source file that you want to debug
 // before the #include statement for this header.
 #ifndef DEBUG
 #define DEBUG 0
 #endif // undef DEBUG
 
-#define DPRINTF(...) \
-        if (DEBUG) printf(__VA_ARGS__)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL (DEBUG ? LOG_LEVEL_DEBUG : CONFIG_LOG_LEVEL)
+#endif // undef LOG_LEVEL
+
+// A single statement, so that it can be the body of an if with an else
+#define LOG_PRINTF(level, ...) \
+        do { if ((level) <= LOG_LEVEL) printf(__VA_ARGS__); } while (0)
+
+#define EPRINTF(...) LOG_PRINTF(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define WPRINTF(...) LOG_PRINTF(LOG_LEVEL_WARN, __VA_ARGS__)
+#define IPRINTF(...) LOG_PRINTF(LOG_LEVEL_INFO, __VA_ARGS__)
+#define DPRINTF(...) LOG_PRINTF(LOG_LEVEL_DEBUG, __VA_ARGS__)
 
 void panic(const char *msg);
 void dump_buf(const char *name, uint32_t *buf, unsigned words);
@@ -4,6 +4,15 @@
 #include <stdint.h>
 #include "panic.h"
 
+// For tests that count the register accesses of a driver, on a fake device in
+// RAM: defined (by the Makefile) only for the object file of that driver
+#ifdef REGOPS_COUNT
+extern unsigned regops_count;
+#define REGOPS_COUNT_INC() (regops_count++)
+#else // !REGOPS_COUNT
+#define REGOPS_COUNT_INC()
+#endif // !REGOPS_COUNT
+
 #define REG_WRITE32(reg, val) reg_write32(#reg, (volatile uint32_t *)(reg), val)
 #define REG_WRITE64(reg, val) reg_write64(#reg, (volatile uint64_t *)(reg), val)
 
@@ -31,23 +40,27 @@
 static inline void reg_write32(const char *name, volatile uint32_t *addr, uint32_t val)
 {
     DPRINTF("%32s: %p <- %x\r\n", name, addr, val);
+    REGOPS_COUNT_INC();
     *addr = val;
 }
 static inline void reg_write64(const char *name, volatile uint64_t *addr, uint64_t val)
 {
     DPRINTF("%32s: %p <- %08x%08x\r\n", name, addr,
            (uint32_t)(val >> 32), (uint32_t)val);
+    REGOPS_COUNT_INC();
     *addr = val;
 }
 static inline uint32_t reg_read32(const char *name, volatile uint32_t *addr)
 {
     uint32_t val = *addr;
+    REGOPS_COUNT_INC();
     DPRINTF("%32s: %p -> %x\r\n", name, addr, val);
     return val;
 }
 static inline uint64_t reg_read64(const char *name, volatile uint64_t *addr)
 {
     uint64_t val = *addr;
+    REGOPS_COUNT_INC();
     DPRINTF("%32s: %p -> %08x%08x\r\n", name, addr,
            (uint32_t)(val >> 32), (uint32_t)val);
     return val;
@@ -55,11 +68,13 @@ static inline uint64_t reg_read64(const char *name, volatile uint64_t *addr)
 static inline void reg_set32(const char *name, volatile uint32_t *addr, uint32_t val)
 {
     DPRINTF("%32s: %p |= %x\r\n", name, addr, val);
+    REGOPS_COUNT_INC();
     *addr |= val;
 }
 static inline void reg_clear32(const char *name, volatile uint32_t *addr, uint32_t val)
 {
     DPRINTF("%32s: %p &= ~%x\r\n", name, addr, val);
+    REGOPS_COUNT_INC();
     *addr &= ~val;
 }
 
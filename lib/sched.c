@@ -0,0 +1,231 @@
+#define DEBUG 0
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arm.h"
+#include "object.h"
+#include "panic.h"
+#include "printf.h"
+#include "timerq.h"
+
+#include "sched.h"
+
+struct task {
+    struct object obj;
+    const char *name;
+    unsigned prio;
+    task_fn_t *fn;
+    task_pending_t *pending;
+    void *arg;
+
+    volatile bool woken; // by task_wake, cleared when the task runs
+    volatile uint64_t woken_at;
+    bool ready; // seen ready by the scheduler, since ready_at
+    uint64_t ready_at;
+    bool checked_in; // ran since the last kick
+    bool overdue; // reported as not checked in
+
+    unsigned runs;
+    unsigned overruns;
+    uint32_t max_latency_us;
+    uint32_t max_run_us;
+    unsigned hist[SCHED_HIST_BUCKETS];
+};
+
+static struct task tasks[SCHED_MAX_TASKS];
+static unsigned task_next; // round-robin among equal priorities
+
+static sched_kick_t *kick_cb = NULL;
+static void *kick_arg;
+static uint64_t kick_interval;
+static uint64_t kick_next;
+static uint64_t step_max; // 0: no limit
+
+struct task *task_create(const char *name, unsigned prio, task_fn_t *fn,
+                         task_pending_t *pending, void *arg)
+{
+    struct task *t = OBJECT_ALLOC(tasks);
+    if (!t)
+        return NULL;
+    printf("SCHED: task %s: prio %u\r\n", name, prio);
+    t->name = name;
+    t->prio = prio;
+    t->fn = fn;
+    t->pending = pending;
+    t->arg = arg;
+    return t;
+}
+
+void task_destroy(struct task *t)
+{
+    OBJECT_FREE(t);
+}
+
+void task_wake(struct task *t)
+{
+    unsigned irq = int_save_disable();
+    if (!t->woken) {
+        t->woken_at = timerq_now();
+        t->woken = true;
+    }
+    int_restore(irq);
+    send_event(); // for a waiter in WFE
+}
+
+static bool task_ready(struct task *t, uint64_t now)
+{
+    if (!t->ready) {
+        if (t->woken) {
+            t->ready = true;
+            t->ready_at = t->woken_at;
+        } else if (t->pending && t->pending(t->arg)) {
+            t->ready = true;
+            t->ready_at = now; // as soon as the scheduler could know
+        }
+    }
+    return t->ready;
+}
+
+// Highest priority first, then the one that has waited since the last run
+// of a task at that priority
+static struct task *pick()
+{
+    uint64_t now = timerq_now();
+    struct task *best = NULL;
+    unsigned i, n;
+
+    for (i = 0; i < SCHED_MAX_TASKS; ++i) {
+        n = (task_next + i) % SCHED_MAX_TASKS;
+        struct task *t = &tasks[n];
+        if (!t->obj.valid || !task_ready(t, now))
+            continue;
+        if (!best || t->prio < best->prio)
+            best = t;
+    }
+    return best;
+}
+
+static void record(struct task *t, uint32_t latency_us, uint32_t run_us)
+{
+    unsigned b = latency_us ? 32 - __builtin_clz(latency_us) : 0;
+    if (b >= SCHED_HIST_BUCKETS)
+        b = SCHED_HIST_BUCKETS - 1;
+    t->hist[b]++;
+    t->runs++;
+    if (latency_us > t->max_latency_us)
+        t->max_latency_us = latency_us;
+    if (run_us > t->max_run_us)
+        t->max_run_us = run_us;
+}
+
+static void run(struct task *t)
+{
+    uint64_t start = timerq_now();
+    uint64_t end;
+
+    t->woken = false; // a wake while it runs makes it run again
+    t->ready = false;
+    task_next = t->obj.index + 1;
+    DPRINTF("SCHED: run %s\r\n", t->name);
+    t->fn(t->arg);
+    end = timerq_now();
+    t->checked_in = true;
+    record(t, timerq_to_us(start - t->ready_at), timerq_to_us(end - start));
+    if (step_max && end - start > step_max) {
+        t->overruns++;
+        printf("SCHED: task %s: step overran: %u us > %u us\r\n", t->name,
+               timerq_to_us(end - start), timerq_to_us(step_max));
+    }
+}
+
+static void supervise()
+{
+    uint64_t now;
+    unsigned i;
+
+    if (!kick_cb)
+        return;
+    now = timerq_now();
+    if (now < kick_next)
+        return;
+
+    for (i = 0; i < SCHED_MAX_TASKS; ++i) {
+        struct task *t = &tasks[i];
+        if (t->obj.valid && t->ready && !t->checked_in) {
+            if (!t->overdue && now >= kick_next + kick_interval) {
+                printf("SCHED: task %s has not run for %u us, not kicking\r\n",
+                       t->name, timerq_to_us(now - t->ready_at));
+                t->overdue = true;
+            }
+            return;
+        }
+    }
+
+    kick_cb(kick_arg);
+    for (i = 0; i < SCHED_MAX_TASKS; ++i) {
+        tasks[i].checked_in = false;
+        tasks[i].overdue = false;
+    }
+    kick_next = now + kick_interval;
+}
+
+void sched_run()
+{
+    struct task *t;
+
+    while ((t = pick())) {
+        supervise();
+        run(t);
+    }
+    supervise();
+}
+
+bool sched_pending()
+{
+    unsigned i;
+
+    for (i = 0; i < SCHED_MAX_TASKS; ++i) {
+        struct task *t = &tasks[i];
+        if (t->obj.valid &&
+                (t->ready || t->woken || (t->pending && t->pending(t->arg))))
+            return true;
+    }
+    return false;
+}
+
+void sched_supervise(sched_kick_t *kick, void *arg, unsigned interval_ms,
+                     unsigned step_max_ms)
+{
+    printf("SCHED: supervise: interval %u ms, step budget %u ms\r\n",
+           interval_ms, step_max_ms);
+    kick_cb = kick;
+    kick_arg = arg;
+    kick_interval = timerq_ms(interval_ms);
+    kick_next = 0;
+    step_max = timerq_ms(step_max_ms);
+}
+
+unsigned task_overruns(struct task *t)
+{
+    return t->overruns;
+}
+
+void sched_print_stats()
+{
+    unsigned i, b;
+
+    for (i = 0; i < SCHED_MAX_TASKS; ++i) {
+        struct task *t = &tasks[i];
+        if (!t->obj.valid)
+            continue;
+        printf("SCHED: task %s: prio %u: %u runs: max latency %u us, "
+               "max run %u us, %u overruns\r\n", t->name, t->prio, t->runs,
+               t->max_latency_us, t->max_run_us, t->overruns);
+        printf("SCHED: task %s: latency us:", t->name);
+        for (b = 0; b < SCHED_HIST_BUCKETS; ++b)
+            if (t->hist[b])
+                printf(" <%u:%u", 1 << b, t->hist[b]);
+        printf("\r\n");
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative scheduler: tasks run to completion, one step at a time, in
+// order of priority (0 is the highest), round-robin among equal priorities.
+// A long operation is split into steps: each step does a bounded amount of
+// work and, if there is more, wakes its own task again, so that the tasks of
+// higher priority (e.g. serving commands) run between the steps.
+//
+// A task is ready when woken (task_wake, also from an ISR) or when its
+// 'pending' predicate (optional) returns true, which is for work that is
+// signaled by state that some other module owns (e.g. a queue).
+//
+// Supervision: the watchdog is kicked from the scheduler loop, and only if
+// every task that is ready has run since the previous kick, so that a task
+// that is stuck (or starved by tasks of higher priority) stops the kicks.
+// Since nothing kicks while a step runs, every step, including any wait in
+// it, must end well within the watchdog timeout: a task bounds its waits
+// (see CMD_TIMEOUT_MS_SERVE_* in command.h), and a step that runs longer
+// than the step budget is logged and counted as an overrun.
+//
+// Time is from the timer queue (see timerq.h).
+
+#define SCHED_MAX_TASKS         8
+#define SCHED_HIST_BUCKETS      20 // log2 of latency in us: up to ~0.5 s
+
+typedef void (task_fn_t)(void *arg);
+typedef bool (task_pending_t)(void *arg);
+typedef void (sched_kick_t)(void *arg);
+
+struct task;
+
+struct task *task_create(const char *name, unsigned prio, task_fn_t *fn,
+                         task_pending_t *pending, void *arg);
+void task_destroy(struct task *t);
+void task_wake(struct task *t);
+
+// Runs the tasks until none is ready (which is never, while a task keeps
+// waking itself, e.g. to poll)
+void sched_run();
+
+// Whether any task is ready: call with interrupts disabled, before WFI
+bool sched_pending();
+
+// The kick is called at most every interval (cb NULL to stop supervision).
+// A step that runs for longer than step_max_ms (0: no limit) is an overrun.
+void sched_supervise(sched_kick_t *kick, void *arg, unsigned interval_ms,
+                     unsigned step_max_ms);
+
+// Steps of the task that overran the step budget
+unsigned task_overruns(struct task *t);
+
+// Per task: histogram of the latency from ready to run, and max run time
+void sched_print_stats();
+
+#endif // SCHED_H
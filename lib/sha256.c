@@ -34,6 +34,11 @@
 
 #include "sha256.h"
 
+#if defined(MBEDTLS_SELF_TEST)
+#include "printf.h"
+#define mbedtls_printf printf
+#endif
+
 #ifndef GET_UINT32_BE
 #define GET_UINT32_BE(n,b,i)                            \
 do {                                                    \
@@ -192,6 +197,85 @@ static const uint32_t K[] =
 }
 
 
+#if CONFIG_SHA256_FAST
+/*
+ * Word-at-a-time big-endian load: one LDR + REV instead of four LDRB and
+ * the shifts to assemble them. The may_alias type makes it legal to read
+ * the byte buffers (ctx->buffer, image data) through it.
+ */
+typedef uint32_t __attribute__((may_alias)) sha256_word_t;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LOAD_WORD_BE(p, i) (((const sha256_word_t *) (p))[i])
+#else
+#define LOAD_WORD_BE(p, i) __builtin_bswap32(((const sha256_word_t *) (p))[i])
+#endif
+
+/*
+ * Message schedule kept in a 16-word window: W[t] overwrites W[t - 16],
+ * which is the last word that still needed it.
+ */
+#define WS(t)   W[(t) & 15]
+#define RS(t)                                               \
+(                                                           \
+    WS(t) += S1(WS((t) - 2)) + WS((t) - 7) + S0(WS((t) - 15))  \
+)
+
+#define P8(i, X)                                            \
+{                                                           \
+    P( a, b, c, d, e, f, g, h, X((i) + 0), K[(i) + 0] );    \
+    P( h, a, b, c, d, e, f, g, X((i) + 1), K[(i) + 1] );    \
+    P( g, h, a, b, c, d, e, f, X((i) + 2), K[(i) + 2] );    \
+    P( f, g, h, a, b, c, d, e, X((i) + 3), K[(i) + 3] );    \
+    P( e, f, g, h, a, b, c, d, X((i) + 4), K[(i) + 4] );    \
+    P( d, e, f, g, h, a, b, c, X((i) + 5), K[(i) + 5] );    \
+    P( c, d, e, f, g, h, a, b, X((i) + 6), K[(i) + 6] );    \
+    P( b, c, d, e, f, g, h, a, X((i) + 7), K[(i) + 7] );    \
+}
+
+/*
+ * Fully unrolled: the working variables are separate locals rather than an
+ * array that is rotated by index, so that (when built with optimization,
+ * see the Makefile) they stay in registers for the whole block.
+ */
+int mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
+                                const unsigned char data[64] )
+{
+    uint32_t temp1, temp2, W[16];
+    uint32_t a, b, c, d, e, f, g, h;
+    unsigned int i;
+
+    if( ( (uintptr_t) data & 0x3 ) == 0 )
+    {
+        for( i = 0; i < 16; i++ )
+            W[i] = LOAD_WORD_BE( data, i );
+    }
+    else
+    {
+        for( i = 0; i < 16; i++ )
+            GET_UINT32_BE( W[i], data, 4 * i );
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2];
+    d = ctx->state[3]; e = ctx->state[4]; f = ctx->state[5];
+    g = ctx->state[6]; h = ctx->state[7];
+
+    P8(  0, WS );
+    P8(  8, WS );
+    P8( 16, RS );
+    P8( 24, RS );
+    P8( 32, RS );
+    P8( 40, RS );
+    P8( 48, RS );
+    P8( 56, RS );
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c;
+    ctx->state[3] += d; ctx->state[4] += e; ctx->state[5] += f;
+    ctx->state[6] += g; ctx->state[7] += h;
+
+    return( 0 );
+}
+#else /* !CONFIG_SHA256_FAST */
 int mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
                                 const unsigned char data[64] )
 {
@@ -249,6 +333,7 @@ int mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
 
     return( 0 );
 }
+#endif /* !CONFIG_SHA256_FAST */
 
 #if !defined(MBEDTLS_DEPRECATED_REMOVED)
 void mbedtls_sha256_process( mbedtls_sha256_context *ctx,
@@ -481,22 +566,24 @@ static const unsigned char sha256_test_sum[6][32] =
 /*
  * Checkup routine
  */
+static int l_memcmp( const void *a, const void *b, size_t size ) {
+    int i;
+    const unsigned char *pa = ( const unsigned char * )a;
+    const unsigned char *pb = ( const unsigned char * )b;
+    for ( i = 0; i < size ; i++ ) {
+        if ( pa[i] != pb[i] )
+            return pa[i] - pb[i];
+    }
+    return 0;
+}
+
 int mbedtls_sha256_self_test( int verbose )
 {
     int i, j, k, buflen, ret = 0;
-    unsigned char *buf;
+    static unsigned char buf[1024];
     unsigned char sha256sum[32];
     mbedtls_sha256_context ctx;
 
-    buf = mbedtls_calloc( 1024, sizeof(unsigned char) );
-    if( NULL == buf )
-    {
-        if( verbose != 0 )
-            mbedtls_printf( "Buffer allocation failed\n" );
-
-        return( 1 );
-    }
-
     mbedtls_sha256_init( &ctx );
 
     for( i = 0; i < 6; i++ )
@@ -534,28 +621,27 @@ int mbedtls_sha256_self_test( int verbose )
             goto fail;
 
 
-        if( memcmp( sha256sum, sha256_test_sum[i], 32 - k * 4 ) != 0 )
+        if( l_memcmp( sha256sum, sha256_test_sum[i], 32 - k * 4 ) != 0 )
         {
             ret = 1;
             goto fail;
         }
 
         if( verbose != 0 )
-            mbedtls_printf( "passed\n" );
+            mbedtls_printf( "passed\r\n" );
     }
 
     if( verbose != 0 )
-        mbedtls_printf( "\n" );
+        mbedtls_printf( "\r\n" );
 
     goto exit;
 
 fail:
     if( verbose != 0 )
-        mbedtls_printf( "failed\n" );
+        mbedtls_printf( "failed\r\n" );
 
 exit:
     mbedtls_sha256_free( &ctx );
-    mbedtls_free( buf );
 
     return( ret );
 }
@@ -0,0 +1,66 @@
+#include <stdint.h>
+
+#include "command.h"
+#include "panic.h"
+#include "printf.h"
+#include "shbuf.h"
+
+#define ADLER_MOD 65521
+// Most bytes that can be summed before the sums could overflow 32 bits
+#define ADLER_NMAX 5552
+
+uint32_t shbuf_checksum(const void *buf, size_t len)
+{
+    const volatile uint8_t *p = buf; // the window is shared
+    uint32_t a = 1, b = 0;
+    size_t n;
+
+    while (len) {
+        n = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= n;
+        while (n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+void *shbuf_get(const struct shbuf_win *win, uint32_t offset, uint32_t len)
+{
+    if (!win || offset > win->size || len > win->size - offset)
+        return NULL;
+    return (void *)(win->addr + offset);
+}
+
+int shbuf_request(struct link *link, uint32_t type, void *buf, size_t len)
+{
+    const struct shbuf_win *win = link->shbuf;
+    uint32_t msg[CMD_MSG_SZ / sizeof(uint32_t)] = { CMD_BUF };
+    uint32_t reply[CMD_MSG_SZ / sizeof(uint32_t)] = {0};
+    struct cmd_buf *desc = (struct cmd_buf *)&msg[1];
+    struct cmd_buf_ack *ack = (struct cmd_buf_ack *)&reply[1];
+    int rc;
+
+    if (!win || (uintptr_t)buf < win->addr ||
+            !shbuf_get(win, (uintptr_t)buf - win->addr, len)) {
+        EPRINTF("%s: shbuf: buffer %p not in the shared window\r\n",
+                link->name, buf);
+        return -1;
+    }
+    desc->type = type;
+    desc->offset = (uintptr_t)buf - win->addr;
+    desc->len = len;
+    desc->checksum = shbuf_checksum(buf, len);
+
+    // the peer replies after processing the whole payload
+    rc = link->request(link, CMD_TIMEOUT_MS_SEND, msg, sizeof(msg),
+                       CMD_TIMEOUT_MS_REPLY, reply, sizeof(reply));
+    if (rc <= 0 || (reply[0] & 0xff) != CMD_BUF_ACK) {
+        EPRINTF("%s: shbuf: request failed: rc %d\r\n", link->name, rc);
+        return -1;
+    }
+    return ack->status;
+}
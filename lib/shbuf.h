@@ -0,0 +1,33 @@
+#ifndef SHBUF_H
+#define SHBUF_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "link.h"
+
+// Payloads too large for a message are passed by reference (CMD_BUF): the
+// payload is in a window of DRAM shared with the peer, agreed upon in
+// advance (see mem-map.h), and the message carries only its offset into
+// the window, its length and its checksum. The receiver reads the payload
+// in place, and replies once done with it, after which the sender may reuse
+// the buffer. The window must be mapped uncached on both sides, like the
+// shared memory message regions.
+struct shbuf_win {
+    uintptr_t addr;
+    size_t size;
+};
+
+// Adler-32 (as in zlib)
+uint32_t shbuf_checksum(const void *buf, size_t len);
+
+// Returns the payload at [offset, offset + len) in the window, or NULL if
+// it is not entirely within the window
+void *shbuf_get(const struct shbuf_win *win, uint32_t offset, uint32_t len);
+
+// Sends the payload at buf, which must be within link->shbuf, by reference,
+// and waits until the peer is done with it. Returns the status in the reply
+// of the peer (CMD_BUF_STATUS_*), or -1 if the request fails.
+int shbuf_request(struct link *link, uint32_t type, void *buf, size_t len);
+
+#endif // SHBUF_H
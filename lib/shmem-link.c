@@ -1,7 +1,11 @@
+#define DEBUG 0
+
 #include <stdint.h>
 
+#include "command.h"
 #include "link.h"
 #include "object.h"
+#include "panic.h"
 #include "printf.h"
 #include "shmem.h"
 #include "sleep.h"
@@ -10,11 +14,20 @@ struct shmem_link {
     struct object obj;
     struct shmem *shmem_out;
     struct shmem *shmem_in;
+    struct cmd_reqs reqs;
 };
 
 #define MAX_LINKS 8
-// pretty coarse, limited by systick
-#define MIN_SLEEP_MS 500
+
+// With the ring protocol, a link has up to CONFIG_SHMEM_RING_SLOTS slots in
+// flight in each direction, and a send completes once the record is in the
+// ring (the peer consuming it is the ACK). Otherwise, the link uses the
+// single-slot protocol: one message in flight, acknowledged by the peer.
+#if CONFIG_SHMEM_RING
+#if CONFIG_SHMEM_RING_SLOTS & (CONFIG_SHMEM_RING_SLOTS - 1)
+#error CONFIG_SHMEM_RING_SLOTS must be a power of 2
+#endif
+#endif // CONFIG_SHMEM_RING
 
 static struct link links[MAX_LINKS] = {0};
 static struct shmem_link slinks[MAX_LINKS] = {0};
@@ -22,47 +35,62 @@ static struct shmem_link slinks[MAX_LINKS] = {0};
 static int shmem_link_disconnect(struct link *link)
 {
     struct shmem_link *slink = link->priv;
-    printf("%s: disconnect\r\n", link->name);
+    IPRINTF("%s: disconnect\r\n", link->name);
     shmem_close(slink->shmem_out);
     shmem_close(slink->shmem_in);
+    cmd_queue_close(link);
     OBJECT_FREE(slink);
     OBJECT_FREE(link);
     return 0;
 }
 
-static void msleep_and_dec(int *ms_rem)
-{
-    msleep(MIN_SLEEP_MS);
-    // if < 0, timeout is infinite
-    if (*ms_rem > 0)
-        *ms_rem -= *ms_rem >= MIN_SLEEP_MS ? MIN_SLEEP_MS : *ms_rem;
-}
-
 static int shmem_link_send(struct link *link, int timeout_ms, void *buf,
                            size_t sz)
 {
     struct shmem_link *slink = link->priv;
-    int sleep_ms_rem = timeout_ms;
-    int rc = shmem_send(slink->shmem_out, buf, sz);
+    struct timeout to;
+    int rc;
+    timeout_start(&to, timeout_ms);
+#if CONFIG_SHMEM_RING
+    do {
+        rc = shmem_ring_send(slink->shmem_out, buf, sz);
+        if (rc < 0) {
+            EPRINTF("%s: send: message of %u bytes larger than the ring\r\n",
+                    link->name, (unsigned)sz);
+            return 0;
+        }
+        if (rc)
+            return rc;
+    } while (timeout_poll(&to)); // ring full: wait for the peer to consume
+    return 0;
+#else // !CONFIG_SHMEM_RING
+    rc = shmem_send(slink->shmem_out, buf, sz);
     shmem_set_new(slink->shmem_out, true);
-    printf("%s: send: waiting for ACK...\r\n", link->name);
+    DPRINTF("%s: send: waiting for ACK...\r\n", link->name);
     do {
         if (shmem_is_ack(slink->shmem_out)) {
-            printf("%s: send: ACK received\r\n", link->name);
+            DPRINTF("%s: send: ACK received\r\n", link->name);
             shmem_set_ack(slink->shmem_out, false);
             return rc;
         }
-        if (!sleep_ms_rem)
-            break; // timeout
-        msleep_and_dec(&sleep_ms_rem);
-    } while (1);
+    } while (timeout_poll(&to)); // no interrupt from the peer: spin
     return 0;
+#endif // !CONFIG_SHMEM_RING
 }
 
 static int shmem_link_recv(struct link *link, void *buf, size_t sz)
 {
     struct shmem_link *slink = link->priv;
     int rc;
+#if CONFIG_SHMEM_RING
+    rc = shmem_ring_recv(slink->shmem_in, buf, sz);
+    if (rc < 0) {
+        WPRINTF("%s: recv: dropped oversized or malformed message\r\n",
+                link->name);
+        return 0;
+    }
+    return rc;
+#else // !CONFIG_SHMEM_RING
     if (shmem_is_new(slink->shmem_in)) {
         rc = shmem_recv(slink->shmem_in, buf, sz);
         shmem_set_new(slink->shmem_in, false);
@@ -70,41 +98,66 @@ static int shmem_link_recv(struct link *link, void *buf, size_t sz)
         return rc;
     }
     return 0;
+#endif // !CONFIG_SHMEM_RING
 }
 
-static int shmem_link_poll(struct link *link, int timeout_ms, void *buf,
-                           size_t sz)
+static int shmem_link_request_start(struct link *link, int wtimeout_ms,
+                                    void *wbuf, size_t wsz,
+                                    void *rbuf, size_t rsz)
 {
-    int sleep_ms_rem = timeout_ms;
+    struct shmem_link *slink = link->priv;
+    int seq;
+
+    DPRINTF("%s: request\r\n", link->name);
+    seq = cmd_req_start(&slink->reqs, wbuf, rbuf, rsz);
+    if (!seq) {
+        WPRINTF("%s: request: too many requests in flight\r\n", link->name);
+        return -1;
+    }
+    if (!shmem_link_send(link, wtimeout_ms, wbuf, wsz)) {
+        WPRINTF("%s: request: send timed out\r\n", link->name);
+        cmd_req_cancel(&slink->reqs, seq);
+        return -1;
+    }
+    return seq;
+}
+
+static int shmem_link_request_wait(struct link *link, int seq, int timeout_ms)
+{
+    struct shmem_link *slink = link->priv;
+    uint32_t msg[CMD_MSG_SZ / sizeof(uint32_t)];
+    struct timeout to;
     int rc;
-    printf("%s: poll: waiting for reply...\r\n", link->name);
+    DPRINTF("%s: poll: waiting for reply %d...\r\n", link->name, seq);
+    timeout_start(&to, timeout_ms);
     do {
-        rc = shmem_link_recv(link, buf, sz);
-        if (rc > 0) {
-            printf("%s: poll: reply received\r\n", link->name);
-            break; // got data
+        // replies to any of the requests in flight
+        while ((rc = shmem_link_recv(link, msg, sizeof(msg))) > 0)
+            if (cmd_req_complete(&slink->reqs, msg, rc))
+                WPRINTF("%s: poll: not a reply to a request in flight\r\n",
+                        link->name);
+        rc = cmd_req_poll(&slink->reqs, seq);
+        if (rc) {
+            DPRINTF("%s: poll: reply received\r\n", link->name);
+            return rc; // got data
         }
-        if (!sleep_ms_rem)
-            break; // timeout
-        msleep_and_dec(&sleep_ms_rem);
-    } while (1);
-    return rc;
+    } while (timeout_poll(&to));
+    cmd_req_cancel(&slink->reqs, seq);
+    return 0;
 }
 
 static int shmem_link_request(struct link *link,
                               int wtimeout_ms, void *wbuf, size_t wsz,
                               int rtimeout_ms, void *rbuf, size_t rsz)
 {
-    int rc;
-    printf("%s: request\r\n", link->name);
-    rc = shmem_link_send(link, wtimeout_ms, wbuf, wsz);
-    if (!rc) {
-        printf("%s: request: send timed out\r\n", link->name);
+    int seq, rc;
+
+    seq = shmem_link_request_start(link, wtimeout_ms, wbuf, wsz, rbuf, rsz);
+    if (seq < 0)
         return -1;
-    }
-    rc = shmem_link_poll(link, rtimeout_ms, rbuf, rsz);
+    rc = shmem_link_request_wait(link, seq, rtimeout_ms);
     if (!rc)
-        printf("%s: request: recv timed out\r\n", link->name);
+        WPRINTF("%s: request: recv timed out\r\n", link->name);
     return rc;
 }
 
@@ -113,9 +166,9 @@ struct link *shmem_link_connect(const char *name, uintptr_t addr_out,
 {
     struct shmem_link *slink;
     struct link *link;
-    printf("%s: connect\r\n", name);
-    printf("\taddr_out = 0x%x\r\n", (unsigned long) addr_out);
-    printf("\taddr_in  = 0x%x\r\n", (unsigned long) addr_in);
+    IPRINTF("%s: connect\r\n", name);
+    IPRINTF("\taddr_out = 0x%x\r\n", (unsigned long) addr_out);
+    IPRINTF("\taddr_in  = 0x%x\r\n", (unsigned long) addr_in);
     link = OBJECT_ALLOC(links);
     if (!link)
         return NULL;
@@ -124,21 +177,36 @@ struct link *shmem_link_connect(const char *name, uintptr_t addr_out,
     if (!slink) {
         goto free_link;
     }
+#if CONFIG_SHMEM_RING
+    slink->shmem_out = shmem_ring_open(addr_out, /* producer */ true,
+                                       CONFIG_SHMEM_RING_SLOTS);
+    if (!slink->shmem_out)
+        goto free_links;
+    slink->shmem_in = shmem_ring_open(addr_in, /* producer */ false, 0);
+#else // !CONFIG_SHMEM_RING
     slink->shmem_out = shmem_open(addr_out);
     if (!slink->shmem_out)
         goto free_links;
     slink->shmem_in = shmem_open(addr_in);
+#endif // !CONFIG_SHMEM_RING
     if (!slink->shmem_in)
         goto free_out;
+    // requests received via recv are queued by the caller
+    if (cmd_queue_open(link))
+        goto free_in;
 
     link->priv = slink;
     link->name = name;
     link->disconnect = shmem_link_disconnect;
     link->send = shmem_link_send;
     link->request = shmem_link_request;
+    link->request_start = shmem_link_request_start;
+    link->request_wait = shmem_link_request_wait;
     link->recv = shmem_link_recv;
     return link;
 
+free_in:
+    shmem_close(slink->shmem_in);
 free_out:
     shmem_close(slink->shmem_out);
 free_links:
@@ -11,12 +11,24 @@
 struct shmem {
     struct object obj;
     volatile struct hpsc_shmem_region *shm;
+    volatile struct hpsc_shmem_ring *ring;
+    unsigned nslots; // 0 until the producer has initialized the ring
+    unsigned epoch; // of the ring, as initialized or last seen
 };
 
 static struct shmem shmems[MAX_SHMEMS] = {0};
 
 #define IS_ALIGNED(p) (((uintptr_t)(const void *)(p) % sizeof(uint32_t)) == 0)
 
+#define SLOT_SIZE HPSC_SHMEM_RING_SLOT_SIZE
+#define REC_HDR_SIZE sizeof(struct hpsc_shmem_rec)
+
+// Order the accesses to the slots with respect to the index updates
+static inline void shmem_barrier()
+{
+    asm volatile ("dmb" ::: "memory");
+}
+
 struct shmem *shmem_open(uintptr_t addr)
 {
     struct shmem *s = OBJECT_ALLOC(shmems);
@@ -80,3 +92,160 @@ void shmem_set_ack(struct shmem *s, bool val)
     else
         s->shm->status &= ~HPSC_SHMEM_STATUS_BIT_ACK;
 }
+
+struct shmem *shmem_ring_open(uintptr_t addr, bool producer, unsigned nslots)
+{
+    volatile struct hpsc_shmem_ring *r = (volatile struct hpsc_shmem_ring *)addr;
+    struct shmem *s;
+
+    ASSERT(addr % HPSC_SHMEM_CACHE_LINE == 0);
+    if (producer && (!nslots || (nslots & (nslots - 1))))
+        return NULL;
+    s = OBJECT_ALLOC(shmems);
+    if (!s)
+        return NULL;
+    s->ring = r;
+    s->nslots = 0;
+    if (producer) {
+        s->epoch = r->epoch + 1; // tail stays the consumer's to reset
+        r->magic = 0;
+        shmem_barrier();
+        r->version = HPSC_SHMEM_RING_VERSION;
+        r->nslots = nslots;
+        r->slot_size = SLOT_SIZE;
+        r->head = 0;
+        shmem_barrier(); // the header is complete when the epoch is seen
+        r->epoch = s->epoch;
+        shmem_barrier(); // the header must be complete before it is valid
+        r->magic = HPSC_SHMEM_RING_MAGIC;
+        s->nslots = nslots;
+    }
+    return s;
+}
+
+// Whether the epoch that the consumer saw is still the current one
+static bool ring_current(struct shmem *s)
+{
+    volatile struct hpsc_shmem_ring *r = s->ring;
+    return r->magic == HPSC_SHMEM_RING_MAGIC && r->epoch == s->epoch;
+}
+
+// For the consumer: (re)attach when the producer has (re)initialized the ring
+static bool ring_ready(struct shmem *s)
+{
+    volatile struct hpsc_shmem_ring *r = s->ring;
+    unsigned nslots, epoch;
+
+    if (r->magic != HPSC_SHMEM_RING_MAGIC)
+        return false;
+    shmem_barrier(); // read the header only after seeing the magic
+    epoch = r->epoch;
+    if (s->nslots && epoch == s->epoch)
+        return true;
+    shmem_barrier(); // the header is the one of this epoch
+    nslots = r->nslots;
+    if (r->version != HPSC_SHMEM_RING_VERSION || r->slot_size != SLOT_SIZE ||
+            !nslots || (nslots & (nslots - 1)))
+        return false;
+    shmem_barrier(); // done reading the header before checking it is current
+    if (r->magic != HPSC_SHMEM_RING_MAGIC || r->epoch != epoch)
+        return false; // re-initialized meanwhile: try again next time
+    s->nslots = nslots;
+    s->epoch = epoch;
+    r->tail = 0; // drop what is left of the previous epoch
+    shmem_barrier(); // the producer uses tail only once it sees the ack
+    r->epoch_ack = epoch;
+    return true;
+}
+
+static unsigned rec_slots(size_t sz)
+{
+    return (REC_HDR_SIZE + sz + SLOT_SIZE - 1) / SLOT_SIZE;
+}
+
+// Copies to/from the record that starts in slot 'pos' (free-running), at
+// byte offset 'off' into the record, across slots as the ring wraps around
+static void ring_write(struct shmem *s, unsigned pos, unsigned off,
+                       uint8_t *src, unsigned n)
+{
+    unsigned slot, o, c;
+    while (n) {
+        slot = (pos + off / SLOT_SIZE) & (s->nslots - 1);
+        o = off % SLOT_SIZE;
+        c = SLOT_SIZE - o < n ? SLOT_SIZE - o : n;
+        vmem_cpy(&s->ring->slots[slot * SLOT_SIZE + o], src, c);
+        src += c;
+        off += c;
+        n -= c;
+    }
+}
+
+static void ring_read(struct shmem *s, unsigned pos, unsigned off,
+                      uint8_t *dst, unsigned n)
+{
+    unsigned slot, o, c;
+    while (n) {
+        slot = (pos + off / SLOT_SIZE) & (s->nslots - 1);
+        o = off % SLOT_SIZE;
+        c = SLOT_SIZE - o < n ? SLOT_SIZE - o : n;
+        mem_vcpy(dst, &s->ring->slots[slot * SLOT_SIZE + o], c);
+        dst += c;
+        off += c;
+        n -= c;
+    }
+}
+
+int shmem_ring_send(struct shmem *s, void *msg, size_t sz)
+{
+    volatile struct hpsc_shmem_ring *r = s->ring;
+    struct hpsc_shmem_rec rec = { .len = sz };
+    unsigned head = r->head;
+    unsigned n = rec_slots(sz);
+    unsigned tail = 0; // until the consumer has reset it for this epoch
+
+    ASSERT(IS_ALIGNED(msg));
+    ASSERT(s->nslots && "not the producer of the ring");
+    if (n > s->nslots)
+        return -1;
+    if (r->epoch_ack == s->epoch) {
+        shmem_barrier(); // tail is of this epoch once the ack is seen
+        tail = r->tail;
+    }
+    if (n > s->nslots - (head - tail))
+        return 0; // full
+    shmem_barrier(); // write the slots only after seeing them released
+    ring_write(s, head, 0, (uint8_t *)&rec, REC_HDR_SIZE);
+    ring_write(s, head, REC_HDR_SIZE, msg, sz);
+    shmem_barrier(); // the record must be complete before it is visible
+    r->head = head + n;
+    return sz;
+}
+
+int shmem_ring_recv(struct shmem *s, void *msg, size_t sz)
+{
+    volatile struct hpsc_shmem_ring *r = s->ring;
+    struct hpsc_shmem_rec rec;
+    unsigned tail, avail, n;
+
+    ASSERT(IS_ALIGNED(msg));
+    if (!ring_ready(s))
+        return 0;
+    tail = r->tail;
+    avail = r->head - tail;
+    if (!avail)
+        return 0;
+    shmem_barrier(); // read the record only after seeing the head
+    ring_read(s, tail, 0, (uint8_t *)&rec, REC_HDR_SIZE);
+    n = rec_slots(rec.len);
+    if (n <= avail && rec.len <= sz)
+        ring_read(s, tail, REC_HDR_SIZE, msg, rec.len);
+    shmem_barrier(); // done reading the record before it is released
+    if (!ring_current(s))
+        return 0; // the producer restarted while it was read: stale
+    if (n > avail) { // corrupted: nothing after it can be trusted
+        r->tail = tail + avail;
+        return -1;
+    }
+    r->tail = tail + n;
+    return rec.len <= sz ? rec.len : -1;
+}
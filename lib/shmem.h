@@ -2,6 +2,7 @@
 #define SHMEM_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 // size aligns with mailbox messages
@@ -17,6 +18,47 @@ struct hpsc_shmem_region {
 
 #define HPSC_SHMEM_REGION_SZ sizeof(struct hpsc_shmem_region)
 
+// Multi-slot ring, an alternative to the single-slot region above (version 1
+// of the format). The region holds a ring of records in one direction: the
+// producer writes records and advances head, the consumer reads them and
+// advances tail. Head and tail are free-running slot counts, so up to nslots
+// slots are in flight. A record is a header followed by a payload of any
+// length, in consecutive slots (wrapping around the end of the ring). Slots,
+// head and tail are each in their own cache lines. The producer initializes
+// the header and writes the magic last; the consumer reads nothing until the
+// magic and version are valid.
+//
+// Each side writes only its own fields, also when the producer (re)starts: it
+// zeroes head and advances the epoch. The consumer, on seeing a new epoch,
+// discards what is left of the old one (zeroes tail) and then acknowledges
+// the epoch. Until then, the producer takes tail to be 0, so a tail written
+// by the consumer for the previous epoch is never used.
+#define HPSC_SHMEM_CACHE_LINE       64
+#define HPSC_SHMEM_RING_MAGIC       0x474e5253 // "SRNG"
+#define HPSC_SHMEM_RING_VERSION     1
+#define HPSC_SHMEM_RING_SLOT_SIZE   HPSC_SHMEM_CACHE_LINE
+struct hpsc_shmem_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots; // power of 2
+    uint32_t slot_size; // bytes
+    uint32_t epoch; // advanced by the producer on each initialization
+    uint8_t pad0[HPSC_SHMEM_CACHE_LINE - 5 * sizeof(uint32_t)];
+    uint32_t head; // written by the producer only
+    uint8_t pad1[HPSC_SHMEM_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t tail; // written by the consumer only
+    uint32_t epoch_ack; // written by the consumer only
+    uint8_t pad2[HPSC_SHMEM_CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint8_t slots[]; // nslots * slot_size
+};
+struct hpsc_shmem_rec {
+    uint32_t len; // of the payload, in bytes
+    uint32_t reserved;
+};
+
+#define HPSC_SHMEM_RING_SZ(nslots) \
+    (sizeof(struct hpsc_shmem_ring) + (nslots) * HPSC_SHMEM_RING_SLOT_SIZE)
+
 struct shmem;
 
 /**
@@ -66,4 +108,26 @@ void shmem_set_new(struct shmem *s, bool val);
  */
 void shmem_set_ack(struct shmem *s, bool val);
 
+/**
+ * Open a shared memory region as a ring (HPSC_SHMEM_RING_SZ(nslots) bytes,
+ * cache-line aligned). The producer initializes it, with nslots a power of
+ * 2; the consumer takes nslots from the producer (pass 0).
+ */
+struct shmem *shmem_ring_open(uintptr_t addr, bool producer, unsigned nslots);
+
+/**
+ * Write a record to the ring.
+ * Returns the number of bytes written, 0 if there is not enough space, or -1
+ * if the record is larger than the ring (it can never fit)
+ */
+int shmem_ring_send(struct shmem *s, void *msg, size_t sz);
+
+/**
+ * Read the next record from the ring.
+ * Returns the number of bytes read, 0 if there is no record (or the producer
+ * has not initialized the ring yet), or -1 if the record is larger than sz
+ * (the record is dropped) or malformed.
+ */
+int shmem_ring_recv(struct shmem *s, void *msg, size_t sz);
+
 #endif // SHMEM_H
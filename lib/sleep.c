@@ -1,19 +1,14 @@
 #define DEBUG 0
 
+#include "arm.h"
 #include "printf.h"
 #include "panic.h"
+#include "timerq.h"
 
 #include "sleep.h"
 
-#define MAX_TIME ~0
-
 static volatile unsigned busyloop_factor = 0;
 
-#if CONFIG_SLEEP_TIMER
-static volatile unsigned time = 0; // cycles @ clk Hz
-static volatile unsigned clk = 0;
-#endif // CONFIG_SLEEP_TIMER
-
 void sleep_set_busyloop_factor(unsigned f)
 {
     printf("SLEEP: busyloop factor <- %u\r\n", f);
@@ -21,39 +16,75 @@ void sleep_set_busyloop_factor(unsigned f)
 }
 
 #if CONFIG_SLEEP_TIMER
-void sleep_set_clock(unsigned f)
+static void sleep_cycles(uint64_t cycles)
 {
-    printf("SLEEP: clock <- %u Hz\r\n", f);
-    clk = f;
-}
+    uint64_t wakeup = timerq_now() + cycles;
+    unsigned irq;
 
-// Call this from a timer ISR
-void sleep_tick(unsigned delta_cycles)
-{
-    time += delta_cycles;
-    DPRINTF("SLEEP: time += %u -> %u\r\n", delta_cycles, time);
+    DPRINTF("SLEEP: sleeping for %u cycles...\r\n", (unsigned)cycles);
+    irq = int_save_disable(); // the check and the WFI must be atomic
+    while (timerq_now() < wakeup) {
+        timerq_wakeup(wakeup);
+        asm("wfi"); // ignores the interrupt mask
+        int_restore(irq); // the ISR runs
+        irq = int_save_disable();
+    }
+    int_restore(irq);
+    DPRINTF("SLEEP: awake\r\n");
 }
+
 void msleep(unsigned ms)
 {
-    ASSERT(clk && "sleep clk not set");
+    sleep_cycles(timerq_ms(ms));
+}
 
-    unsigned c = ms * (clk / 1000); // msec to cycles
+void usleep(unsigned us)
+{
+    sleep_cycles(timerq_us(us));
+}
+#endif // CONFIG_SLEEP_TIMER
 
-    unsigned wakeup = time + c; // % MAX_TIME implicitly
-    DPRINTF("time %u, wakeup %u\r\n", time, wakeup);
-    int remaining = wakeup >= time ? wakeup - time : (MAX_TIME - time) + wakeup;
-    unsigned last_tick = time;
-    while (remaining > 0) {
-	DPRINTF("SLEEP: sleeping for %u cycles...\r\n", remaining);
-        asm("wfi"); // TODO: change to WFE and add SEV to sleep_tick
+void timeout_start(struct timeout *t, int ms)
+{
+    t->forever = ms < 0;
+#if CONFIG_SLEEP_TIMER
+    t->deadline = timerq_now() + timerq_ms(ms);
+#else // !CONFIG_SLEEP_TIMER
+    t->remaining = ms;
+#endif // !CONFIG_SLEEP_TIMER
+}
 
-	unsigned elapsed = time >= last_tick ? time - last_tick : (MAX_TIME - last_tick) + time;
-        last_tick = time;
-        remaining -= elapsed;
-    }
-    DPRINTF("SLEEP: awake\r\n");
+static bool timeout_expired(struct timeout *t)
+{
+#if CONFIG_SLEEP_TIMER
+    return !t->forever && timerq_now() >= t->deadline;
+#else // !CONFIG_SLEEP_TIMER
+    if (t->forever)
+        return false;
+    if (!t->remaining)
+        return true;
+    mdelay(1);
+    t->remaining--;
+    return false;
+#endif // !CONFIG_SLEEP_TIMER
 }
+
+bool timeout_wait(struct timeout *t)
+{
+    if (timeout_expired(t))
+        return false;
+#if CONFIG_SLEEP_TIMER
+    if (!t->forever)
+        timerq_wakeup(t->deadline); // no tick would wake it otherwise
+    wait_for_event();
 #endif // CONFIG_SLEEP_TIMER
+    return true;
+}
+
+bool timeout_poll(struct timeout *t)
+{
+    return !timeout_expired(t);
+}
 
 void mdelay(unsigned ms)
 {
@@ -1,17 +1,43 @@
 #ifndef SLEEP_H
 #define SLEEP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void mdelay(unsigned ms); // busyloop
 void sleep_set_busyloop_factor(unsigned f);
 
+// With the sleep timer, the core sleeps in WFI until the deadline, which is
+// programmed one-shot into the timer of the timer queue (see timerq.h).
 #if CONFIG_SLEEP_TIMER
-void sleep_set_clock(unsigned t);
 void msleep(unsigned ms);
-
-// Call this from a timer ISR
-void sleep_tick(unsigned delta);
+void usleep(unsigned us);
 #else // !CONFIG_SLEEP_TIMER
 #define msleep(t) mdelay(t)
+#define usleep(t) mdelay(((t) + 999) / 1000)
 #endif // !CONFIG_SLEEP_TIMER
 
+// Timeout for a wait on a condition that is checked in a loop: the timeout
+// only bounds the wait, while the condition is checked as soon as it may have
+// changed. Without the sleep timer, each wait busyloops for 1 ms.
+struct timeout {
+#if CONFIG_SLEEP_TIMER
+    uint64_t deadline; // cycles of the timer queue clock
+#else // !CONFIG_SLEEP_TIMER
+    unsigned remaining; // ms
+#endif // !CONFIG_SLEEP_TIMER
+    bool forever;
+};
+
+void timeout_start(struct timeout *t, int ms); // ms < 0: never expires
+
+// For a condition set by an ISR, which must send_event() after setting it:
+// waits for the next event or interrupt (WFE), at the latest until the
+// deadline. Returns false if the timeout has expired instead.
+bool timeout_wait(struct timeout *t);
+
+// For a condition that no interrupt signals (e.g. in shared memory): returns
+// immediately (to poll again) unless the timeout has expired.
+bool timeout_poll(struct timeout *t);
+
 #endif // SLEEP_H
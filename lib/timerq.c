@@ -0,0 +1,143 @@
+#define DEBUG 0
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "panic.h"
+#include "printf.h"
+
+#include "timerq.h"
+
+static const struct timerq_clock *clock;
+static uint32_t cycles_per_us;
+
+static struct timer *head; // sorted by deadline
+static uint64_t wake = TIMERQ_NEVER; // earliest of the timerq_wakeup requests
+
+void timerq_init(const struct timerq_clock *clk)
+{
+    printf("TIMERQ: clock %u Hz\r\n", clk->freq);
+    ASSERT(clk->freq >= 1000000 && clk->freq % 1000000 == 0);
+    clock = clk;
+    cycles_per_us = clk->freq / 1000000;
+    head = NULL;
+    wake = TIMERQ_NEVER;
+    clock->alarm(TIMERQ_NEVER);
+}
+
+uint64_t timerq_now()
+{
+    return clock->now();
+}
+
+uint64_t timerq_us(uint32_t us)
+{
+    return (uint64_t)us * cycles_per_us;
+}
+
+uint64_t timerq_ms(uint32_t ms)
+{
+    return (uint64_t)ms * 1000 * cycles_per_us;
+}
+
+uint32_t timerq_to_us(uint64_t cycles)
+{
+    if (cycles > ~0U) // no 64-bit division
+        return ~0U;
+    return (uint32_t)cycles / cycles_per_us;
+}
+
+// Called with interrupts disabled (or from the ISR)
+static void program()
+{
+    uint64_t at = wake;
+    if (head && head->deadline < at)
+        at = head->deadline;
+    DPRINTF("TIMERQ: alarm at %08x%08x\r\n",
+            (uint32_t)(at >> 32), (uint32_t)at);
+    clock->alarm(at);
+}
+
+static void insert(struct timer *t)
+{
+    struct timer **p = &head;
+    while (*p && (*p)->deadline <= t->deadline) // FIFO among equal deadlines
+        p = &(*p)->next;
+    t->next = *p;
+    *p = t;
+}
+
+static void unlink(struct timer *t)
+{
+    struct timer **p = &head;
+    while (*p && *p != t)
+        p = &(*p)->next;
+    if (*p)
+        *p = t->next;
+}
+
+void timerq_wakeup(uint64_t at)
+{
+    unsigned irq = int_save_disable();
+    if (at < wake) {
+        wake = at;
+        if (!head || at < head->deadline)
+            program();
+    }
+    int_restore(irq);
+}
+
+void timer_start(struct timer *t, uint64_t delay, uint64_t period,
+                 timer_cb_t *cb, void *cb_arg)
+{
+    unsigned irq = int_save_disable();
+    if (t->started)
+        unlink(t);
+    t->cb = cb;
+    t->cb_arg = cb_arg;
+    t->period = period;
+    t->deadline = clock->now() + delay;
+    t->started = true;
+    insert(t);
+    if (head == t)
+        program();
+    int_restore(irq);
+}
+
+void timer_stop(struct timer *t)
+{
+    unsigned irq = int_save_disable();
+    if (t->started) {
+        // Not reprogrammed if it was the earliest: an early alarm is harmless
+        unlink(t);
+        t->started = false;
+    }
+    int_restore(irq);
+}
+
+void timerq_isr()
+{
+    uint64_t now = clock->now();
+    struct timer *t;
+
+    while (head && head->deadline <= now) {
+        t = head;
+        head = t->next;
+        if (t->period) {
+            t->deadline += t->period; // no drift, unless it fell behind
+            if (t->deadline <= now)
+                t->deadline = now + t->period;
+            insert(t);
+        } else {
+            t->started = false;
+        }
+        t->cb(t->cb_arg); // may start or stop timers, including this one
+        now = clock->now();
+    }
+
+    if (wake <= now) {
+        wake = TIMERQ_NEVER;
+        send_event(); // for a waiter in WFE
+    }
+    program();
+}
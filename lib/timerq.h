@@ -0,0 +1,58 @@
+#ifndef TIMERQ_H
+#define TIMERQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timer queue: callbacks at deadlines on a free-running clock. The hardware
+// timer is programmed one-shot for the earliest deadline only (tickless), so
+// the core sleeps in WFI/WFE between events rather than waking up on a
+// periodic tick.
+//
+// Times are in cycles of the clock. Conversions from us/ms are by
+// multiplication only (there is no libgcc for 64-bit division), so the clock
+// frequency must be a multiple of 1 MHz.
+
+// Provided by the platform, from a driver of the hardware timer
+struct timerq_clock {
+    uint32_t freq; // Hz
+    uint64_t (*now)(void); // free-running count
+    // One interrupt at the count (as soon as possible if in the past),
+    // replacing the previous one; the ISR must call timerq_isr.
+    void (*alarm)(uint64_t at);
+};
+
+#define TIMERQ_NEVER (~0ULL)
+
+typedef void (timer_cb_t)(void *arg);
+
+// Owned by the caller, and must stay allocated while started
+struct timer {
+    struct timer *next;
+    uint64_t deadline;
+    uint64_t period; // 0 for one-shot
+    timer_cb_t *cb;
+    void *cb_arg;
+    bool started;
+};
+
+void timerq_init(const struct timerq_clock *clk);
+void timerq_isr();
+
+uint64_t timerq_now();
+uint64_t timerq_us(uint32_t us); // to cycles
+uint64_t timerq_ms(uint32_t ms); // to cycles
+uint32_t timerq_to_us(uint64_t cycles); // ~0 beyond 2^32 cycles
+
+// An interrupt at (or soon after) the count, without a callback: for a wait
+// in WFI/WFE that must not outlast a deadline. Only the earliest one is kept,
+// an extra interrupt is harmless to a wait that is already over.
+void timerq_wakeup(uint64_t at);
+
+// The callback runs in the ISR, first at 'delay' cycles from now, then every
+// 'period' cycles (if not 0) until stopped.
+void timer_start(struct timer *t, uint64_t delay, uint64_t period,
+                 timer_cb_t *cb, void *cb_arg);
+void timer_stop(struct timer *t);
+
+#endif // TIMERQ_H
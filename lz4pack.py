@@ -0,0 +1,114 @@
+#!/usr/bin/python3
+#
+# Pack a file into a compressed memfs image: an 8-byte header (magic "LZ4B"
+# and the decompressed size, little-endian) followed by one LZ4 block.
+# TRCH decompresses it straight to the load address (see lib/lz4.h).
+#
+# The memfs descriptor of the image must have the LZ4 flag (bit 16 of the
+# valid field) set, and its checksum must be the SHA-256 of the original
+# (decompressed) file, which is printed by this tool.
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = 0x42345a4c
+MIN_MATCH = 4
+LAST_LITERALS = 5 # the block must end with at least this many literals
+MF_LIMIT = 12 # no match may start closer than this to the end
+MAX_OFFSET = 0xffff
+
+def length_bytes(n):
+    out = bytearray()
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+    return out
+
+def sequence(out, lits, mlen, offset):
+    lit_nib = min(len(lits), 15)
+    if mlen is None:
+        out.append(lit_nib << 4)
+    else:
+        out.append(lit_nib << 4 | min(mlen - MIN_MATCH, 15))
+    if lit_nib == 15:
+        out += length_bytes(len(lits) - 15)
+    out += lits
+    if mlen is not None:
+        out += struct.pack('<H', offset)
+        if mlen - MIN_MATCH >= 15:
+            out += length_bytes(mlen - MIN_MATCH - 15)
+
+def compress(data):
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    match_end = n - LAST_LITERALS
+    while i < n - MF_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > MAX_OFFSET:
+            i += 1
+            continue
+        mlen = MIN_MATCH
+        while i + mlen < match_end and data[cand + mlen] == data[i + mlen]:
+            mlen += 1
+        sequence(out, data[anchor:i], mlen, i - cand)
+        i += mlen
+        anchor = i
+    sequence(out, data[anchor:], None, 0)
+    return out
+
+def decompress(block, size):
+    out = bytearray()
+    i = 0
+    while True:
+        token = block[i]; i += 1
+        lits = token >> 4
+        if lits == 15:
+            while True:
+                b = block[i]; i += 1
+                lits += b
+                if b != 255:
+                    break
+        out += block[i:i + lits]; i += lits
+        if i == len(block):
+            break
+        offset = block[i] | block[i + 1] << 8; i += 2
+        mlen = (token & 0xf) + MIN_MATCH
+        if mlen == 15 + MIN_MATCH:
+            while True:
+                b = block[i]; i += 1
+                mlen += b
+                if b != 255:
+                    break
+        for _ in range(mlen):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise ValueError("decompressed size mismatch")
+    return bytes(out)
+
+parser = argparse.ArgumentParser(
+    description="Compress a file into an LZ4 image for memfs")
+parser.add_argument('input', help='File to compress')
+parser.add_argument('output', help='Compressed image')
+args = parser.parse_args()
+
+data = open(args.input, 'rb').read()
+block = compress(data)
+if decompress(block, len(data)) != data:
+    print("error: compressed image does not round-trip", file=sys.stderr)
+    sys.exit(1)
+
+with open(args.output, 'wb') as f:
+    f.write(struct.pack('<II', MAGIC, len(data)))
+    f.write(block)
+
+print("%s: %u -> %u bytes (%.1f%%)" % (args.output, len(data), len(block) + 8,
+      100.0 * (len(block) + 8) / max(len(data), 1)))
+print("sha256 (for the descriptor): %s" % hashlib.sha256(data).hexdigest())
@@ -1,10 +1,19 @@
 #!/usr/bin/python
 
+# Usage:
+#   metrics.py ELF...
+#       sizes of the sections
+#   metrics.py --compare ELF_A ELF_B
+#       sizes of the sections of two builds (e.g. with CONFIG_LOG_LEVEL=4
+#       and CONFIG_LOG_LEVEL=1), and the difference
+#   metrics.py --compare-logs LOG_A LOG_B
+#       numbers (cycles, etc) in the benchmark lines of the console logs of
+#       two builds, side by side
+
+import re
 import sys
 from elftools.elf.elffile import ELFFile
 
-files = sys.argv[1:]
-
 SECTIONS = [
     '.text',
     '.bss',
@@ -12,12 +21,63 @@ SECTIONS = [
     '.rodata',
 ]
 
-for fname in files:
+def section_sizes(fname):
     f = open(fname, "rb")
     ef = ELFFile(f)
-    print(fname)
+    sizes = {}
     for s in ef.iter_sections():
         if s.name in SECTIONS:
             # data_size not yet available in pyelftools 0.22
-            print("%10s: %4.3f KB" % (s.name, len(s.data()) / 1024))
-    print
+            sizes[s.name] = len(s.data())
+    f.close()
+    return sizes
+
+def print_sizes(files):
+    for fname in files:
+        sizes = section_sizes(fname)
+        print(fname)
+        for name in SECTIONS:
+            if name in sizes:
+                print("%10s: %4.3f KB" % (name, sizes[name] / 1024.0))
+        print("")
+
+def compare_sizes(fname_a, fname_b):
+    a = section_sizes(fname_a)
+    b = section_sizes(fname_b)
+    print("A: %s\nB: %s" % (fname_a, fname_b))
+    print("%10s  %10s  %10s  %10s" % ("", "A (KB)", "B (KB)", "B - A (KB)"))
+    for name in SECTIONS:
+        sa = a.get(name, 0)
+        sb = b.get(name, 0)
+        print("%10s: %10.3f  %10.3f  %+10.3f" %
+              (name, sa / 1024.0, sb / 1024.0, (sb - sa) / 1024.0))
+
+NUMBER = re.compile(r'\d+')
+
+# Benchmark lines, keyed by the line without its numbers, in order
+def bench_lines(fname):
+    lines = []
+    for line in open(fname):
+        line = line.strip()
+        if 'bench' in line.lower():
+            lines.append((NUMBER.sub('#', line), NUMBER.findall(line)))
+    return lines
+
+def compare_logs(fname_a, fname_b):
+    b = bench_lines(fname_b)
+    print("A: %s\nB: %s" % (fname_a, fname_b))
+    for key, nums_a in bench_lines(fname_a):
+        match = [i for i, (k, _) in enumerate(b) if k == key]
+        if not match:
+            continue
+        key_b, nums_b = b.pop(match[0])
+        print(key)
+        print("\t" + ", ".join("%s -> %s" % (na, nb)
+                               for na, nb in zip(nums_a, nums_b)))
+
+if len(sys.argv) == 4 and sys.argv[1] == '--compare':
+    compare_sizes(sys.argv[2], sys.argv[3])
+elif len(sys.argv) == 4 and sys.argv[1] == '--compare-logs':
+    compare_logs(sys.argv[2], sys.argv[3])
+else:
+    print_sizes(sys.argv[1:])
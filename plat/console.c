@@ -1,18 +1,22 @@
 #include <stdint.h>
 
+#include "arm.h"
 #include "hwinfo.h"
+#include "printf.h"
 #include  "console.h"
 
+#define CONSOLE_DEFER_LEN 16 // lines logged from ISRs between main loop passes
+
 #if defined(CONFIG_CONSOLE__NS16550)
 
 #include "ns16550.h"
 
-int console_init()
+static int uart_init()
 {
     return ns16550_startup(UART_BASE, UART_CLOCK, UART_BAUDRATE);
 }
 
-void _putchar(char c)
+static void uart_putchar(char c)
 {
     ns16550_putchar(c);
 }
@@ -21,12 +25,12 @@ void _putchar(char c)
 
 #include "cadence_uart.h"
 
-int console_init()
+static int uart_init()
 {
     return cdns_uart_startup(UART_BASE);
 }
 
-void _putchar(char c)
+static void uart_putchar(char c)
 {
     cdns_uart_poll_put_char(c);
 }
@@ -34,3 +38,187 @@ void _putchar(char c)
 #else // CONFIG_CONSOLE__*
 #error Invalid console choice: see CONFIG_CONSOLE
 #endif // CONFIG_CONSOLE__*
+
+#if CONFIG_CONSOLE_BUFFERED
+
+#if !defined(CONFIG_CONSOLE__NS16550)
+#error CONFIG_CONSOLE_BUFFERED is supported only for the NS16550 console
+#endif
+#if CONFIG_CONSOLE_BUF_SIZE & (CONFIG_CONSOLE_BUF_SIZE - 1)
+#error CONFIG_CONSOLE_BUF_SIZE must be a power of 2
+#endif
+
+// Output is queued into a ring that the ISR moves into the TX FIFO of the UART
+// whenever the FIFO is empty, so printf costs only the formatting instead of
+// the time on the wire. Head and tail are free-running counters. When the ring
+// is full, chars are dropped and counted (reported by console_drain).
+static char tx_buf[CONFIG_CONSOLE_BUF_SIZE];
+static volatile unsigned tx_head; // by _putchar
+static volatile unsigned tx_tail; // by the ISR
+static volatile unsigned tx_dropped;
+static unsigned tx_dropped_reported;
+static bool tx_active; // TX interrupt enabled
+static bool tx_sync; // bypass the ring
+
+int console_init()
+{
+    return uart_init();
+}
+
+void _putchar(char c)
+{
+    unsigned irq_state;
+
+    if (tx_sync) {
+        uart_putchar(c);
+        return;
+    }
+
+    // From main loop and from ISRs alike
+    irq_state = int_save_disable();
+    if (tx_head - tx_tail == CONFIG_CONSOLE_BUF_SIZE) {
+        tx_dropped++;
+    } else {
+        tx_buf[tx_head++ % CONFIG_CONSOLE_BUF_SIZE] = c;
+        if (!tx_active) { // the interrupt fires once enabled, if FIFO empty
+            tx_active = true;
+            ns16550_tx_int_enable(true);
+        }
+    }
+    int_restore(irq_state);
+}
+
+void console_isr()
+{
+    unsigned irq_state = int_save_disable(); // against _putchar in other ISRs
+    unsigned n;
+
+    if (ns16550_tx_empty()) {
+        for (n = 0; n < NS16550_TX_FIFO_DEPTH && tx_tail != tx_head; ++n)
+            ns16550_tx_put(tx_buf[tx_tail++ % CONFIG_CONSOLE_BUF_SIZE]);
+        if (tx_tail == tx_head) {
+            tx_active = false;
+            ns16550_tx_int_enable(false);
+        }
+    }
+    int_restore(irq_state);
+}
+
+void console_sync()
+{
+    unsigned irq_state = int_save_disable();
+
+    ns16550_tx_int_enable(false);
+    tx_active = false;
+    while (tx_tail != tx_head)
+        uart_putchar(tx_buf[tx_tail++ % CONFIG_CONSOLE_BUF_SIZE]);
+    tx_sync = true;
+    int_restore(irq_state);
+}
+
+static void report_dropped()
+{
+    unsigned dropped = tx_dropped;
+
+    if (dropped != tx_dropped_reported) {
+        printf("console: dropped %u chars\r\n", dropped - tx_dropped_reported);
+        tx_dropped_reported = dropped;
+    }
+}
+
+#else // !CONFIG_CONSOLE_BUFFERED
+
+int console_init()
+{
+    return uart_init();
+}
+
+void _putchar(char c)
+{
+    uart_putchar(c);
+}
+
+void console_isr()
+{
+}
+
+void console_sync()
+{
+}
+
+static void report_dropped()
+{
+}
+
+#endif // !CONFIG_CONSOLE_BUFFERED
+
+struct deferred {
+    const char *fmt;
+    uint32_t args[4];
+};
+
+// Written by ISRs (with interrupts masked, since they may nest), read by the
+// main loop: free-running counters, like the TX ring.
+static struct deferred deferred[CONSOLE_DEFER_LEN];
+static volatile unsigned defer_head, defer_tail;
+static volatile unsigned defer_dropped;
+static unsigned defer_dropped_reported;
+
+void console_defer(const char *fmt, uint32_t a0, uint32_t a1,
+                   uint32_t a2, uint32_t a3)
+{
+    unsigned irq_state = int_save_disable();
+    struct deferred *d;
+
+    if (defer_head - defer_tail == CONSOLE_DEFER_LEN) {
+        defer_dropped++;
+    } else {
+        d = &deferred[defer_head % CONSOLE_DEFER_LEN];
+        d->fmt = fmt;
+        d->args[0] = a0;
+        d->args[1] = a1;
+        d->args[2] = a2;
+        d->args[3] = a3;
+        defer_head++;
+    }
+    int_restore(irq_state);
+}
+
+bool console_pending()
+{
+    return defer_head != defer_tail;
+}
+
+void console_drain()
+{
+    struct deferred *d;
+    const char *fmt;
+    uint32_t a[4];
+    unsigned irq_state, dropped;
+
+    while (1) {
+        irq_state = int_save_disable();
+        if (defer_tail == defer_head) {
+            int_restore(irq_state);
+            break;
+        }
+        d = &deferred[defer_tail % CONSOLE_DEFER_LEN];
+        fmt = d->fmt;
+        a[0] = d->args[0];
+        a[1] = d->args[1];
+        a[2] = d->args[2];
+        a[3] = d->args[3];
+        defer_tail++;
+        int_restore(irq_state);
+
+        printf(fmt, a[0], a[1], a[2], a[3]);
+    }
+
+    dropped = defer_dropped;
+    if (dropped != defer_dropped_reported) {
+        printf("console: dropped %u lines logged from ISRs\r\n",
+               dropped - defer_dropped_reported);
+        defer_dropped_reported = dropped;
+    }
+    report_dropped();
+}
@@ -1,6 +1,30 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 int console_init();
 
+// With CONFIG_CONSOLE_BUFFERED, the UART TX interrupt must be routed to this
+void console_isr();
+
+// Flush the output by polling and bypass the buffer from then on: for when
+// interrupts are masked for good (i.e. panic)
+void console_sync();
+
+// Logging from ISRs: only the format and up to four word-sized arguments are
+// recorded (so, no 64-bit or floating point arguments, and only strings that
+// outlive the call); the formatting and the output are deferred until the main
+// loop calls console_drain.
+#define printf_isr(...) printf_isr_(__VA_ARGS__, 0, 0, 0, 0)
+#define printf_isr_(fmt, a0, a1, a2, a3, ...) \
+        console_defer(fmt, (uint32_t)(a0), (uint32_t)(a1), \
+                      (uint32_t)(a2), (uint32_t)(a3))
+
+void console_defer(const char *fmt, uint32_t a0, uint32_t a1,
+                   uint32_t a2, uint32_t a3);
+void console_drain();
+bool console_pending();
+
 #endif // CONSOLE_H
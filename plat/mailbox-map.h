@@ -51,6 +51,10 @@
 #define LSIO_MBOX0_CHAN__RTPS_A53_ATF__TRCH_SSW 2
 #define LSIO_MBOX0_CHAN__TRCH_SSW__RTPS_A53_ATF 3
 
+// RTPS R52 SSW <-> TRCH SSW, polled (no interrupts)
+#define LSIO_MBOX0_CHAN__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW_POLL 4
+#define LSIO_MBOX0_CHAN__TRCH_SSW__RTPS_R52_LOCKSTEP_SSW_POLL 5
+
 // RTPS R52 SSW loopback
 #define LSIO_MBOX0_CHAN__RTPS_R52_LOCKSTEP_SSW__LOOPBACK 31
 
@@ -49,8 +49,12 @@
 #define RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW     0xbe008000
 #define RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW     0x00008000
 // Shared memory - reserved but not allocated
-#define RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP__FREE             0xbe010000
-#define RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP__FREE             0x01ff0000
+// Payloads passed by reference in requests to TRCH (see shbuf.h)
+#define RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF 0xbe010000
+#define RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF 0x00100000
+
+#define RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP__FREE             0xbe110000
+#define RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP__FREE             0x01ef0000
 
 //////////
 // HPPS //
@@ -80,6 +84,11 @@
 // Shared memory regions accessible to HPPS
 #define HPPS_DDR_ADDR__SHM__HPPS_SMP 0xc3400000
 #define HPPS_DDR_SIZE__SHM__HPPS_SMP   0x400000
+// Payloads passed by reference in requests to TRCH (see shbuf.h)
+#define HPPS_DDR_ADDR__SHM__HPPS_SMP_APP__TRCH_SSW__BUF 0xc3400000
+#define HPPS_DDR_SIZE__SHM__HPPS_SMP_APP__TRCH_SSW__BUF   0x100000
+#define HPPS_DDR_ADDR__SHM__HPPS_SMP_SSW__TRCH_SSW__BUF 0xc3500000
+#define HPPS_DDR_SIZE__SHM__HPPS_SMP_SSW__TRCH_SSW__BUF   0x100000
 // HPPS userspace <-> TRCH SSW
 #define HPPS_DDR_ADDR__SHM__HPPS_SMP_APP__TRCH_SSW 0xc3600000
 #define HPPS_DDR_SIZE__SHM__HPPS_SMP_APP__TRCH_SSW    0x10000
@@ -21,6 +21,7 @@
 #include "server.h"
 #include "sleep.h"
 #include "test.h"
+#include "timerq.h"
 #include "watchdog.h"
 
 extern unsigned char _text_start;
@@ -71,15 +72,38 @@ void soft_reset (void)
 }
 
 #if CONFIG_GTIMER
+#if CONFIG_SLEEP_TIMER
+static uint64_t sys_clock_now()
+{
+    return gtimer_get_pct(sys_timer);
+}
+
+static void sys_clock_alarm(uint64_t at)
+{
+    gtimer_set_cval(sys_timer, at);
+}
+
+static struct timerq_clock sys_clock = {
+    .now = sys_clock_now,
+    .alarm = sys_clock_alarm,
+};
+static struct timer sys_tick_timer; // a periodic timer in the timer queue
+
+static void sys_clock_isr(void *arg)
+{
+    timerq_isr();
+}
+
+// Only wakes up the main loop, which kicks the watchdog
+static void sys_tick(void *arg)
+{
+}
+#else // !CONFIG_SLEEP_TIMER
 static void sys_tick(void *arg)
 {
-    int32_t tval = gtimer_get_tval(sys_timer); // negative value, time since last tick
     gtimer_set_tval(sys_timer, sys_timer_interval); // schedule the next tick
-
-#if CONFIG_SLEEP_TIMER
-    sleep_tick(sys_timer_interval + (-tval));
-#endif // CONFIG_SLEEP_TIMER
 }
+#endif // !CONFIG_SLEEP_TIMER
 #endif // CONFIG_GTIMER
 
 int main(void)
@@ -92,6 +116,11 @@ int main(void)
 
     gic_init(RTPS_GIC_BASE);
 
+#if CONFIG_CONSOLE_BUFFERED
+    // output so far was buffered
+    gic_int_enable(RTPS_IRQ__LSIO_UART1_0, GIC_IRQ_TYPE_SPI, GIC_IRQ_CFG_LEVEL);
+#endif // CONFIG_CONSOLE_BUFFERED
+
 #if TEST_R52_SMP
     test_r52_smp();
 #endif
@@ -108,13 +137,21 @@ int main(void)
     if (sys_timer_clk == 0)
         panic("system counter freq register was not initialized by bootloader");
     sys_timer_interval = SYS_TICK_INTERVAL_MS * (sys_timer_clk / 1000);
+#if CONFIG_SLEEP_TIMER
+    // Tickless: CVAL is programmed for the next deadline in the timer queue,
+    // of which the tick is only one.
+    sys_clock.freq = sys_timer_clk;
+    timerq_init(&sys_clock);
+    gtimer_subscribe(sys_timer, sys_clock_isr, NULL);
+#else // !CONFIG_SLEEP_TIMER
     gtimer_set_tval(sys_timer, sys_timer_interval);
     gtimer_subscribe(sys_timer, sys_tick, NULL);
+#endif // !CONFIG_SLEEP_TIMER
     gic_int_enable(PPI_IRQ__TIMER_PHYS, GIC_IRQ_TYPE_PPI, GIC_IRQ_CFG_LEVEL);
     gtimer_start(sys_timer);
-
 #if CONFIG_SLEEP_TIMER
-    sleep_set_clock(sys_timer_clk);
+    timer_start(&sys_tick_timer, sys_timer_interval, sys_timer_interval,
+                sys_tick, NULL);
 #endif // CONFIG_SLEEP_TIMER
 #endif // CONFIG_GTIMER
 
@@ -229,8 +266,10 @@ int main(void)
             verbose = true; // to end log with 'waiting' msg
         }
 
+        console_drain(); // lines logged by ISRs
+
         int_disable(); // the check and the WFI must be atomic
-        if (!cmd_pending()) {
+        if (!cmd_pending() && !console_pending()) {
             if (verbose)
                 printf("[%u] Waiting for interrupt...\r\n", iter);
             asm("wfi"); // ignores PRIMASK set by int_disable
@@ -281,6 +320,11 @@ void irq_handler(unsigned intid) {
         unsigned irq = intid - GIC_INTERNAL;
         DPRINTF("IRQ #%u\r\n", irq);
         switch (irq) {
+#if CONFIG_CONSOLE_BUFFERED
+            case RTPS_IRQ__LSIO_UART1_0:
+                    console_isr();
+                    break;
+#endif // CONFIG_CONSOLE_BUFFERED
             // Only register the ISRs for mailbox ints that are used (see mailbox-map.h)
             // NOTE: we multiplex all mboxes (in one IP block) onto one pair of IRQs
 #if CONFIG_HPPS_RTPS_MAILBOX
@@ -1,13 +1,173 @@
 #include <stdint.h>
 
+#include "arm.h"
 #include "printf.h"
 #include "mailbox-link.h"
 #include "mailbox-map.h"
 #include "hwinfo.h"
 #include "gic.h"
+#include "gtimer.h"
 #include "command.h"
+#include "mem-map.h"
+#include "shbuf.h"
 #include "test.h"
 
+#define PING_BENCH_ITERS 64
+
+// Round trips of CMD_PING: the request, the ACK, the TRCH main loop handling
+// it, the reply, and its ACK, with each side woken by the mailbox interrupts
+static int ping_bench(struct link *link)
+{
+    uint32_t arg[] = { CMD_PING, 0 };
+    uint32_t reply[sizeof(arg) / sizeof(arg[0])];
+    uint32_t start, cycles, min = ~0, max = 0, total = 0;
+    unsigned i;
+    int rc;
+
+    cycle_counter_enable();
+    for (i = 0; i < PING_BENCH_ITERS; ++i) {
+        arg[1] = i;
+        reply[0] = reply[1] = 0;
+        start = cycle_counter_read();
+        rc = link->request(link, CMD_TIMEOUT_MS_SEND, arg, sizeof(arg),
+                           CMD_TIMEOUT_MS_RECV, reply, sizeof(reply));
+        cycles = cycle_counter_read() - start;
+        if (rc <= 0 || (reply[0] & 0xff) != CMD_PONG || reply[1] != i) {
+            printf("PING bench: round trip %u failed: rc %d\r\n", i, rc);
+            return 1;
+        }
+        if (cycles < min)
+            min = cycles;
+        if (cycles > max)
+            max = cycles;
+        total += cycles;
+    }
+    printf("PING bench: %s: %u round trips: cycles: min %u avg %u max %u\r\n",
+           link->name, PING_BENCH_ITERS, min, total / PING_BENCH_ITERS, max);
+    return 0;
+}
+
+#define PIPELINE_BENCH_REQS 256
+
+// Throughput with up to 'window' requests in flight, in requests per second
+static int pipeline_bench(struct link *link, unsigned window)
+{
+    uint32_t arg[2];
+    uint32_t replies[CMD_MAX_INFLIGHT][2];
+    int seqs[CMD_MAX_INFLIGHT];
+    unsigned issued = 0, done = 0, naks = 0, slot;
+    uint64_t start;
+    uint32_t us;
+    int rc;
+
+    start = gtimer_get_pct(GTIMER_PHYS);
+    while (done < PIPELINE_BENCH_REQS) {
+        while (issued < PIPELINE_BENCH_REQS && issued - done < window) {
+            slot = issued % window;
+            arg[0] = CMD_PING;
+            arg[1] = issued;
+            seqs[slot] = link->request_start(link, CMD_TIMEOUT_MS_SEND,
+                                             arg, sizeof(arg), replies[slot],
+                                             sizeof(replies[slot]));
+            if (seqs[slot] < 0)
+                return 1;
+            issued++;
+        }
+        slot = done % window;
+        rc = link->request_wait(link, seqs[slot], CMD_TIMEOUT_MS_RECV);
+        if (rc > 0 && (replies[slot][0] & 0xff) == CMD_NAK) {
+            naks++;
+        } else if (rc <= 0 || (replies[slot][0] & 0xff) != CMD_PONG ||
+                   replies[slot][1] != done) {
+            printf("PIPELINE bench: request %u failed: rc %d\r\n", done, rc);
+            return 1;
+        }
+        done++;
+    }
+    us = (uint32_t)(gtimer_get_pct(GTIMER_PHYS) - start) /
+         (gtimer_get_frq() / 1000000);
+    printf("PIPELINE bench: %s: %u in flight: %u requests (%u NAK'ed) "
+           "in %u us: %u requests/s\r\n", link->name, window,
+           PIPELINE_BENCH_REQS, naks, us,
+           us ? PIPELINE_BENCH_REQS * 1000000 / us : 0);
+    return 0;
+}
+
+static const struct shbuf_win shbuf_win = {
+    RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF,
+    RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF
+};
+
+static const char shbuf_log[] =
+    "RTPS: this log is passed by reference in the shared window\r\n";
+
+// Payloads passed by reference: the mailbox carries only the descriptor,
+// and TRCH checksums the payload in place
+static int shbuf_bench(struct link *link)
+{
+    static const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+    uint32_t *buf = (uint32_t *)shbuf_win.addr;
+    char *text = (char *)shbuf_win.addr;
+    uint32_t start, cycles;
+    unsigned i, w;
+    int rc;
+
+    link->shbuf = &shbuf_win;
+    cycle_counter_enable();
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for (w = 0; w < sizes[i] / sizeof(uint32_t); ++w)
+            buf[w] = w * 2654435761u;
+        start = cycle_counter_read();
+        rc = shbuf_request(link, CMD_BUF_TYPE_DATA, buf, sizes[i]);
+        cycles = cycle_counter_read() - start;
+        if (rc != CMD_BUF_STATUS_OK) {
+            printf("BUF bench: %u bytes: failed: rc %d\r\n", sizes[i], rc);
+            return 1;
+        }
+        printf("BUF bench: %u bytes: %u cycles\r\n", sizes[i], cycles);
+    }
+
+    for (i = 0; i < sizeof(shbuf_log) - 1; ++i)
+        text[i] = shbuf_log[i];
+    rc = shbuf_request(link, CMD_BUF_TYPE_LOG, text, sizeof(shbuf_log) - 1);
+    if (rc != CMD_BUF_STATUS_OK) {
+        printf("BUF: log: failed: rc %d\r\n", rc);
+        return 1;
+    }
+    return 0;
+}
+
+#if TEST_RTPS_TRCH_MAILBOX_POLL
+// The same round trips as over the link with interrupts, for comparison, but
+// with both sides spinning on the mailbox event status
+static int ping_bench_polled()
+{
+    struct mbox_link_dev mdev;
+    struct link *link;
+    int rc;
+
+    mdev.base = MBOX_LSIO__BASE;
+    mdev.rcv_irq = NULL;
+    mdev.rcv_int_idx = 0;
+    mdev.ack_irq = NULL;
+    mdev.ack_int_idx = 0;
+
+    link = mbox_link_connect("RTPS_TRCH_MBOX_POLL_TEST_LINK", &mdev,
+                    LSIO_MBOX0_CHAN__TRCH_SSW__RTPS_R52_LOCKSTEP_SSW_POLL,
+                    LSIO_MBOX0_CHAN__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW_POLL,
+                    /* server */ 0, /* client */ MASTER_ID_RTPS_CPU0);
+    if (!link)
+        return 1;
+#if CONFIG_MBOX_MSG_LEN
+    mbox_link_set_msg_len(link, true);
+#endif // CONFIG_MBOX_MSG_LEN
+    rc = ping_bench(link);
+    if (link->disconnect(link))
+        rc = 1;
+    return rc;
+}
+#endif // TEST_RTPS_TRCH_MAILBOX_POLL
+
 int test_rtps_trch_mailbox()
 {
 #define LSIO_RCV_IRQ_IDX  MBOX_LSIO__RTPS_RCV_INT
@@ -26,6 +186,9 @@ int test_rtps_trch_mailbox()
                     /* server */ 0, /* client */ MASTER_ID_RTPS_CPU0);
     if (!rtps_link)
         return 1;
+#if CONFIG_MBOX_MSG_LEN
+    mbox_link_set_msg_len(rtps_link, true); // TRCH, built with the same
+#endif // CONFIG_MBOX_MSG_LEN
 
     uint32_t arg[] = { CMD_PING, 42 };
     uint32_t reply[sizeof(arg) / sizeof(arg[0])] = {0};
@@ -36,6 +199,22 @@ int test_rtps_trch_mailbox()
     if (rc <= 0)
         return rc;
 
+    if (ping_bench(rtps_link))
+        return 1;
+
+#if TEST_RTPS_TRCH_MAILBOX_POLL
+    if (ping_bench_polled())
+        return 1;
+#endif // TEST_RTPS_TRCH_MAILBOX_POLL
+
+    if (shbuf_bench(rtps_link))
+        return 1;
+
+    if (pipeline_bench(rtps_link, 1) ||
+        pipeline_bench(rtps_link, CMD_MAX_INFLIGHT / 2) ||
+        pipeline_bench(rtps_link, CMD_MAX_INFLIGHT))
+        return 1;
+
     rc = rtps_link->disconnect(rtps_link);
     if (rc)
         return 1;
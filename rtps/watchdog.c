@@ -1,3 +1,4 @@
+#include "console.h"
 #include "printf.h"
 #include "panic.h"
 #include "gic.h"
@@ -11,7 +12,7 @@ static struct wdt **wdt_ptr;
 
 static void handle_timeout(struct wdt *wdt, unsigned stage, void *arg)
 {
-    printf("watchdog: expired\r\n");
+    printf_isr("watchdog: expired\r\n");
     // nothing to do: main loop will return from WFI/WFE and kick
 }
 
@@ -20,6 +20,7 @@
 
 #define CONFIG_BLOB_COPIES 0x3
 #define SHA256_CHECKSUM_SIZE 32
+#define LOAD_CHUNK_SIZE (1 << 12) /* multiple of word size */
 
 extern void relocate_code (uint32_t);
 extern void clean_and_jump (uint32_t, uint32_t);
@@ -79,6 +80,36 @@ static int load_memcpy(uint32_t *mem_addr, uint32_t *load_addr, unsigned size)
     return 0;
 }
 
+/*
+   Copy and hash in chunks, each chunk right after it is copied (while it is
+   still in the write buffer/cache, if any), instead of hashing the whole
+   image in a second pass after the copy.
+ */
+static int load_verify(uint32_t *mem_addr, uint32_t *load_addr, unsigned size,
+                       unsigned char *checksum)
+{
+#if CONFIG_BL0_VERIFY
+    mbedtls_sha256_context ctx;
+    unsigned char output[SHA256_CHECKSUM_SIZE];
+    unsigned off, sz;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, false);
+    for (off = 0; off < size; off += sz) {
+        sz = size - off;
+        if (sz > LOAD_CHUNK_SIZE)
+            sz = LOAD_CHUNK_SIZE;
+        load_memcpy(mem_addr + off / sizeof(uint32_t),
+                    load_addr + off / sizeof(uint32_t), sz);
+        mbedtls_sha256_update_ret(&ctx, (unsigned char *)load_addr + off, sz);
+    }
+    mbedtls_sha256_finish_ret(&ctx, output);
+    return diff_checksum(output, checksum);
+#else /* !CONFIG_BL0_VERIFY */
+    return load_memcpy(mem_addr, load_addr, size);
+#endif /* !CONFIG_BL0_VERIFY */
+}
+
 /* 
    Boot Select Code:
        bs[0]: 0: SRAM; 1: SPI
@@ -221,12 +252,13 @@ int main ( void )
             load_addr += config_blob.bl1_entry_offset;
             mem_addr = mem_base_addr + config_blob.bl1_offset; /* + vtbl_size; */
             printf("Load BL1 image (0x%x) to (0x%x), size(0x%x)\r\n", mem_addr, load_addr, config_blob.bl1_size);
-            load_memcpy((uint32_t *) mem_addr, (uint32_t *)load_addr, config_blob.bl1_size);
-   
-            /* checksum */   
-            unsigned char output[SHA256_CHECKSUM_SIZE];
-            mbedtls_sha256_ret((unsigned char *) load_addr, config_blob.bl1_size, output, false);
-            if (diff_checksum(output, config_blob.checksum)) {
+            cycle_counter_enable();
+            uint32_t start = cycle_counter_read();
+            int rc = load_verify((uint32_t *) mem_addr, (uint32_t *)load_addr,
+                                 config_blob.bl1_size, config_blob.checksum);
+            printf("Loaded BL1 in %u cycles (verification %s)\r\n",
+                   cycle_counter_read() - start, CONFIG_BL0_VERIFY ? "on" : "off");
+            if (rc) {
                 printf("Checksum Failure\r\n");
                 continue;
             }
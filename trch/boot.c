@@ -1,4 +1,6 @@
+#include "arm.h"
 #include "printf.h"
+#include "panic.h"
 #include "reset.h"
 #include "smc.h"
 #include "watchdog.h"
@@ -8,6 +10,32 @@
 
 #include "boot.h"
 
+#define MAX_BOOT_IMAGES 8
+
+struct boot_image {
+    const char *name;
+    const char *fallback; // if not NULL, image is optional
+    // Data that the subsystem does not modify in place: on reboot, a copy
+    // left from the previous boot is checked and reused if still intact.
+    // Code images are modified when they run, so are always reloaded.
+    bool lazy;
+};
+
+static const struct boot_image rtps_lockstep_images[] = {
+    { "rtps-bl",        NULL,                                        false },
+    { "rtps-os",        NULL,                                        false },
+};
+
+static const struct boot_image hpps_images[] = {
+    { "hpps-fw",        NULL,                                        false },
+    { "hpps-bl",        NULL,                                        false },
+    { "hpps-bl-dt",     "will fall back to compiled-in DT",          true },
+    { "hpps-bl-env",    "will fall back to compiled-in environment", true },
+    { "hpps-dt",        NULL,                                        false },
+    { "hpps-os",        NULL,                                        false },
+    { "hpps-initramfs", "booting without initramfs",                 true },
+};
+
 static subsys_t reboot_requests;
 
 // For legacy way to configure HPPS u-boot, until have u-boot env/script.
@@ -27,7 +55,87 @@ static int hpps_boot_mode(enum memdev rootfs_loc, volatile uint32_t *mode)
     return 0;
 }
 
-static int boot_load(subsys_t subsys, struct syscfg *cfg, struct memfs *fs)
+// A subsystem being booted: its loads proceed in the background (in
+// parallel with the loads of other subsystems, on as many DMA channels as
+// are available), and its reset is released as soon as all are reaped, if
+// all of the images that it requires loaded and verified.
+struct boot {
+    const struct boot_image *imgs;
+    unsigned count;
+    struct memfs_load *lds[MAX_BOOT_IMAGES]; // NULL once reaped
+    uint32_t start;
+    int rc;
+    bool active;
+};
+
+static struct boot boots[NUM_SUBSYSS];
+static uint32_t boot_start_cycles; // of the earliest boot still active
+
+static void load_failed(struct boot *b, unsigned i)
+{
+    if (b->imgs[i].fallback) {
+        printf("BOOT: %s not found in NV mem; %s\r\n",
+               b->imgs[i].name, b->imgs[i].fallback);
+    } else {
+        printf("BOOT: ERROR: failed to load %s\r\n", b->imgs[i].name);
+        b->rc = 1;
+    }
+}
+
+static void load_images(struct boot *b, struct memfs *fs,
+                        const struct boot_image *imgs, unsigned count)
+{
+    unsigned i;
+
+    ASSERT(count <= MAX_BOOT_IMAGES);
+    b->imgs = imgs;
+    b->count = count;
+    for (i = 0; i < count; ++i) {
+        b->lds[i] = imgs[i].lazy ? memfs_load_start_lazy(fs, imgs[i].name, NULL)
+                                 : memfs_load_start(fs, imgs[i].name, NULL);
+        if (!b->lds[i])
+            load_failed(b, i);
+    }
+}
+
+// Reap the loads that are complete. Returns true when none are left.
+static bool poll_images(struct boot *b)
+{
+    bool done = true;
+    unsigned i;
+
+    for (i = 0; i < b->count; ++i) {
+        if (!b->lds[i])
+            continue;
+        if (!memfs_load_poll(b->lds[i])) {
+            done = false;
+            continue;
+        }
+        if (memfs_load_wait(b->lds[i]))
+            load_failed(b, i);
+        b->lds[i] = NULL;
+    }
+    return done;
+}
+
+// True if the boot is waiting for DMA only. A boot with no loads left is
+// not blocked: it is ready to be finished.
+static bool images_blocked(struct boot *b)
+{
+    bool live = false;
+
+    for (unsigned i = 0; i < b->count; ++i) {
+        if (!b->lds[i])
+            continue;
+        if (!memfs_load_blocked(b->lds[i]))
+            return false;
+        live = true;
+    }
+    return live;
+}
+
+static int boot_load(subsys_t subsys, struct syscfg *cfg, struct memfs *fs,
+                     struct boot *b)
 {
     switch (subsys) {
         case SUBSYS_RTPS_R52:
@@ -43,10 +151,8 @@ static int boot_load(subsys_t subsys, struct syscfg *cfg, struct memfs *fs)
                     printf("TODO: NOT IMPLEMENTED: loading for SPLIT mode");
                     break;
                 case SYSCFG__RTPS_MODE__LOCKSTEP:
-                    if (memfs_load(fs, "rtps-bl", NULL))
-                        return 1;
-                    if (memfs_load(fs, "rtps-os", NULL))
-                        return 1;
+                    load_images(b, fs, rtps_lockstep_images,
+                            sizeof(rtps_lockstep_images) / sizeof(rtps_lockstep_images[0]));
                     break;
                 case SYSCFG__RTPS_MODE__SMP: // TODO
                     printf("TODO: NOT IMPLEMENTED: loading for SMP mode");
@@ -70,26 +176,8 @@ static int boot_load(subsys_t subsys, struct syscfg *cfg, struct memfs *fs)
                 return 0;
             }
 
-            if (memfs_load(fs, "hpps-fw", NULL))
-                return 1;
-            if (memfs_load(fs, "hpps-bl", NULL))
-                return 1;
-            if (memfs_load(fs, "hpps-bl-dt", NULL)) {
-                printf("BOOT: hpps-bl-dt not found in NV mem;"
-                       "will fall back to compiled-in DT");
-            }
-            if (memfs_load(fs, "hpps-bl-env", NULL)) {
-                printf("BOOT: hpps-bl-env not found in NV mem;"
-                       "will fall back to compiled-in environment");
-            }
-            if (memfs_load(fs, "hpps-dt", NULL))
-                return 1;
-            if (memfs_load(fs, "hpps-os", NULL))
-                return 1;
-            if (memfs_load(fs, "hpps-initramfs", NULL)) {
-                printf("BOOT: hpps-initramfs not found in NV mem;"
-                       "booting without initramfs");
-            }
+            load_images(b, fs, hpps_images,
+                        sizeof(hpps_images) / sizeof(hpps_images[0]));
             break;
         default:
             printf("BOOT: ERROR: unknown subsystem %x\r\n", subsys);
@@ -159,31 +247,90 @@ void boot_request(subsys_t subsys)
     // TODO: SEV (to prevent race between requests check and WFE in main loop)
 }
 
-bool boot_pending()
+static subsys_t active_boots()
 {
-    return !!reboot_requests;
+    subsys_t active = 0;
+    for (unsigned b = 0; b < NUM_SUBSYSS; ++b)
+        if (boots[b].active)
+            active |= 1 << b;
+    return active;
 }
 
-int boot_handle(subsys_t *subsys)
+// Boots proceed only in boot_poll, so there is work to do unless all active
+// boots are waiting for DMA, whose completion interrupt ends the WFI.
+bool boot_pending()
 {
-    int b = 0;
-    while (b < NUM_SUBSYSS && !(reboot_requests & (1 << b)))
-        b++;
-    if (b == NUM_SUBSYSS)
-        return 1;
-    *subsys = (subsys_t)(1 << b);
-    return 0;
+    unsigned b;
+
+    if (reboot_requests & ~active_boots())
+        return true;
+    for (b = 0; b < NUM_SUBSYSS; ++b)
+        if (boots[b].active && !images_blocked(&boots[b]))
+            return true;
+    return false;
 }
 
-int boot_reboot(subsys_t subsys, struct syscfg *cfg, struct memfs *fs)
+static void boot_start(subsys_t subsys, struct boot *b, struct syscfg *cfg,
+                       struct memfs *fs)
 {
-    int rc = 0;
     printf("BOOT: rebooting subsys %s...\r\n", subsys_name(subsys));
+    cycle_counter_enable();
+    if (!active_boots())
+        boot_start_cycles = cycle_counter_read();
+    reboot_requests &= ~subsys;
+    b->active = true;
+    b->start = cycle_counter_read();
+    b->count = 0;
+    b->rc = 0;
+    b->rc |= boot_load(subsys, cfg, fs, b);
+}
 
-    rc |= boot_load(subsys, cfg, fs);
-    rc |= boot_reset(subsys, cfg);
+static void boot_finish(subsys_t subsys, struct boot *b, struct syscfg *cfg,
+                        struct memfs *fs)
+{
+    uint32_t now = cycle_counter_read();
 
-    reboot_requests &= ~subsys;
-    printf("BOOT: rebooted subsys %s: rc %u\r\n", subsys_name(subsys), rc);
-   return rc;
+    if (b->count)
+        printf("BOOT: loaded %u images in %u cycles (verification %s), "
+               "%u directory reads from SRAM since mount\r\n",
+               b->count, now - b->start,
+               CONFIG_MEMFS_VERIFY ? "on" : "off", memfs_sram_reads(fs));
+    // Never start a core on an image that is missing or failed to verify:
+    // the subsystem stays in reset until the next reboot request
+    if (b->rc)
+        printf("BOOT: ERROR: subsys %s: images not loaded, not releasing "
+               "reset\r\n", subsys_name(subsys));
+    else
+        b->rc = boot_reset(subsys, cfg);
+    b->active = false;
+    printf("BOOT: rebooted subsys %s: rc %u\r\n", subsys_name(subsys), b->rc);
+    if (!active_boots())
+        printf("BOOT: all subsystems up %u cycles after the first request\r\n",
+               now - boot_start_cycles);
+}
+
+bool boot_poll(struct syscfg *cfg, struct memfs *fs)
+{
+    bool progress = false;
+    unsigned i;
+
+    for (i = 0; i < NUM_SUBSYSS; ++i) {
+        subsys_t subsys = (subsys_t)(1 << i);
+        struct boot *b = &boots[i];
+
+        if (b->active && poll_images(b)) {
+            boot_finish(subsys, b, cfg, fs);
+            progress = true;
+        }
+        // A request for a subsystem being booted waits for that boot to end
+        if (!b->active && (reboot_requests & subsys)) {
+            boot_start(subsys, b, cfg, fs);
+            // Nothing to wait for if no loads were started (bins not in
+            // SRAM, nothing to load for the mode, or every load failed)
+            if (poll_images(b))
+                boot_finish(subsys, b, cfg, fs);
+            progress = true;
+        }
+    }
+    return progress;
 }
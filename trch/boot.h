@@ -10,7 +10,12 @@ struct memfs;
 
 void boot_request(subsys_t subsys);
 bool boot_pending();
-int boot_handle(subsys_t *subsys);
-int boot_reboot(subsys_t subsys, struct syscfg *cfg, struct memfs *fs);
+
+// Non-blocking: starts loading the images of requested subsystems, reaps
+// the loads that have completed, and releases the reset of each subsystem
+// once all its images are loaded. Subsystems boot in parallel, while the
+// caller serves commands between calls. Returns true if a boot started or
+// ended.
+bool boot_poll(struct syscfg *cfg, struct memfs *fs);
 
 #endif // BOOT_H
@@ -8,7 +8,9 @@
 // Global because standalone test also needs to set it, but ISR is here
 struct dma *trch_dma;
 
-static uint8_t trch_dma_mcode[256]; // store in TRCH SRAM
+// Room for microcode of up to four channels (the driver uses as many
+// channels as fit), each with its own event IRQ
+static uint8_t trch_dma_mcode[512]; // store in TRCH SRAM
 
 struct dma *trch_dma_init()
 {
@@ -19,6 +21,9 @@ struct dma *trch_dma_init()
 
     nvic_int_enable(TRCH_IRQ__TRCH_DMA_ABORT);
     nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV0);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV1);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV2);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV3);
     return trch_dma;
 }
 
@@ -26,6 +31,9 @@ void trch_dma_deinit()
 {
     nvic_int_disable(TRCH_IRQ__TRCH_DMA_ABORT);
     nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV0);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV1);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV2);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV3);
 
     dma_destroy(trch_dma);
 }
@@ -38,3 +46,6 @@ void dma_trch_dma_abort_isr() {
 }
 
 DMA_EV_ISR(trch_dma, 0);
+DMA_EV_ISR(trch_dma, 1);
+DMA_EV_ISR(trch_dma, 2);
+DMA_EV_ISR(trch_dma, 3);
@@ -22,18 +22,23 @@
 #include "panic.h"
 #include "printf.h"
 #include "reset.h"
+#include "sched.h"
 #include "server.h"
+#include "shbuf.h"
 #include "shmem-link.h"
 #include "sleep.h"
 #include "smc.h"
 #include "systick.h"
 #include "test.h"
+#include "timerq.h"
 #include "watchdog.h"
 #include "syscfg.h"
 
 #define SYSTICK_INTERVAL_MS     500
 #define SYSTICK_INTERVAL_CYCLES (SYSTICK_INTERVAL_MS * (SYSTICK_CLK_HZ / 1000))
 #define MAIN_LOOP_SILENT_ITERS 16
+#define SCHED_KICK_INTERVAL_MS  100 // at most this often, within WDT timeout
+#define SCHED_STEP_MAX_MS       500 // well within the WDT timeout (2 stages of 1 s)
 
 // inferred CONFIG settings
 #define CONFIG_MBOX_DEV_HPPS (CONFIG_HPPS_TRCH_MAILBOX_SSW || CONFIG_HPPS_TRCH_MAILBOX || CONFIG_HPPS_TRCH_MAILBOX_ATF)
@@ -43,16 +48,50 @@ static struct syscfg syscfg;
 
 static struct llist link_list = { 0 };
 
+// Windows for payloads passed by reference, one per peer (see shbuf.h)
+#if CONFIG_HPPS_TRCH_MAILBOX || CONFIG_HPPS_TRCH_SHMEM
+static const struct shbuf_win hpps_app_shbuf = {
+    HPPS_DDR_ADDR__SHM__HPPS_SMP_APP__TRCH_SSW__BUF,
+    HPPS_DDR_SIZE__SHM__HPPS_SMP_APP__TRCH_SSW__BUF
+};
+#endif
+#if CONFIG_HPPS_TRCH_MAILBOX_SSW || CONFIG_HPPS_TRCH_SHMEM_SSW
+static const struct shbuf_win hpps_ssw_shbuf = {
+    HPPS_DDR_ADDR__SHM__HPPS_SMP_SSW__TRCH_SSW__BUF,
+    HPPS_DDR_SIZE__SHM__HPPS_SMP_SSW__TRCH_SSW__BUF
+};
+#endif
+#if CONFIG_RTPS_TRCH_MAILBOX || CONFIG_RTPS_TRCH_MAILBOX_POLL || CONFIG_RTPS_TRCH_SHMEM
+static const struct shbuf_win rtps_shbuf = {
+    RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF,
+    RTPS_DDR_SIZE__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW__BUF
+};
+#endif
+
 #if CONFIG_TRCH_WDT
 static bool trch_wdt_started = false;
 #endif // CONFIG_TRCH_WDT
 
+#if CONFIG_SLEEP_TIMER
+static const struct timerq_clock sys_clock = {
+    .freq = SYSTICK_CLK_HZ,
+    .now = systick_now,
+    .alarm = systick_alarm,
+};
+static struct timer sys_tick_timer; // a periodic timer in the timer queue
+
+static void sys_clock_isr(void *arg)
+{
+    timerq_isr();
+}
+#endif // CONFIG_SLEEP_TIMER
+
 #if CONFIG_SYSTICK
 static void systick_tick(void *arg)
 {
     DPRINTF("MAIN: sys tick\r\n");
 
-#if CONFIG_TRCH_WDT
+#if CONFIG_TRCH_WDT && !CONFIG_SCHED // the scheduler kicks (the tick wakes it)
     // Note: we kick here in the ISR instead of relying on the main loop
     // wakeing up from WFE as a result of ISR, because the main loop might not
     // be sleeping but might be performing a long operation, in which case it
@@ -60,13 +99,116 @@ static void systick_tick(void *arg)
     // time.
     if (trch_wdt_started)
         watchdog_kick(COMP_CPU_TRCH);
+#endif // CONFIG_TRCH_WDT && !CONFIG_SCHED
+}
+#endif // CONFIG_SYSTICK
+
+#if CONFIG_SCHED
+// Each step serves one command, so that the other tasks are not starved by a
+// burst of requests.
+static void cmd_task(void *arg)
+{
+    struct cmd cmd;
+    if (!cmd_dequeue(&cmd))
+        cmd_handle(&cmd);
+}
+
+static bool cmd_task_pending(void *arg)
+{
+    return cmd_pending();
+}
+
+static void boot_task(void *arg)
+{
+    boot_poll(&syscfg, (struct memfs *)arg);
+}
+
+static bool boot_task_pending(void *arg)
+{
+    return boot_pending();
+}
+
+static void console_task(void *arg)
+{
+    console_drain(); // lines logged by ISRs
+}
+
+static bool console_task_pending(void *arg)
+{
+    return console_pending();
+}
+
+// Receive on the links that have no interrupt: on every wakeup of the main
+// loop, and continuously if any is a polled mailbox link (which is served
+// only as long as it spins), at the lowest priority.
+static struct task *link_task;
+
+static void link_task_run(void *arg)
+{
+    struct cmd cmd;
+    struct link *link_curr;
+    int sz;
+
+    llist_iter_init(&link_list);
+    while ((link_curr = (struct link *)llist_iter_next(&link_list))) {
+        sz = link_curr->recv(link_curr, cmd.msg, sizeof(cmd.msg));
+        if (sz) {
+            cmd.link = link_curr;
+            if (cmd_enqueue(&cmd))
+                printf("%s: recv: queue full, will NAK\r\n", link_curr->name);
+        }
+    }
+#if CONFIG_RTPS_TRCH_MAILBOX_POLL
+    task_wake(link_task);
+#endif // CONFIG_RTPS_TRCH_MAILBOX_POLL
+}
+
+#if CONFIG_SCHED_STATS_MS
+static struct task *stats_task;
+static struct timer stats_timer;
+
+static void stats_tick(void *arg)
+{
+    task_wake(stats_task);
+}
+
+static void stats_task_run(void *arg)
+{
+    sched_print_stats();
+}
+#endif // CONFIG_SCHED_STATS_MS
+
+#if CONFIG_TRCH_WDT
+static void sched_kick(void *arg)
+{
+    watchdog_kick(COMP_CPU_TRCH);
+}
 #endif // CONFIG_TRCH_WDT
 
-#if CONFIG_SLEEP_TIMER
-    sleep_tick(SYSTICK_INTERVAL_CYCLES);
-#endif // CONFIG_SLEEP_TIMER
+static void sched_init(struct memfs *fs)
+{
+    if (!task_create("cmd", 0, cmd_task, cmd_task_pending, NULL))
+        panic("cmd task");
+    if (!task_create("boot", 1, boot_task, boot_task_pending, fs))
+        panic("boot task");
+    if (!task_create("console", 2, console_task, console_task_pending, NULL))
+        panic("console task");
+    link_task = task_create("link", 3, link_task_run, NULL, NULL);
+    if (!link_task)
+        panic("link task");
+#if CONFIG_SCHED_STATS_MS
+    stats_task = task_create("stats", 3, stats_task_run, NULL, NULL);
+    if (!stats_task)
+        panic("stats task");
+    timer_start(&stats_timer, timerq_ms(CONFIG_SCHED_STATS_MS),
+                timerq_ms(CONFIG_SCHED_STATS_MS), stats_tick, NULL);
+#endif // CONFIG_SCHED_STATS_MS
+#if CONFIG_TRCH_WDT
+    sched_supervise(sched_kick, NULL, SCHED_KICK_INTERVAL_MS,
+                    SCHED_STEP_MAX_MS);
+#endif // CONFIG_TRCH_WDT
 }
-#endif // CONFIG_SYSTICK
+#endif // CONFIG_SCHED
 
 int main ( void )
 {
@@ -78,6 +220,10 @@ int main ( void )
 
     nvic_init(TRCH_SCS_BASE);
 
+#if CONFIG_CONSOLE_BUFFERED
+    nvic_int_enable(TRCH_IRQ__LSIO_UART0_0); // output so far was buffered
+#endif // CONFIG_CONSOLE_BUFFERED
+
     sleep_set_busyloop_factor(TRCH_M4_BUSYLOOP_FACTOR);
 
 #if TEST_SYSTICK
@@ -86,14 +232,30 @@ int main ( void )
 #endif // TEST_SYSTICK
 
 #if CONFIG_SYSTICK
+#if CONFIG_SLEEP_TIMER
+    // Tickless: SysTick is programmed for the next deadline in the timer
+    // queue, of which the tick is only one.
+    systick_config_tickless(sys_clock_isr, NULL);
+    timerq_init(&sys_clock);
+    systick_enable();
+    timer_start(&sys_tick_timer, SYSTICK_INTERVAL_CYCLES,
+                SYSTICK_INTERVAL_CYCLES, systick_tick, NULL);
+#else // !CONFIG_SLEEP_TIMER
     systick_config(SYSTICK_INTERVAL_CYCLES, systick_tick, NULL);
     systick_enable();
-
-#if CONFIG_SLEEP_TIMER
-    sleep_set_clock(SYSTICK_CLK_HZ);
-#endif // CONFIG_SLEEP_TIMER
+#endif // !CONFIG_SLEEP_TIMER
 #endif // CONFIG_SYSTICK
 
+#if TEST_TIMERQ
+    if (test_timerq())
+        panic("TRCH timer queue test");
+#endif // TEST_TIMERQ
+
+#if TEST_SCHED
+    if (test_sched())
+        panic("TRCH scheduler test");
+#endif // TEST_SCHED
+
 #if TEST_ETIMER
     if (test_etimer())
         panic("Elapsed Timer test");
@@ -119,11 +281,46 @@ int main ( void )
         panic("TRCH DMA test");
 #endif // TEST_TRCH_DMA
 
+#if TEST_TRCH_DMA_PERIPH
+    if (test_trch_dma_periph())
+        panic("TRCH DMA peripheral test");
+#endif // TEST_TRCH_DMA_PERIPH
+
+#if TEST_SHA256
+    if (test_sha256())
+        panic("SHA-256 test");
+#endif // TEST_SHA256
+
+#if TEST_ECC
+    if (test_ecc())
+        panic("ECC test");
+#endif // TEST_ECC
+
+#if TEST_MEMFS_LZ4
+    if (test_memfs_lz4())
+        panic("memfs LZ4 test");
+#endif // TEST_MEMFS_LZ4
+
+#if TEST_CMDQ
+    if (test_cmdq())
+        panic("CMDQ test");
+#endif // TEST_CMDQ
+
 #if TEST_SHMEM
     if (test_shmem())
         panic("shmem test");
 #endif // TEST_SHMEM
 
+#if TEST_MBOX_ISR
+    if (test_mbox_isr())
+        panic("MBOX ISR test");
+#endif // TEST_MBOX_ISR
+
+#if TEST_MBOX_MMIO
+    if (test_mbox_mmio())
+        panic("MBOX MMIO test");
+#endif // TEST_MBOX_MMIO
+
 #if CONFIG_TRCH_DMA
     struct dma *trch_dma = trch_dma_init();
     if (!trch_dma)
@@ -198,6 +395,7 @@ int main ( void )
         /* client */ MASTER_ID_HPPS_CPU0);
     if (!hpps_link_ssw)
         panic("HPPS_MBOX_SSW_LINK");
+    hpps_link_ssw->shbuf = &hpps_ssw_shbuf;
     // Never release the link, because we listen on it in main loop
 #endif // CONFIG_HPPS_TRCH_MAILBOX_SSW
 
@@ -210,6 +408,7 @@ int main ( void )
         /* client */ MASTER_ID_HPPS_CPU0);
     if (!hpps_link)
         panic("HPPS_MBOX_LINK");
+    hpps_link->shbuf = &hpps_app_shbuf;
     // Never release the link, because we listen on it in main loop
 #endif // CONFIG_HPPS_TRCH_MAILBOX
 
@@ -234,6 +433,10 @@ int main ( void )
         /* client */ MASTER_ID_RTPS_CPU0);
     if (!rtps_link)
         panic("RTPS_MBOX_LINK");
+#if CONFIG_MBOX_MSG_LEN
+    mbox_link_set_msg_len(rtps_link, true); // RTPS SSW, built with the same
+#endif // CONFIG_MBOX_MSG_LEN
+    rtps_link->shbuf = &rtps_shbuf;
     // Never disconnect the link, because we listen on it in main loop
 #endif // CONFIG_RTPS_TRCH_MAILBOX
 
@@ -251,12 +454,38 @@ int main ( void )
 
     llist_init(&link_list);
 
+#if CONFIG_RTPS_TRCH_MAILBOX_POLL
+    struct mbox_link_dev mldev_lsio_poll;
+    mldev_lsio_poll.base = MBOX_LSIO__BASE;
+    mldev_lsio_poll.rcv_irq = NULL; // polled, from the main loop
+    mldev_lsio_poll.rcv_int_idx = 0;
+    mldev_lsio_poll.ack_irq = NULL;
+    mldev_lsio_poll.ack_int_idx = 0;
+
+    struct link *rtps_link_poll = mbox_link_connect("RTPS_MBOX_POLL_LINK",
+        &mldev_lsio_poll,
+        LSIO_MBOX0_CHAN__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW_POLL,
+        LSIO_MBOX0_CHAN__TRCH_SSW__RTPS_R52_LOCKSTEP_SSW_POLL,
+        /* server */ MASTER_ID_TRCH_CPU,
+        /* client */ MASTER_ID_RTPS_CPU0);
+    if (!rtps_link_poll)
+        panic("RTPS_MBOX_POLL_LINK");
+#if CONFIG_MBOX_MSG_LEN
+    mbox_link_set_msg_len(rtps_link_poll, true);
+#endif // CONFIG_MBOX_MSG_LEN
+    rtps_link_poll->shbuf = &rtps_shbuf;
+    if (llist_insert(&link_list, rtps_link_poll))
+        panic("RTPS_MBOX_POLL_LINK: llist_insert");
+    // Never disconnect the link, because we listen on it in main loop
+#endif // CONFIG_RTPS_TRCH_MAILBOX_POLL
+
 #if CONFIG_RTPS_TRCH_SHMEM
     struct link *rtps_link_shmem = shmem_link_connect("RTPS_SHMEM_LINK",
         RTPS_DDR_ADDR__SHM__TRCH_SSW__RTPS_R52_LOCKSTEP_SSW,
         RTPS_DDR_ADDR__SHM__RTPS_R52_LOCKSTEP_SSW__TRCH_SSW);
     if (!rtps_link_shmem)
         panic("RTMS_SHMEM_LINK");
+    rtps_link_shmem->shbuf = &rtps_shbuf;
     if (llist_insert(&link_list, rtps_link_shmem))
         panic("RTMS_SHMEM_LINK: llist_insert");
     // Never disconnect the link, because we listen on it in main loop
@@ -268,6 +497,7 @@ int main ( void )
         HPPS_DDR_ADDR__SHM__TRCH_SSW__HPPS_SMP_APP);
     if (!hpps_link_shmem)
         panic("HPPS_SHMEM_LINK");
+    hpps_link_shmem->shbuf = &hpps_app_shbuf;
     if (llist_insert(&link_list, hpps_link_shmem))
         panic("HPPS_SHMEM_LINK: llist_insert");
     // Never disconnect the link, because we listen on it in main loop
@@ -279,6 +509,7 @@ int main ( void )
         HPPS_DDR_ADDR__SHM__TRCH_SSW__HPPS_SMP_SSW);
     if (!hpps_link_shmem_ssw)
         panic("HPPS_SHMEM_SSW_LINK");
+    hpps_link_shmem_ssw->shbuf = &hpps_ssw_shbuf;
     if (llist_insert(&link_list, hpps_link_shmem_ssw))
         panic("HPPS_SHMEM_SSW_LINK: llist_insert");
     // Never disconnect the link, because we listen on it in main loop
@@ -304,6 +535,10 @@ int main ( void )
 
     cmd_handler_register(server_process);
 
+#if CONFIG_SCHED
+    sched_init(trch_fs);
+#endif // CONFIG_SCHED
+
     unsigned iter = 0;
 #if TEST_R52_SMP
     bool r52_1_init = false;
@@ -326,11 +561,16 @@ int main ( void )
 
         //printf("main\r\n");
 
-        subsys_t subsys;
-        while (!boot_handle(&subsys)) {
-            boot_reboot(subsys, &syscfg, trch_fs);
+        bool idle;
+#if CONFIG_SCHED
+        task_wake(link_task);
+        sched_run();
+
+        int_disable(); // the check and the WFI must be atomic
+        idle = !sched_pending();
+#else // !CONFIG_SCHED
+        if (boot_poll(&syscfg, trch_fs))
             verbose = true; // to end log with 'waiting' msg
-        }
 
         struct cmd cmd;
         struct link *link_curr;
@@ -342,19 +582,24 @@ int main ( void )
                 break;
             sz = link_curr->recv(link_curr, cmd.msg, sizeof(cmd.msg));
             if (sz) {
-                printf("%s: recv: got message\r\n", link_curr->name);
                 cmd.link = link_curr;
                 if (cmd_enqueue(&cmd))
-                    panic("TRCH: failed to enqueue command");
+                    printf("%s: recv: queue full, will NAK\r\n",
+                           link_curr->name);
             }
         } while (1);
-        while (!cmd_dequeue(&cmd)) {
+        // Silently: logging here would add to the round trip of each request
+        while (!cmd_dequeue(&cmd))
             cmd_handle(&cmd);
-            verbose = true; // to end log with 'waiting' msg
-        }
+
+        console_drain(); // lines logged by ISRs
 
         int_disable(); // the check and the WFI must be atomic
-        if (!cmd_pending() && !boot_pending()) {
+        // A polled link is served only as long as the main loop spins
+        idle = !cmd_pending() && !boot_pending() && !console_pending() &&
+               !CONFIG_RTPS_TRCH_MAILBOX_POLL;
+#endif // !CONFIG_SCHED
+        if (idle) {
             if (verbose)
                 printf("[%u] Waiting for interrupt...\r\n", iter);
             asm("wfi"); // ignores PRIMASK set by int_disable
@@ -9,10 +9,14 @@
 #include "panic.h"
 #include "printf.h"
 #include "server.h"
+#include "shbuf.h"
 #include "pm_defs.h"
 #include "psci.h"
 
 #define MAX_MBOX_LINKS          8
+// Only the end of a long log is printed: output to the UART is slow (~11 KB/s
+// at 115200 baud), and a buffered console drops what does not fit its buffer
+#define LOG_PRINT_MAX           1024
 
 static struct link *links[MAX_MBOX_LINKS] = {0};
 
@@ -32,6 +36,56 @@ static void linkp_free(int index)
      links[index] = NULL;
 }
 
+static void print_log(const char *src, const char *text, size_t len)
+{
+    char line[CMD_MSG_SZ + 1];
+    size_t n;
+
+    if (len > LOG_PRINT_MAX) {
+        printf("[log from %s: %u bytes, last %u follow]\r\n", src,
+               (unsigned)len, LOG_PRINT_MAX);
+        text += len - LOG_PRINT_MAX;
+        len = LOG_PRINT_MAX;
+    }
+    while (len) {
+        for (n = 0; n < len && n < sizeof(line) - 1; ++n)
+            line[n] = text[n];
+        line[n] = '\0';
+        printf("%s", line);
+        text += n;
+        len -= n;
+    }
+    printf("\r\n[end of log from %s]\r\n", src);
+}
+
+static uint32_t handle_buf(struct cmd *cmd)
+{
+    struct cmd_buf *pl =
+        (struct cmd_buf *)(&cmd->msg[CMD_MSG_PAYLOAD_OFFSET]);
+    void *buf = shbuf_get(cmd->link->shbuf, pl->offset, pl->len);
+
+    if (!buf) {
+        printf("BUF: %s: [0x%x, +0x%x) not in the shared window\r\n",
+               cmd->link->name, pl->offset, pl->len);
+        return CMD_BUF_STATUS_RANGE;
+    }
+    if (shbuf_checksum(buf, pl->len) != pl->checksum) {
+        printf("BUF: %s: checksum mismatch\r\n", cmd->link->name);
+        return CMD_BUF_STATUS_CHECKSUM;
+    }
+    switch (pl->type) {
+        case CMD_BUF_TYPE_DATA:
+            return CMD_BUF_STATUS_OK;
+        case CMD_BUF_TYPE_LOG:
+            print_log(cmd->link->name, buf, pl->len);
+            return CMD_BUF_STATUS_OK;
+        default:
+            printf("BUF: %s: unknown type: %u\r\n", cmd->link->name,
+                   pl->type);
+            return CMD_BUF_STATUS_TYPE;
+    }
+}
+
 int server_process(struct cmd *cmd, void *reply, size_t reply_sz)
 {
     size_t i;
@@ -43,8 +97,7 @@ int server_process(struct cmd *cmd, void *reply, size_t reply_sz)
             printf("NOP ...\r\n");
             // do nothing and reply nothing command
             return 0;
-        case CMD_PING:
-            printf("PING ...\r\n");
+        case CMD_PING: // on the latency benchmark path: no printing
             reply_u8[0] = CMD_PONG;
             for (i = 1; i < CMD_MSG_PAYLOAD_OFFSET && i < reply_sz; i++)
                 reply_u8[i] = 0;
@@ -64,6 +117,13 @@ int server_process(struct cmd *cmd, void *reply, size_t reply_sz)
             printf("\r\n");
             return handle_psci(cmd, reply);
         }
+        case CMD_BUF: { // on the throughput benchmark path: no printing
+            struct cmd_buf_ack *ack =
+                (struct cmd_buf_ack *)&reply_u8[CMD_MSG_PAYLOAD_OFFSET];
+            ack->status = handle_buf(cmd);
+            reply_u8[0] = CMD_BUF_ACK;
+            return CMD_MSG_PAYLOAD_OFFSET + sizeof(*ack);
+        }
         case CMD_WATCHDOG_TIMEOUT: {
             unsigned int cpu =
                 *((unsigned int *)(&cmd->msg[CMD_MSG_PAYLOAD_OFFSET]));
@@ -154,8 +214,8 @@ int server_process(struct cmd *cmd, void *reply, size_t reply_sz)
             printf("request: cmd %x arg %x..\r\n",
                    msg[0], msg[CMD_MSG_PAYLOAD_OFFSET]);
             rc = link->request(link,
-                               CMD_TIMEOUT_MS_SEND, msg, sizeof(msg),
-                               CMD_TIMEOUT_MS_RECV, reqr, sizeof(reqr));
+                               CMD_TIMEOUT_MS_SERVE_SEND, msg, sizeof(msg),
+                               CMD_TIMEOUT_MS_SERVE_RECV, reqr, sizeof(reqr));
             if (rc <= 0) {
                 reply_u8[0] = -2;
                 return 1;
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "printf.h"
+#include "command.h"
+#include "link.h"
+#include "test.h"
+
+// Stress of the per-link command queues: random bursts of requests on
+// several links (more than fit, as when HPPS sends a burst of PSCI
+// requests), drained in random amounts. Every request must come out of the
+// queue of its link in order, exactly once, or be counted in a NAK that
+// comes out after the requests that were queued before it.
+
+#define CMDQ_LINKS      3
+#define CMDQ_ROUNDS     20000
+#define REF_LEN         (4 * CONFIG_CMD_QUEUE_LEN) // > queued and dropped
+
+struct ref {
+    uint32_t seq[REF_LEN]; // accepted requests, in order
+    unsigned head, tail;
+    uint32_t next_seq;
+    unsigned dropped; // since the last NAK
+    unsigned dropped_total;
+    unsigned naks_total;
+    uint32_t nak_pos; // accepted requests before the last drop
+};
+
+static struct link cmdq_links[CMDQ_LINKS];
+static struct ref refs[CMDQ_LINKS];
+static const char *cmdq_link_names[CMDQ_LINKS] = { "L0", "L1", "L2" };
+static uint8_t last_reply[CMD_MSG_SZ];
+
+static uint32_t rand_state = 1;
+static unsigned rnd(unsigned n)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 16) % n;
+}
+
+static int fake_send(struct link *link, int timeout_ms, void *buf, size_t sz)
+{
+    for (unsigned i = 0; i < CMD_MSG_SZ; ++i)
+        last_reply[i] = ((uint8_t *)buf)[i];
+    return sz;
+}
+
+static void produce(unsigned l)
+{
+    struct ref *r = &refs[l];
+    struct cmd cmd;
+    uint32_t *pl = (uint32_t *)&cmd.msg[CMD_MSG_PAYLOAD_OFFSET];
+    unsigned i;
+
+    cmd.link = &cmdq_links[l];
+    cmd.msg[0] = CMD_PSCI;
+    for (i = 0; i < CMD_MSG_PAYLOAD_SIZE / sizeof(uint32_t); ++i)
+        pl[i] = r->next_seq ^ i;
+    if (cmd_enqueue(&cmd)) {
+        r->nak_pos = r->head; // the NAK is due after the accepted ones
+        r->dropped++;
+        r->dropped_total++;
+    } else {
+        r->seq[r->head++ % REF_LEN] = r->next_seq;
+    }
+    r->next_seq++;
+}
+
+static int consume()
+{
+    struct cmd cmd;
+    uint32_t *pl = (uint32_t *)&cmd.msg[CMD_MSG_PAYLOAD_OFFSET];
+    struct ref *r;
+    unsigned l, i;
+
+    if (cmd_dequeue(&cmd))
+        return 1;
+    l = cmd.link - cmdq_links;
+    if (l >= CMDQ_LINKS) {
+        printf("CMDQ test: dequeued a command for an unknown link\r\n");
+        return -1;
+    }
+    r = &refs[l];
+
+    if (cmd.msg[0] == CMD_NAK) {
+        struct cmd_nak *nak = (struct cmd_nak *)pl;
+        if (!r->dropped || r->tail != r->nak_pos ||
+                nak->count != r->dropped || nak->cmd != CMD_PSCI) {
+            printf("CMDQ test: %s: unexpected NAK: count %u, expected %u\r\n",
+                   cmdq_link_names[l], nak->count, r->dropped);
+            return -1;
+        }
+        cmd_handle(&cmd); // replied to as is
+        if (last_reply[0] != CMD_NAK) {
+            printf("CMDQ test: NAK not sent as the reply\r\n");
+            return -1;
+        }
+        r->naks_total += r->dropped;
+        r->dropped = 0;
+        return 0;
+    }
+
+    if (r->tail == r->head || (r->dropped && r->tail == r->nak_pos)) {
+        printf("CMDQ test: %s: request dequeued out of order\r\n",
+               cmdq_link_names[l]);
+        return -1;
+    }
+    for (i = 0; i < CMD_MSG_PAYLOAD_SIZE / sizeof(uint32_t); ++i) {
+        if (pl[i] != (r->seq[r->tail % REF_LEN] ^ i)) {
+            printf("CMDQ test: %s: request %u: corrupted or out of order\r\n",
+                   cmdq_link_names[l], r->seq[r->tail % REF_LEN]);
+            return -1;
+        }
+    }
+    r->tail++;
+    return 0;
+}
+
+int test_cmdq()
+{
+    unsigned round, n, l;
+    int rc = 1, crc = 0;
+
+    for (l = 0; l < CMDQ_LINKS; ++l) {
+        cmdq_links[l].name = cmdq_link_names[l];
+        cmdq_links[l].send = fake_send;
+        if (cmd_queue_open(&cmdq_links[l])) {
+            printf("CMDQ test: failed to open queue\r\n");
+            goto out;
+        }
+    }
+
+    for (round = 0; round < CMDQ_ROUNDS; ++round) {
+        for (n = rnd(2 * CONFIG_CMD_QUEUE_LEN); n; --n)
+            produce(rnd(CMDQ_LINKS));
+        crc = 0;
+        for (n = rnd(2 * CONFIG_CMD_QUEUE_LEN); n; --n)
+            if ((crc = consume()))
+                break;
+        if (crc < 0)
+            goto out;
+    }
+    while (!(crc = consume()))
+        ;
+    if (crc < 0)
+        goto out;
+    if (cmd_pending()) {
+        printf("CMDQ test: commands pending after draining\r\n");
+        goto out;
+    }
+
+    for (l = 0; l < CMDQ_LINKS; ++l) {
+        struct ref *r = &refs[l];
+        printf("CMDQ test: %s: %u requests, %u dropped and NAK'ed\r\n",
+               cmdq_link_names[l], r->next_seq, r->dropped_total);
+        if (r->head != r->tail || r->naks_total != r->dropped_total) {
+            printf("CMDQ test: %s: lost requests\r\n", cmdq_link_names[l]);
+            goto out;
+        }
+    }
+    rc = 0;
+out:
+    for (l = 0; l < CMDQ_LINKS; ++l)
+        cmd_queue_close(&cmdq_links[l]);
+    return rc;
+}
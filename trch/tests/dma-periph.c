@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "printf.h"
+#include "mem.h"
+#include "dma.h"
+#include "test.h"
+
+// Register-level fake of a PL330: the driver programs an array in memory
+// instead of the device, and the test executes the microcode that the driver
+// launched via the debug instruction registers. The test also plays the part
+// of the peripheral, which checks the request handshake: each LDP/STP must
+// follow a WFP for the peripheral and be followed by a FLUSHP.
+
+#define FAKE_NUM_PERI   4
+#define FAKE_PERI       2
+
+#define REG_DBGINST0    0xd08
+#define REG_DBGINST1    0xd0c
+#define REG_CR0         0xe00
+#define REG_PERIPH_ID2  0xfe8
+
+#define CMD_END         0x00
+#define CMD_LD          0x04 // | cond
+#define CMD_ST          0x08 // | cond
+#define CMD_RMB         0x12
+#define CMD_WMB         0x13
+#define CMD_LP          0x20 // | loop << 1
+#define CMD_LDP         0x25 // | burst << 1
+#define CMD_LPEND       0x28 // | !forever << 4 | loop << 2 | cond
+#define CMD_STP         0x29 // | burst << 1
+#define CMD_WFP         0x30 // | burst << 1 | periph
+#define CMD_SEV         0x34
+#define CMD_FLUSHP      0x35
+#define CMD_MOV         0xbc
+
+enum req_type { REQ_NONE, REQ_SINGLE, REQ_BURST };
+
+static uint32_t fake_regs[0x1000 / sizeof(uint32_t)];
+static uint8_t fake_mcode[128]; // one channel
+
+// The peripheral's data register, and what went through it
+static volatile uint32_t fake_fifo;
+static uint8_t periph_data[128];
+static unsigned periph_pos;
+static unsigned periph_reqs;
+
+static uint8_t mem_buf[128] __attribute__((aligned(8)));
+
+struct fake_thread {
+    uint32_t sar, dar, ccr;
+    unsigned lc[2];
+    enum req_type req;
+    bool acked;
+    uint8_t mfifo[16 * 8];
+    unsigned mfifo_len;
+    int ev;
+};
+
+static bool cond_ok(struct fake_thread *t, uint8_t op)
+{
+    if (!(op & 0x1))
+        return true; // always
+    return (op & 0x2) ? t->req == REQ_BURST : t->req == REQ_SINGLE;
+}
+
+static uint8_t periph_read(uint32_t addr, unsigned i)
+{
+    if (addr == (uint32_t)&fake_fifo)
+        return periph_data[periph_pos++];
+    return ((uint8_t *)addr)[i];
+}
+
+static void periph_write(uint32_t addr, unsigned i, uint8_t b)
+{
+    if (addr == (uint32_t)&fake_fifo)
+        periph_data[periph_pos++] = b;
+    else
+        ((uint8_t *)addr)[i] = b;
+}
+
+static void load(struct fake_thread *t)
+{
+    unsigned beat = 1 << ((t->ccr >> 1) & 0x7);
+    unsigned len = ((t->ccr >> 4) & 0xf) + 1;
+    for (unsigned b = 0; b < len; ++b) {
+        for (unsigned i = 0; i < beat; ++i)
+            t->mfifo[t->mfifo_len++] = periph_read(t->sar, i);
+        if (t->ccr & (1 << 0))
+            t->sar += beat;
+    }
+}
+
+static void store(struct fake_thread *t)
+{
+    unsigned beat = 1 << ((t->ccr >> 15) & 0x7);
+    unsigned len = ((t->ccr >> 18) & 0xf) + 1;
+    unsigned pos = 0;
+    for (unsigned b = 0; b < len; ++b) {
+        for (unsigned i = 0; i < beat; ++i)
+            periph_write(t->dar, i, t->mfifo[pos++]);
+        if (t->ccr & (1 << 14))
+            t->dar += beat;
+    }
+    t->mfifo_len = 0;
+}
+
+static bool periph_acc(struct fake_thread *t, uint8_t op, uint8_t arg)
+{
+    if ((arg >> 3) != FAKE_PERI || t->req == REQ_NONE || t->acked) {
+        printf("DMA periph test: %s %u without request\r\n",
+               (op & ~0x2) == CMD_LDP ? "LDP" : "STP", arg >> 3);
+        return false;
+    }
+    t->acked = true;
+    return true;
+}
+
+// Returns 0 on END, or non-zero on a handshake violation or bad instruction
+static int run(struct fake_thread *t, uint8_t *pc)
+{
+    unsigned steps = 0;
+
+    while (steps++ < 100000) {
+        uint8_t op = pc[0];
+        if (op == CMD_MOV) {
+            uint32_t v = pc[2] | (pc[3] << 8) | (pc[4] << 16) | (pc[5] << 24);
+            if (pc[1] == 0)
+                t->sar = v;
+            else if (pc[1] == 1)
+                t->ccr = v;
+            else
+                t->dar = v;
+            pc += 6;
+        } else if ((op & ~0x2) == CMD_LP) {
+            t->lc[(op >> 1) & 0x1] = pc[1];
+            pc += 2;
+        } else if ((op & ~0x7) == (CMD_LPEND | (1 << 4))) {
+            unsigned *lc = &t->lc[(op >> 2) & 0x1];
+            if (*lc) {
+                (*lc)--;
+                pc -= pc[1];
+            } else {
+                pc += 2;
+            }
+        } else if ((op & ~0x3) == CMD_LD) {
+            if (cond_ok(t, op))
+                load(t);
+            pc += 1;
+        } else if ((op & ~0x3) == CMD_ST) {
+            if (cond_ok(t, op))
+                store(t);
+            pc += 1;
+        } else if ((op & ~0x2) == CMD_LDP) {
+            if (!periph_acc(t, op, pc[1]))
+                return 1;
+            if (cond_ok(t, op | 0x1))
+                load(t);
+            pc += 2;
+        } else if ((op & ~0x2) == CMD_STP) {
+            if (!periph_acc(t, op, pc[1]))
+                return 1;
+            if (cond_ok(t, op | 0x1))
+                store(t);
+            pc += 2;
+        } else if ((op & ~0x3) == CMD_WFP) {
+            if ((pc[1] >> 3) != FAKE_PERI || t->req != REQ_NONE) {
+                printf("DMA periph test: WFP %u with request pending\r\n",
+                       pc[1] >> 3);
+                return 1;
+            }
+            // the peripheral is always ready: request what was waited for
+            t->req = (op & 0x2) ? REQ_BURST : REQ_SINGLE;
+            t->acked = false;
+            periph_reqs++;
+            pc += 2;
+        } else if (op == CMD_FLUSHP) {
+            if ((pc[1] >> 3) != FAKE_PERI || !t->acked) {
+                printf("DMA periph test: FLUSHP %u before LDP/STP\r\n",
+                       pc[1] >> 3);
+                return 1;
+            }
+            t->req = REQ_NONE;
+            pc += 2;
+        } else if (op == CMD_SEV) {
+            t->ev = pc[1] >> 3;
+            pc += 2;
+        } else if (op == CMD_RMB || op == CMD_WMB) {
+            pc += 1;
+        } else if (op == CMD_END) {
+            if (t->req != REQ_NONE) {
+                printf("DMA periph test: END with request not flushed\r\n");
+                return 1;
+            }
+            return 0;
+        } else {
+            printf("DMA periph test: unexpected instruction %02x\r\n", op);
+            return 1;
+        }
+    }
+    printf("DMA periph test: program did not terminate\r\n");
+    return 1;
+}
+
+// Execute the programs launched by the driver, chained by the event ISR
+static int execute(struct dma *dma, struct dma_tx *tx)
+{
+    struct fake_thread t;
+
+    while (fake_regs[REG_DBGINST1 / 4]) {
+        uint8_t *pc = (uint8_t *)fake_regs[REG_DBGINST1 / 4];
+        fake_regs[REG_DBGINST1 / 4] = 0;
+        t.ccr = 0;
+        t.req = REQ_NONE;
+        t.mfifo_len = 0;
+        t.ev = -1;
+        if (run(&t, pc))
+            return 1;
+        if (t.ev < 0) {
+            printf("DMA periph test: no event signaled at END\r\n");
+            return 1;
+        }
+        dma_event_isr(dma, t.ev);
+    }
+    return dma_wait(tx);
+}
+
+static int test_to_periph(struct dma *dma)
+{
+    struct dma_periph periph;
+    unsigned i;
+
+    periph.fifo = &fake_fifo;
+    periph.peri = FAKE_PERI;
+    periph.width_bits = 0; // byte register, like a UART THR
+    periph.burst = 1;
+
+    for (i = 0; i < sizeof(mem_buf); ++i)
+        mem_buf[i] = i ^ 0x5a;
+    periph_pos = 0;
+    periph_reqs = 0;
+
+    struct dma_tx *tx = dma_transfer_to_periph(dma, /* chan */ 0, &periph,
+            mem_buf, sizeof(mem_buf), NULL, NULL);
+    if (!tx || execute(dma, tx))
+        return 1;
+
+    if (periph_reqs != sizeof(mem_buf) || periph_pos != sizeof(mem_buf)) {
+        printf("DMA periph test: to periph: reqs %u bytes %u, expected %u\r\n",
+               periph_reqs, periph_pos, sizeof(mem_buf));
+        return 1;
+    }
+    for (i = 0; i < sizeof(mem_buf); ++i) {
+        if (periph_data[i] != mem_buf[i]) {
+            printf("DMA periph test: to periph: data mismatch at %u\r\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_from_periph(struct dma *dma)
+{
+    struct dma_periph periph;
+    unsigned i;
+
+    periph.fifo = &fake_fifo;
+    periph.peri = FAKE_PERI;
+    periph.width_bits = 2; // 32-bit register
+    periph.burst = 4;
+
+    for (i = 0; i < sizeof(periph_data); ++i)
+        periph_data[i] = i ^ 0xa5;
+    bzero(mem_buf, sizeof(mem_buf));
+    periph_pos = 0;
+    periph_reqs = 0;
+
+    // Not a multiple of the burst
+    if (dma_transfer_from_periph(dma, /* chan */ 0, &periph,
+            mem_buf, 4 * 4 + 4, NULL, NULL)) {
+        printf("DMA periph test: partial burst not rejected\r\n");
+        return 1;
+    }
+
+    struct dma_tx *tx = dma_transfer_from_periph(dma, /* chan */ 0, &periph,
+            mem_buf, sizeof(mem_buf), NULL, NULL);
+    if (!tx || execute(dma, tx))
+        return 1;
+
+    if (periph_reqs != sizeof(mem_buf) / (4 * 4)) {
+        printf("DMA periph test: from periph: reqs %u, expected %u\r\n",
+               periph_reqs, sizeof(mem_buf) / (4 * 4));
+        return 1;
+    }
+    for (i = 0; i < sizeof(mem_buf); ++i) {
+        if (mem_buf[i] != periph_data[i]) {
+            printf("DMA periph test: from periph: data mismatch at %u\r\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int test_trch_dma_periph()
+{
+    int rc = 1;
+
+    bzero(fake_regs, sizeof(fake_regs));
+    fake_regs[REG_CR0 / 4] = (1 << 0) /* periph req */ |
+                             ((FAKE_NUM_PERI - 1) << 12) |
+                             (0 << 4) /* 1 chan */ | (0 << 17) /* 1 event */;
+    fake_regs[REG_PERIPH_ID2 / 4] = 1 << 4; // r1p0
+
+    struct dma *dma = dma_create("FAKE", (uintptr_t)fake_regs,
+                                 fake_mcode, sizeof(fake_mcode));
+    if (!dma)
+        return 1;
+
+    if (test_to_periph(dma))
+        goto out;
+    if (test_from_periph(dma))
+        goto out;
+    rc = 0;
+out:
+    dma_destroy(dma);
+    return rc;
+}
@@ -1,7 +1,9 @@
 #include <stdbool.h>
 
 #include "printf.h"
+#include "arm.h"
 #include "panic.h"
+#include "mem.h"
 #include "dma.h"
 #include "hwinfo.h"
 #include "nvic.h"
@@ -10,10 +12,17 @@
 // We can't own it, because the ISR (which we can't own) needs to access it
 extern struct dma *trch_dma;
 
-static uint8_t trch_dma_mcode[256]; // store in TRCH SRAM
+static uint8_t trch_dma_mcode[512]; // store in TRCH SRAM, room for 4 channels
 
-static uint32_t dma_src_buf[128] __attribute__((aligned(DMA_MAX_BURST_BYTES)));
-static uint32_t dma_dst_buf[128] __attribute__((aligned(DMA_MAX_BURST_BYTES)));
+static uint32_t dma_src_buf[256] __attribute__((aligned(DMA_MAX_BURST_BYTES)));
+static uint32_t dma_dst_buf[256] __attribute__((aligned(DMA_MAX_BURST_BYTES)));
+
+#define DMA_BUF_WORDS (sizeof(dma_src_buf) / sizeof(dma_src_buf[0]))
+#define DMA_SEGS 4 // more than fit in one program, so exercises chaining
+#define DMA_SEG_WORDS (DMA_BUF_WORDS / DMA_SEGS)
+
+#define DMA_BENCH_CHUNKS 4
+#define DMA_BENCH_CHUNK_WORDS (DMA_BUF_WORDS / DMA_BENCH_CHUNKS)
 
 #if TEST_TRCH_DMA_CB
 static void dma_tx_completed(void *arg, int rc)
@@ -24,19 +33,249 @@ static void dma_tx_completed(void *arg, int rc)
 }
 #endif // TEST_TRCH_DMA_CB
 
+static int check_mcode_mov(unsigned off, uint8_t dst, uint32_t val)
+{
+    uint32_t imm = trch_dma_mcode[off + 2] |
+                   (trch_dma_mcode[off + 3] << 8) |
+                   (trch_dma_mcode[off + 4] << 16) |
+                   (trch_dma_mcode[off + 5] << 24);
+    if (trch_dma_mcode[off] != 0xbc /* DMAMOV */ ||
+        trch_dma_mcode[off + 1] != dst || (dst != 1 /* CCR */ && imm != val)) {
+        printf("DMA SG test: unexpected microcode at %u: %02x %02x %08x\r\n",
+               off, trch_dma_mcode[off], trch_dma_mcode[off + 1], imm);
+        return 1;
+    }
+    return 0;
+}
+
+// Copy segments of src to dst in reverse order
+static int test_trch_dma_sg()
+{
+    struct dma_sg sg[DMA_SEGS];
+    unsigned s, i;
+
+    bzero(dma_dst_buf, sizeof(dma_dst_buf));
+
+    for (s = 0; s < DMA_SEGS; ++s) {
+        sg[s].src = &dma_src_buf[s * DMA_SEG_WORDS];
+        sg[s].dst = &dma_dst_buf[(DMA_SEGS - 1 - s) * DMA_SEG_WORDS];
+        sg[s].sz = DMA_SEG_WORDS * sizeof(uint32_t);
+    }
+
+#if TEST_TRCH_DMA_CB
+    bool dma_done = false;
+#endif
+
+    struct dma_tx *dma_tx =
+        dma_transfer_sg(trch_dma, /* chan */ 0, sg, DMA_SEGS,
+#if TEST_TRCH_DMA_CB
+                     dma_tx_completed, &dma_done);
+#else
+                     NULL, NULL);
+#endif
+    if (!dma_tx)
+        return 1;
+
+    printf("Waiting for DMA SG tx to complete\r\n");
+#if TEST_TRCH_DMA_CB
+    while (!dma_done);
+#else
+    int rc = dma_wait(dma_tx);
+    if (rc)
+        return 1;
+#endif
+    printf("DMA SG tx completed\r\n");
+
+    for (s = 0; s < DMA_SEGS; ++s) {
+        for (i = 0; i < DMA_SEG_WORDS; ++i) {
+            if (sg[s].dst[i] != sg[s].src[i]) {
+                printf("DMA SG test: seg %u: dest contents does not match src\r\n", s);
+                return 1;
+            }
+        }
+    }
+
+    // The program for the first batch (in request slot 0 of channel 0) starts
+    // with: DMAMOV CCR; DMAMOV SAR, seg0.src; DMAMOV DAR, seg0.dst
+    if (check_mcode_mov(0, 1, 0) ||
+        check_mcode_mov(6, 0, (uint32_t)sg[0].src) ||
+        check_mcode_mov(12, 2, (uint32_t)sg[0].dst))
+        return 1;
+
+    return 0;
+}
+
+static int bench_check(const char *name, uint32_t cycles)
+{
+    for (unsigned i = 0; i < DMA_BUF_WORDS; ++i) {
+        if (dma_dst_buf[i] != dma_src_buf[i]) {
+            printf("DMA bench: %s: dest contents does not match src\r\n", name);
+            return 1;
+        }
+    }
+    printf("DMA bench: %s: %u chunks x %u bytes: %u cycles\r\n", name,
+           DMA_BENCH_CHUNKS, DMA_BENCH_CHUNK_WORDS * sizeof(uint32_t), cycles);
+    return 0;
+}
+
+// An allocated channel is not taken by a transfer that names it by number,
+// and takes transfers through the handle from dma_chan_alloc
+static int test_trch_dma_chan_alloc()
+{
+    int chan = dma_chan_alloc(trch_dma);
+    struct dma_tx *tx;
+    int rc = 1;
+
+    if (chan < 0)
+        return 1;
+    tx = dma_transfer(trch_dma, chan & ~DMA_CHAN_OWNED,
+                      dma_src_buf, dma_dst_buf, sizeof(dma_dst_buf),
+                      NULL, NULL);
+    if (tx) {
+        dma_wait(tx);
+        printf("DMA chan alloc test: allocated channel taken by number\r\n");
+        goto out;
+    }
+    tx = dma_transfer(trch_dma, chan, dma_src_buf, dma_dst_buf,
+                      sizeof(dma_dst_buf), NULL, NULL);
+    if (!tx || dma_wait(tx))
+        goto out;
+    rc = 0;
+out:
+    if (dma_chan_free(trch_dma, chan))
+        rc = 1;
+    return rc;
+}
+
+// Copy the buffer in chunks, first one chunk at a time on one channel, then
+// all chunks at once on whichever channels are free.
+static int test_trch_dma_bench()
+{
+    struct dma_tx *txes[DMA_BENCH_CHUNKS];
+    uint32_t start, cycles;
+    unsigned c;
+    int i, rc = 0;
+
+    cycle_counter_enable();
+
+    bzero(dma_dst_buf, sizeof(dma_dst_buf));
+    start = cycle_counter_read();
+    for (c = 0; c < DMA_BENCH_CHUNKS; ++c) {
+        struct dma_tx *tx = dma_transfer(trch_dma, /* chan */ 0,
+                &dma_src_buf[c * DMA_BENCH_CHUNK_WORDS],
+                &dma_dst_buf[c * DMA_BENCH_CHUNK_WORDS],
+                DMA_BENCH_CHUNK_WORDS * sizeof(uint32_t), NULL, NULL);
+        if (!tx || dma_wait(tx))
+            return 1;
+    }
+    cycles = cycle_counter_read() - start;
+    if (bench_check("serial", cycles))
+        return 1;
+
+    bzero(dma_dst_buf, sizeof(dma_dst_buf));
+    start = cycle_counter_read();
+    for (c = 0; c < DMA_BENCH_CHUNKS; ++c) {
+        txes[c] = dma_transfer(trch_dma, DMA_CHAN_ANY,
+                &dma_src_buf[c * DMA_BENCH_CHUNK_WORDS],
+                &dma_dst_buf[c * DMA_BENCH_CHUNK_WORDS],
+                DMA_BENCH_CHUNK_WORDS * sizeof(uint32_t), NULL, NULL);
+    }
+    for (c = 0; c < DMA_BENCH_CHUNKS; ++c) {
+        if (!txes[c])
+            rc = 1;
+    }
+    while ((i = dma_wait_any(txes, DMA_BENCH_CHUNKS)) >= 0) { // in completion order
+        if (dma_wait(txes[i]))
+            rc = 1;
+        txes[i] = NULL;
+    }
+    cycles = cycle_counter_read() - start;
+    if (rc)
+        return 1;
+    return bench_check("parallel", cycles);
+}
+
+// Copy a range with an odd size between odd offsets, which is split into a
+// head and tail copied by the CPU and a body copied by DMA. Bytes around the
+// destination range must not be touched.
+static int test_trch_dma_unaligned()
+{
+    const unsigned src_off = 3, dst_off = 1;
+    const unsigned sz = sizeof(dma_src_buf) / 2 + 77;
+    const uint32_t fill = 0xdeadbeef;
+    uint8_t *src = (uint8_t *)dma_src_buf + src_off;
+    uint8_t *dst = (uint8_t *)dma_dst_buf + dst_off;
+    unsigned i;
+
+    for (i = 0; i < DMA_BUF_WORDS; ++i)
+        dma_dst_buf[i] = fill;
+
+    struct dma_tx *tx = dma_transfer(trch_dma, /* chan */ 0,
+            (uint32_t *)src, (uint32_t *)dst, sz, NULL, NULL);
+    if (!tx || dma_wait(tx))
+        return 1;
+
+    for (i = 0; i < sizeof(dma_dst_buf); ++i) {
+        uint8_t b = ((uint8_t *)dma_dst_buf)[i];
+        uint8_t exp = (i >= dst_off && i < dst_off + sz) ?
+            src[i - dst_off] : ((const uint8_t *)&fill)[i % 4];
+        if (b != exp) {
+            printf("DMA unaligned test: byte %u: %02x != %02x\r\n", i, b, exp);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Time the setup (compile and launch) of a transfer of a size not used by
+// the other tests, then of one of the same shape at different addresses,
+// which should hit in the microcode cache and only patch SAR/DAR.
+static int test_trch_dma_mcode_cache()
+{
+    const unsigned words = DMA_BUF_WORDS / 2 + DMA_BUF_WORDS / 4;
+    const unsigned offs[] = { 0, DMA_BUF_WORDS / 4 };
+    uint32_t cycles[2];
+    unsigned r, i;
+
+    cycle_counter_enable();
+
+    for (r = 0; r < 2; ++r) {
+        bzero(dma_dst_buf, sizeof(dma_dst_buf));
+        uint32_t start = cycle_counter_read();
+        struct dma_tx *tx = dma_transfer(trch_dma, /* chan */ 0,
+                &dma_src_buf[offs[r]], &dma_dst_buf[offs[r]],
+                words * sizeof(uint32_t), NULL, NULL);
+        cycles[r] = cycle_counter_read() - start;
+        if (!tx || dma_wait(tx))
+            return 1;
+        for (i = offs[r]; i < offs[r] + words; ++i) {
+            if (dma_dst_buf[i] != dma_src_buf[i]) {
+                printf("DMA mcode cache test: dest contents does not match src\r\n");
+                return 1;
+            }
+        }
+    }
+    printf("DMA bench: setup of %u bytes: compile %u cycles, cached %u cycles\r\n",
+           words * sizeof(uint32_t), cycles[0], cycles[1]);
+    return 0;
+}
+
 int test_trch_dma()
 {
     nvic_int_enable(TRCH_IRQ__TRCH_DMA_ABORT);
     nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV0);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV1);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV2);
+    nvic_int_enable(TRCH_IRQ__TRCH_DMA_EV3);
 
     trch_dma = dma_create("TRCH", TRCH_DMA_BASE,
                           trch_dma_mcode, sizeof(trch_dma_mcode));
     if (!trch_dma)
 	return 1;
 
-    for (unsigned i = 0; i < sizeof(dma_src_buf) / sizeof(dma_src_buf[0]); ++i)
+    for (unsigned i = 0; i < DMA_BUF_WORDS; ++i)
         dma_src_buf[i] = 0xf00d0000 | i;
-    dump_buf("DMA src", dma_src_buf, sizeof(dma_src_buf) / sizeof(dma_src_buf[0]));
+    dump_buf("DMA src", dma_src_buf, DMA_BUF_WORDS);
 
 #if TEST_TRCH_DMA_CB
     bool dma_done = false;
@@ -63,18 +302,36 @@ int test_trch_dma()
 #endif
     printf("DMA tx completed\r\n");
 
-    dump_buf("DMA dst", dma_dst_buf, sizeof(dma_dst_buf) / sizeof(dma_dst_buf[0]));
-    for (unsigned i = 0; i < sizeof(dma_dst_buf) / sizeof(dma_dst_buf[0]); ++i) {
+    dump_buf("DMA dst", dma_dst_buf, DMA_BUF_WORDS);
+    for (unsigned i = 0; i < DMA_BUF_WORDS; ++i) {
         if (dma_dst_buf[i] != dma_src_buf[i]) {
 	    printf("DMA test: dest contents does not match src\r\n");
             return 1;
 	}
     }
 
+    if (test_trch_dma_sg())
+        return 1;
+
+    if (test_trch_dma_chan_alloc())
+        return 1;
+
+    if (test_trch_dma_bench())
+        return 1;
+
+    if (test_trch_dma_mcode_cache())
+        return 1;
+
+    if (test_trch_dma_unaligned())
+        return 1;
+
     dma_destroy(trch_dma);
 
     nvic_int_disable(TRCH_IRQ__TRCH_DMA_ABORT);
     nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV0);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV1);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV2);
+    nvic_int_disable(TRCH_IRQ__TRCH_DMA_EV3);
 
     return 0;
 }
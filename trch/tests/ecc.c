@@ -0,0 +1,75 @@
+#include <stdint.h>
+
+#include "printf.h"
+#include "arm.h"
+#include "ecc.h"
+#include "test.h"
+
+#define ECC_BUF_SIZE    (4 * 512 + 100) // last step partial
+#define ECC_STEP        512
+
+static uint8_t ecc_buf[ECC_BUF_SIZE] __attribute__((aligned(4)));
+static uint8_t ecc_code[ECC_SIZE(ECC_BUF_SIZE, ECC_STEP)];
+
+// Flip one bit in each step (and one in the ECC of the last step), and
+// expect the batch correction to restore the buffer
+static int test_ecc_correct()
+{
+    unsigned steps, i;
+    int rc;
+
+    for (i = 0; i < ECC_BUF_SIZE; ++i)
+        ecc_buf[i] = i * 7 + (i >> 9);
+
+    steps = calculate_ecc_steps(ecc_buf, ECC_BUF_SIZE, ECC_STEP, ecc_code);
+    if (steps * ECC_512_SIZE != sizeof(ecc_code)) {
+        printf("ECC test: %u steps, expected %u\r\n",
+               steps, sizeof(ecc_code) / ECC_512_SIZE);
+        return 1;
+    }
+
+    for (i = 0; i < steps - 1; ++i)
+        ecc_buf[i * ECC_STEP + i * 31] ^= 1 << (i % 8);
+    ecc_code[(steps - 1) * ECC_512_SIZE] ^= 0x10;
+
+    rc = correct_data_steps(ecc_buf, ECC_BUF_SIZE, ecc_code, ECC_STEP);
+    if (rc != steps) {
+        printf("ECC test: corrected %d steps, expected %u\r\n", rc, steps);
+        return 1;
+    }
+    for (i = 0; i < ECC_BUF_SIZE; ++i) {
+        if (ecc_buf[i] != (uint8_t)(i * 7 + (i >> 9))) {
+            printf("ECC test: data not corrected at %u\r\n", i);
+            return 1;
+        }
+    }
+
+    // Two flips in one step can be detected but not corrected
+    ecc_code[(steps - 1) * ECC_512_SIZE] ^= 0x10;
+    ecc_buf[3] ^= 0x1;
+    ecc_buf[100] ^= 0x4;
+    if (correct_data_steps(ecc_buf, ECC_BUF_SIZE, ecc_code, ECC_STEP) >= 0) {
+        printf("ECC test: double bit error not detected\r\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void test_ecc_bench()
+{
+    uint32_t start, cycles;
+
+    cycle_counter_enable();
+    start = cycle_counter_read();
+    calculate_ecc_steps(ecc_buf, ECC_BUF_SIZE, ECC_STEP, ecc_code);
+    cycles = cycle_counter_read() - start;
+    printf("ECC bench: %u bytes: %u cycles\r\n", ECC_BUF_SIZE, cycles);
+}
+
+int test_ecc()
+{
+    if (test_ecc_correct())
+        return 1;
+    test_ecc_bench();
+    return 0;
+}
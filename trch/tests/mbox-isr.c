@@ -0,0 +1,100 @@
+#include <stdint.h>
+
+#include "arm.h"
+#include "hwinfo.h"
+#include "mailbox.h"
+#include "nvic.h"
+#include "printf.h"
+#include "test.h"
+
+// Cycles spent in the mailbox ISR dispatch as more mailboxes are claimed, on
+// a fake IP block in RAM (the mailboxes never raise the IRQ, the test calls
+// the ISR). The event is raised on the last claimed instance, the worst case.
+
+#define FAKE_MBOX_INSTANCES 32
+#define BENCH_ITERS         64
+#define BENCH_INT_IDX       0
+#define EVENT_A             0x1
+
+struct fake_mbox {
+    uint32_t config;
+    uint32_t event_cause;
+    uint32_t event_status;
+    uint32_t int_enable;
+    uint32_t data[HPSC_MBOX_DATA_REGS];
+};
+
+static struct fake_mbox fake_block[FAKE_MBOX_INSTANCES];
+static struct mbox *mboxes[FAKE_MBOX_INSTANCES];
+static unsigned rcv_count[FAKE_MBOX_INSTANCES];
+
+static void handle_rcv(void *arg)
+{
+    unsigned i = (unsigned)arg;
+    rcv_count[i]++;
+    fake_block[i].event_cause = 0; // what writing REG_EVENT_CLEAR would do
+}
+
+static int bench(unsigned n)
+{
+    uint32_t start, cycles, min = ~0, max = 0, total = 0;
+    unsigned target = n - 1, irq_state, i;
+
+    for (i = 0; i < n; ++i)
+        rcv_count[i] = 0;
+
+    cycle_counter_enable();
+    for (i = 0; i < BENCH_ITERS; ++i) {
+        fake_block[target].event_cause = EVENT_A;
+        irq_state = int_save_disable();
+        start = cycle_counter_read();
+        mbox_rcv_isr(BENCH_INT_IDX);
+        cycles = cycle_counter_read() - start;
+        int_restore(irq_state);
+        if (cycles < min)
+            min = cycles;
+        if (cycles > max)
+            max = cycles;
+        total += cycles;
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (rcv_count[i] != (i == target ? BENCH_ITERS : 0)) {
+            printf("MBOX ISR test: mbox %u: %u callbacks\r\n", i, rcv_count[i]);
+            return 1;
+        }
+    }
+    printf("MBOX ISR test: %u mailboxes: cycles: min %u avg %u max %u\r\n",
+           n, min, total / BENCH_ITERS, max);
+    return 0;
+}
+
+int test_mbox_isr()
+{
+    static const unsigned counts[] = { 1, 8, 32 };
+    struct irq *irq = nvic_request(TRCH_IRQ__TR_MBOX_0 + BENCH_INT_IDX);
+    union mbox_cb cb = { .rcv_cb = handle_rcv };
+    unsigned claimed = 0, c;
+    int rc = 1;
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (; claimed < counts[c]; ++claimed) {
+            mboxes[claimed] = mbox_claim((uintptr_t)fake_block, claimed,
+                                         irq, BENCH_INT_IDX,
+                                         /* owner */ 0, /* src */ 0, /* dest */ 0,
+                                         MBOX_INCOMING, cb, (void *)claimed);
+            if (!mboxes[claimed]) {
+                printf("MBOX ISR test: failed to claim mbox %u\r\n", claimed);
+                goto out;
+            }
+        }
+        if (bench(counts[c]))
+            goto out;
+    }
+    rc = 0;
+out:
+    while (claimed--)
+        mbox_release(mboxes[claimed]);
+    nvic_release(irq);
+    return rc;
+}
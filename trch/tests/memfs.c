@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "printf.h"
+#include "mem.h"
+#include "ecc.h"
+#include "sha256.h"
+#include "lz4.h"
+#include "memfs.h"
+#include "memfs-format.h"
+#include "test.h"
+
+// Round trip of a compressed file through memfs_load: the test builds an
+// image in RAM with the on-media layout (memfs-format.h), with one file
+// that is an LZ4 block that covers the extended length encodings and an
+// overlapping match, and loads it without DMA.
+
+#define LIT_LEN         20
+#define MATCH_OFFSET    10
+#define MATCH_LEN       300
+#define LAST_LEN        5
+#define FILE_SIZE       (LIT_LEN + MATCH_LEN + LAST_LEN)
+#define DATA_OFFSET     512
+#define GUARD           0xa5
+
+// Position of the high byte of the match offset in the image
+#define OFFSET_HI_POS \
+    (DATA_OFFSET + sizeof(struct lz4_header) + 2 + LIT_LEN + 1)
+
+static const char fname[] = "lz4-test";
+
+static uint8_t image[1024] __attribute__((aligned(4)));
+static uint8_t expected[FILE_SIZE];
+static uint8_t loaded[FILE_SIZE + 1] __attribute__((aligned(4)));
+
+// Sequence 1: 20 literals, then a match of 300 at offset 10 (both lengths
+// need extra bytes); sequence 2: the last 5 literals, with no match.
+static unsigned build_block(uint8_t *b)
+{
+    unsigned n = 0, i;
+
+    b[n++] = 0xff;
+    b[n++] = LIT_LEN - 15;
+    for (i = 0; i < LIT_LEN; ++i)
+        b[n++] = expected[i] = i * 13 + 1;
+    b[n++] = MATCH_OFFSET & 0xff;
+    b[n++] = MATCH_OFFSET >> 8;
+    b[n++] = 255;
+    b[n++] = MATCH_LEN - 4 - 15 - 255;
+    for (i = LIT_LEN; i < LIT_LEN + MATCH_LEN; ++i)
+        expected[i] = expected[i - MATCH_OFFSET];
+    b[n++] = LAST_LEN << 4;
+    for (i = 0; i < LAST_LEN; ++i)
+        b[n++] = expected[LIT_LEN + MATCH_LEN + i] = 0xf0 + i;
+    return n;
+}
+
+static void build_image()
+{
+    global_table *gt = (global_table *)image;
+    file_descriptor *fd = (file_descriptor *)(image + sizeof(*gt));
+    struct lz4_header *hdr = (struct lz4_header *)(image + DATA_OFFSET);
+    unsigned i;
+
+    bzero(image, sizeof(image));
+
+    hdr->magic = LZ4_MAGIC;
+    hdr->size = FILE_SIZE;
+    fd->size = sizeof(*hdr) + build_block(image + DATA_OFFSET + sizeof(*hdr));
+
+    fd->valid = 1 | FILE_FLAG_LZ4;
+    fd->offset = DATA_OFFSET;
+    fd->load_addr = (uint32_t)loaded;
+    for (i = 0; fname[i]; ++i)
+        fd->name[i] = fname[i];
+    mbedtls_sha256_ret(expected, FILE_SIZE, fd->chcksum, /* is224 */ 0);
+    calculate_ecc((uint8_t *)fd, offsetof(file_descriptor, ecc), fd->ecc);
+
+    gt->n_files = 1;
+    gt->low_mark_data = DATA_OFFSET;
+    gt->high_mark_fd = sizeof(*gt) + sizeof(*fd);
+    gt->fsize = sizeof(image);
+    calculate_ecc((uint8_t *)gt, offsetof(global_table, ecc), gt->ecc);
+}
+
+static int load(struct memfs *fs)
+{
+    uint32_t *addr;
+    unsigned i;
+
+    for (i = 0; i < sizeof(loaded); ++i)
+        loaded[i] = GUARD;
+    if (memfs_load(fs, fname, &addr))
+        return 1;
+    if ((uint8_t *)addr != loaded) {
+        printf("memfs LZ4 test: load address %p, expected %p\r\n",
+               addr, loaded);
+        return 1;
+    }
+    for (i = 0; i < FILE_SIZE; ++i) {
+        if (loaded[i] != expected[i]) {
+            printf("memfs LZ4 test: mismatch at %u: %x, expected %x\r\n",
+                   i, loaded[i], expected[i]);
+            return 1;
+        }
+    }
+    if (loaded[FILE_SIZE] != GUARD) {
+        printf("memfs LZ4 test: wrote past the end of the file\r\n");
+        return 1;
+    }
+    return 0;
+}
+
+int test_memfs_lz4()
+{
+    struct memfs *fs;
+    int rc = 1;
+
+    build_image();
+    fs = memfs_mount((uintptr_t)image, /* dmac */ NULL);
+    if (!fs)
+        return 1;
+
+    if (load(fs))
+        goto out;
+
+    // A match that reaches before the start of the output must be caught
+    image[OFFSET_HI_POS] = 0x10;
+    if (!load(fs)) {
+        printf("memfs LZ4 test: corrupted image not detected\r\n");
+        goto out;
+    }
+    rc = 0;
+out:
+    memfs_unmount(fs);
+    return rc;
+}
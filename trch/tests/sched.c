@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "printf.h"
+#include "sched.h"
+#include "test.h"
+#include "timerq.h"
+
+// Scheduler: tasks run in order of priority, a task split into steps lets a
+// task of higher priority run between its steps, a task with a pending
+// predicate runs until it has no more work, the watchdog is not kicked
+// while a ready task is starved, and a step that runs past the step budget
+// is counted as an overrun.
+
+#define HOG_STEPS       5
+#define SPLIT_STEPS     4
+#define PENDING_ITEMS   3
+#define MAX_RUNS        32
+#define STEP_MAX_MS     1
+#define SLOW_MS         (STEP_MAX_MS * 2)
+
+enum { ID_LO, ID_MID, ID_HI, ID_SPLIT, ID_PENDING, ID_HOG, ID_SLOW, NUM_IDS };
+
+static struct task *tasks[NUM_IDS];
+static unsigned runs[MAX_RUNS];
+static unsigned nruns;
+static unsigned steps;
+static unsigned items;
+static unsigned kicks;
+static unsigned kicks_while_hogging;
+static unsigned kicks_at_slow;
+
+static void log_run(unsigned id)
+{
+    if (nruns < MAX_RUNS)
+        runs[nruns] = id;
+    nruns++;
+}
+
+static void plain(void *arg)
+{
+    log_run((unsigned)arg);
+}
+
+static void split(void *arg)
+{
+    log_run(ID_SPLIT);
+    if (++steps == SPLIT_STEPS / 2)
+        task_wake(tasks[ID_HI]); // runs before the next step
+    if (steps < SPLIT_STEPS)
+        task_wake(tasks[ID_SPLIT]);
+}
+
+static void consume(void *arg)
+{
+    log_run(ID_PENDING);
+    items--;
+}
+
+static bool has_items(void *arg)
+{
+    return items > 0;
+}
+
+static void hog(void *arg)
+{
+    log_run(ID_HOG);
+    kicks_while_hogging += kicks;
+    if (++steps < HOG_STEPS)
+        task_wake(tasks[ID_HOG]);
+}
+
+// A step that waits for longer than the budget, e.g. on a device
+static void slow(void *arg)
+{
+    uint64_t end = timerq_now() + timerq_ms(SLOW_MS);
+
+    log_run(ID_SLOW);
+    kicks_at_slow = kicks;
+    while (timerq_now() < end);
+}
+
+static void kick(void *arg)
+{
+    kicks++;
+}
+
+static int expect(const char *what, const unsigned *ids, unsigned n)
+{
+    unsigned i;
+
+    if (nruns != n) {
+        printf("SCHED test: %s: %u runs, expected %u\r\n", what, nruns, n);
+        return 1;
+    }
+    for (i = 0; i < n; ++i) {
+        if (runs[i] != ids[i]) {
+            printf("SCHED test: %s: run %u: task %u, expected %u\r\n",
+                   what, i, runs[i], ids[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int test_sched()
+{
+    static const unsigned prio_order[] = { ID_HI, ID_MID, ID_LO };
+    static const unsigned split_order[] = {
+        ID_SPLIT, ID_SPLIT, ID_HI, ID_SPLIT, ID_SPLIT
+    };
+    static const unsigned pending_order[] = {
+        ID_PENDING, ID_PENDING, ID_PENDING, ID_LO
+    };
+    static const unsigned hog_order[] = {
+        ID_HOG, ID_HOG, ID_HOG, ID_HOG, ID_HOG, ID_LO
+    };
+    static const unsigned slow_order[] = { ID_SLOW, ID_LO };
+    unsigned i;
+    int rc = 1;
+
+    tasks[ID_LO] = task_create("lo", 2, plain, NULL, (void *)ID_LO);
+    tasks[ID_MID] = task_create("mid", 1, plain, NULL, (void *)ID_MID);
+    tasks[ID_HI] = task_create("hi", 0, plain, NULL, (void *)ID_HI);
+    tasks[ID_SPLIT] = task_create("split", 1, split, NULL, NULL);
+    tasks[ID_PENDING] = task_create("pending", 1, consume, has_items, NULL);
+    tasks[ID_HOG] = task_create("hog", 0, hog, NULL, NULL);
+    tasks[ID_SLOW] = task_create("slow", 0, slow, NULL, NULL);
+    for (i = 0; i < NUM_IDS; ++i)
+        if (!tasks[i])
+            goto out;
+
+    nruns = 0;
+    task_wake(tasks[ID_LO]);
+    task_wake(tasks[ID_MID]);
+    task_wake(tasks[ID_HI]);
+    sched_run();
+    if (expect("priority", prio_order, 3))
+        goto out;
+
+    nruns = steps = 0;
+    task_wake(tasks[ID_SPLIT]);
+    sched_run();
+    if (expect("steps", split_order, SPLIT_STEPS + 1))
+        goto out;
+
+    nruns = 0;
+    items = PENDING_ITEMS;
+    task_wake(tasks[ID_LO]);
+    sched_run();
+    if (expect("pending", pending_order, PENDING_ITEMS + 1))
+        goto out;
+    if (sched_pending()) {
+        printf("SCHED test: pending after run\r\n");
+        goto out;
+    }
+
+    // Supervised: a ready task of lower priority that is starved by the hog
+    // must stop the kicks until it runs
+    sched_supervise(kick, NULL, /* interval */ 0, /* step max */ 0);
+    sched_run(); // none ready: kicks
+    if (!kicks) {
+        printf("SCHED test: no kick while idle\r\n");
+        goto out;
+    }
+    nruns = steps = kicks = 0;
+    task_wake(tasks[ID_LO]);
+    task_wake(tasks[ID_HOG]);
+    sched_run();
+    if (expect("starved", hog_order, HOG_STEPS + 1))
+        goto out;
+    if (kicks_while_hogging || !kicks) {
+        printf("SCHED test: %u kicks while starved, %u after\r\n",
+               kicks_while_hogging, kicks);
+        goto out;
+    }
+
+    // With a step budget: the step that overran is reported, and the kicks
+    // resume after it, once the task of lower priority has run too
+    sched_supervise(kick, NULL, /* interval */ 0, STEP_MAX_MS);
+    nruns = kicks = 0;
+    task_wake(tasks[ID_LO]);
+    task_wake(tasks[ID_SLOW]);
+    sched_run();
+    if (expect("overrun", slow_order, 2))
+        goto out;
+    if (task_overruns(tasks[ID_SLOW]) != 1 || task_overruns(tasks[ID_LO])) {
+        printf("SCHED test: overruns: slow %u, lo %u, expected 1, 0\r\n",
+               task_overruns(tasks[ID_SLOW]), task_overruns(tasks[ID_LO]));
+        goto out;
+    }
+    if (kicks_at_slow || !kicks) {
+        printf("SCHED test: %u kicks before the overrun, %u after\r\n",
+               kicks_at_slow, kicks);
+        goto out;
+    }
+
+    sched_print_stats();
+    rc = 0;
+out:
+    sched_supervise(NULL, NULL, 0, 0);
+    for (i = 0; i < NUM_IDS; ++i)
+        if (tasks[i])
+            task_destroy(tasks[i]);
+    return rc;
+}
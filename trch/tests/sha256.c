@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "printf.h"
+#include "arm.h"
+#include "sha256.h"
+#include "test.h"
+
+#define SHA_BUF_SIZE    4096
+#define SHA_BENCH_ITERS 16
+
+// One spare word so that the data can be shifted to every misalignment
+static uint8_t sha_buf[SHA_BUF_SIZE + 4] __attribute__((aligned(4)));
+
+static const unsigned sha_chunks[] = { 1, 7, 64, 100, SHA_BUF_SIZE };
+
+static int digest_cmp(const uint8_t *a, const uint8_t *b)
+{
+    for (unsigned i = 0; i < 32; ++i)
+        if (a[i] != b[i])
+            return 1;
+    return 0;
+}
+
+static void digest(const uint8_t *data, unsigned size, unsigned chunk,
+                   uint8_t out[32])
+{
+    mbedtls_sha256_context ctx;
+    unsigned off, len;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, /* is224 */ 0);
+    for (off = 0; off < size; off += len) {
+        len = size - off < chunk ? size - off : chunk;
+        mbedtls_sha256_update_ret(&ctx, data + off, len);
+    }
+    mbedtls_sha256_finish_ret(&ctx, out);
+}
+
+// The same data must hash the same regardless of its alignment and of how it
+// is split into updates, which exercises both the word and the byte loads
+// and processing from the input as well as from the context buffer.
+static int test_sha256_align()
+{
+    uint8_t ref[32], sum[32];
+    unsigned shift, c, i;
+
+    for (i = 0; i < SHA_BUF_SIZE; ++i)
+        sha_buf[i] = i * 7 + (i >> 8);
+    digest(sha_buf, SHA_BUF_SIZE, SHA_BUF_SIZE, ref);
+
+    for (shift = 1; shift <= 4; ++shift) {
+        for (i = SHA_BUF_SIZE; i > 0; --i) // shift the data up by one byte
+            sha_buf[i] = sha_buf[i - 1];
+        for (c = 0; c < sizeof(sha_chunks) / sizeof(sha_chunks[0]); ++c) {
+            digest(sha_buf + shift, SHA_BUF_SIZE, sha_chunks[c], sum);
+            if (digest_cmp(sum, ref)) {
+                printf("SHA-256 test: mismatch at offset %u chunk %u\r\n",
+                       shift, sha_chunks[c]);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Throughput in cycles per byte: MB/s is the core clock in MHz divided by it
+static void test_sha256_bench()
+{
+    mbedtls_sha256_context ctx;
+    uint8_t sum[32];
+    uint32_t start, cycles;
+    unsigned bytes = SHA_BUF_SIZE * SHA_BENCH_ITERS;
+
+    cycle_counter_enable();
+    start = cycle_counter_read();
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, /* is224 */ 0);
+    for (unsigned i = 0; i < SHA_BENCH_ITERS; ++i)
+        mbedtls_sha256_update_ret(&ctx, sha_buf, SHA_BUF_SIZE);
+    mbedtls_sha256_finish_ret(&ctx, sum);
+    cycles = cycle_counter_read() - start;
+
+    printf("SHA-256 bench: %u bytes: %u cycles: %u.%02u cycles/byte\r\n",
+           bytes, cycles, cycles / bytes, (cycles % bytes) * 100 / bytes);
+}
+
+int test_sha256()
+{
+    if (mbedtls_sha256_self_test(/* verbose */ 1))
+        return 1;
+    if (test_sha256_align())
+        return 1;
+    test_sha256_bench();
+    return 0;
+}
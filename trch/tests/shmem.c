@@ -10,12 +10,129 @@ static char buf[HPSC_SHMEM_REGION_SZ] = {0};
 // a dummy shared memory region
 static char shmem_reg[HPSC_SHMEM_REGION_SZ] = {0};
 
+// Ring: records of varying lengths, several in flight, wrapping around
+#define RING_SLOTS      8
+#define RING_ROUNDS     200
+#define RING_MAX_LEN    (3 * HPSC_SHMEM_RING_SLOT_SIZE)
+static uint8_t ring_reg[HPSC_SHMEM_RING_SZ(RING_SLOTS)]
+    __attribute__((aligned(HPSC_SHMEM_CACHE_LINE)));
+static uint8_t ring_msg[RING_MAX_LEN] __attribute__((aligned(4)));
+static uint8_t ring_buf[RING_MAX_LEN] __attribute__((aligned(4)));
+
+static unsigned ring_len(unsigned seq)
+{
+    return 1 + (seq * 37) % RING_MAX_LEN;
+}
+
+static void ring_fill(uint8_t *p, unsigned seq)
+{
+    for (unsigned i = 0; i < ring_len(seq); ++i)
+        p[i] = seq + i;
+}
+
+static int test_shmem_ring()
+{
+    struct shmem *prod, *cons;
+    unsigned sent = 0, rcvd = 0, round, i;
+    int sz, ret = 1;
+
+    prod = shmem_ring_open((uintptr_t)ring_reg, /* producer */ true,
+                           RING_SLOTS);
+    if (!prod)
+        return 1;
+    cons = shmem_ring_open((uintptr_t)ring_reg, /* producer */ false, 0);
+    if (!cons) {
+        shmem_close(prod);
+        return 1;
+    }
+
+    for (round = 0; round < RING_ROUNDS; ++round) {
+        // fill until full, then drain some: records stay in flight
+        do {
+            ring_fill(ring_msg, sent);
+        } while (shmem_ring_send(prod, ring_msg, ring_len(sent)) > 0 &&
+                 ++sent);
+        for (i = 0; i < round % 4 + 1; ++i) {
+            sz = shmem_ring_recv(cons, ring_buf, sizeof(ring_buf));
+            if (!sz)
+                break;
+            ring_fill(ring_msg, rcvd);
+            if (sz != ring_len(rcvd)) {
+                printf("ERROR: TEST: shmem: ring: record %u: len %d != %u\r\n",
+                       rcvd, sz, ring_len(rcvd));
+                goto out;
+            }
+            for (unsigned b = 0; b < sz; ++b) {
+                if (ring_buf[b] != ring_msg[b]) {
+                    printf("ERROR: TEST: shmem: ring: record %u corrupted\r\n",
+                           rcvd);
+                    goto out;
+                }
+            }
+            rcvd++;
+        }
+    }
+    while ((sz = shmem_ring_recv(cons, ring_buf, sizeof(ring_buf))) > 0)
+        rcvd++;
+    if (sz || rcvd != sent) {
+        printf("ERROR: TEST: shmem: ring: sent %u, received %u\r\n",
+               sent, rcvd);
+        goto out;
+    }
+
+    // a record larger than the buffer is dropped
+    if (shmem_ring_send(prod, ring_msg, 2 * HPSC_SHMEM_RING_SLOT_SIZE) <= 0 ||
+            shmem_ring_recv(cons, ring_buf, HPSC_SHMEM_RING_SLOT_SIZE) >= 0 ||
+            shmem_ring_recv(cons, ring_buf, sizeof(ring_buf))) {
+        printf("ERROR: TEST: shmem: ring: oversized record not dropped\r\n");
+        goto out;
+    }
+
+    // a record larger than the whole ring is rejected, not "full"
+    if (shmem_ring_send(prod, ring_msg, RING_SLOTS * HPSC_SHMEM_RING_SLOT_SIZE)
+            >= 0) {
+        printf("ERROR: TEST: shmem: ring: record larger than ring accepted\r\n");
+        goto out;
+    }
+
+    // the producer restarts with records in flight and tail not at 0: the
+    // consumer drops them and resets tail, and then the ring holds as much as
+    // when it was new
+    ring_fill(ring_msg, 0);
+    if (shmem_ring_send(prod, ring_msg, 1) <= 0)
+        goto out;
+    shmem_close(prod);
+    prod = shmem_ring_open((uintptr_t)ring_reg, /* producer */ true,
+                           RING_SLOTS);
+    if (!prod)
+        goto out_cons;
+    for (i = 0; shmem_ring_send(prod, ring_msg, 1) > 0; ++i);
+    if (i != RING_SLOTS) {
+        printf("ERROR: TEST: shmem: ring: restart: %u records fit\r\n", i);
+        goto out;
+    }
+    for (i = 0; (sz = shmem_ring_recv(cons, ring_buf, sizeof(ring_buf))) > 0;
+            ++i);
+    if (sz || i != RING_SLOTS || shmem_ring_send(prod, ring_msg, 1) <= 0) {
+        printf("ERROR: TEST: shmem: ring: restart: %u records received\r\n",
+               i);
+        goto out;
+    }
+    printf("TEST: shmem: ring: %u records\r\n", sent);
+    ret = 0;
+out:
+    shmem_close(prod);
+out_cons:
+    shmem_close(cons);
+    return ret;
+}
+
 int test_shmem()
 {
     size_t sz;
     int ret = 0;
     uint32_t status;
-    struct shmem *shm = shmem_open(shmem_reg);
+    struct shmem *shm = shmem_open((uintptr_t)shmem_reg);
     if (!shm)
         return 1;
     // no flags should be set at this point
@@ -63,6 +180,10 @@ int test_shmem()
         ret = 1;
         goto out;
     }
+    if (test_shmem_ring()) {
+        ret = 1;
+        goto out;
+    }
     printf("TEST: shmem: success\r\n");
 
 out:
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "printf.h"
+#include "sleep.h"
+#include "timerq.h"
+#include "test.h"
+
+// Resolution of sleeps and timers on the tickless timer queue: each sleep
+// must last at least as long as requested and wake up within the slack
+// (instead of at the next 500 ms tick), and a periodic timer must fire at its
+// period while the core sleeps.
+
+#define SLACK_US        200
+#define PERIOD_MS       10
+#define PERIODS         10
+#define TIMEOUT_MS      20
+
+static const unsigned sleeps_us[] = { 50, 1000, 20000 };
+
+static void count(void *arg)
+{
+    (*(volatile unsigned *)arg)++;
+}
+
+static int check(const char *what, uint64_t elapsed, uint64_t expected)
+{
+    printf("TIMERQ test: %s: %u cycles, expected %u\r\n",
+           what, (uint32_t)elapsed, (uint32_t)expected);
+    if (elapsed < expected || elapsed > expected + timerq_us(SLACK_US)) {
+        printf("TIMERQ test: %s: out of bounds\r\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+int test_timerq()
+{
+    volatile unsigned ticks = 0;
+    struct timer timer = { 0 };
+    struct timeout to;
+    uint64_t start;
+    unsigned i;
+
+    for (i = 0; i < sizeof(sleeps_us) / sizeof(sleeps_us[0]); ++i) {
+        start = timerq_now();
+        usleep(sleeps_us[i]);
+        if (check("usleep", timerq_now() - start, timerq_us(sleeps_us[i])))
+            return 1;
+    }
+
+    start = timerq_now();
+    timeout_start(&to, TIMEOUT_MS);
+    while (timeout_wait(&to))
+        ;
+    if (check("timeout", timerq_now() - start, timerq_ms(TIMEOUT_MS)))
+        return 1;
+
+    timer_start(&timer, timerq_ms(PERIOD_MS), timerq_ms(PERIOD_MS),
+                count, (void *)&ticks);
+    msleep(PERIOD_MS * PERIODS + PERIOD_MS / 2);
+    timer_stop(&timer);
+    printf("TIMERQ test: periodic: %u ticks, expected %u\r\n", ticks, PERIODS);
+    if (ticks != PERIODS)
+        return 1;
+    return 0;
+}
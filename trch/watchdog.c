@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "console.h"
 #include "wdt.h"
 #include "nvic.h"
 #include "panic.h"
@@ -69,7 +70,7 @@ static void handle_timeout(struct wdt *wdt, unsigned stage, void *arg)
     const struct cpu_group *cpu_group = subsys_cpu_group(gid);
     int rc;
 
-    printf("watchdog: cpu %u: stage %u: expired\r\n", gid, stage);
+    printf_isr("watchdog: cpu %u: stage %u: expired\r\n", gid, stage);
 
     if (gid == CPU_GROUP_TRCH) {
             ASSERT(stage == 0); // no last stage interrupt, because wired to hw reset
@@ -83,7 +84,9 @@ static void handle_timeout(struct wdt *wdt, unsigned stage, void *arg)
             // to the scheduler loop, kick the WDT from that loop, and then
             // return to task (or context switch to another task). Even so, the
             // WDT would then be monitoring the scheduler, not whether any task
-            // is stuck.
+            // is stuck. With CONFIG_SCHED (which needs SysTick), the
+            // scheduler kicks only if every ready task has run since the
+            // previous kick, so it does (see sched.h).
             wdt_kick(wdt);
 #endif // !CONFIG_SYSTICK
     } else {
@@ -102,8 +105,8 @@ static void handle_timeout(struct wdt *wdt, unsigned stage, void *arg)
 
         rc = reset_assert(cpu_group->cpu_set); // will prevent all CPUs from kicking
         if (rc) {
-            printf("ERROR: WATCHDOG: failed to assert reset for cpu set: %x\r\n",
-                   cpu_group->cpu_set);
+            printf_isr("ERROR: WATCHDOG: failed to assert reset for cpu set: %x\r\n",
+                       cpu_group->cpu_set);
             return;
         }
 